@@ -0,0 +1,123 @@
+/**
+ * @file bench_dispatch.cpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 消息分发吞吐量随读线程数的变化
+ * @date 2021-01-21
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "../micro_kernel.hpp"
+
+using namespace Asty;
+
+static const int kPlugins = 1000;  ///< 注册的插件数
+
+class EchoPlugin : public IPlugin<int> {
+public:
+    EchoPlugin(const PluginKey<int> &key) : IPlugin<int>(key) {}
+
+    virtual bool plugin_init(void) override { return true; }
+    virtual bool plugin_start(void) override { return true; }
+    virtual bool plugin_task(void) override { return true; }
+    virtual bool plugin_task_en(void) override { return false; }
+    virtual bool plugin_stop(void) override { return true; }
+    virtual bool plugin_exit(void) override { return true; }
+    virtual bool notice(const PluginDataT &msg) override { return true; }
+
+    virtual bool message(const PluginMessage<int> &request,
+                         PluginMessage<int> &response) override {
+        response.data.type = request.data.type;
+        return true;
+    }
+
+    virtual bool stream(std::shared_ptr<IPluginStream<int>> stream) override {
+        return true;
+    }
+};
+
+/**
+ * @brief readers个线程持续分发消息，churn为true时另有线程不断注册注销插件
+ *
+ */
+static double bench_dispatch(MicroKernel<int> &kernel, int readers,
+                             bool churn, double seconds) {
+    std::atomic_bool stop(false);
+    std::atomic<uint64_t> total(0);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < readers; i++) {
+        threads.emplace_back([&, i] {
+            PluginKey<int> from("bench", "1.0.0", -1 - i);
+            PluginDataT req{};
+            PluginDataT res{};
+            uint64_t cnt = 0;
+
+            req.type = 1;
+
+            while (!stop) {
+                for (int k = 0; k < kPlugins; k++) {
+                    kernel.message_dispatch(from, k, req, res);
+                }
+                cnt += kPlugins;
+            }
+
+            total += cnt;
+        });
+    }
+
+    if (churn) {
+        threads.emplace_back([&] {
+            PluginKey<int> key("churn", "1.0.0", kPlugins);
+
+            while (!stop) {
+                kernel.plugin_register(std::make_shared<EchoPlugin>(key));
+                kernel.plugin_unregister(key.key);
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds((int)(seconds * 1000)));
+    stop = true;
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    return total / seconds;
+}
+
+int main(int argc, char **argv) {
+    int max_readers = argc > 1 ? atoi(argv[1]) : 0;
+
+    if (max_readers <= 0) {
+        max_readers = std::thread::hardware_concurrency() * 2;
+    }
+
+    std::shared_ptr<MicroKernelThreadPool> pool(new MicroKernelThreadPool);
+    MicroKernel<int> kernel(kPlugins + 1, pool);
+
+    for (int i = 0; i < kPlugins; i++) {
+        kernel.plugin_register(std::make_shared<EchoPlugin>(
+            PluginKey<int>("echo", "1.0.0", i)));
+    }
+
+    printf("readers,churn,dispatch_per_sec\n");
+
+    for (int readers = 1; readers <= max_readers; readers <<= 1) {
+        printf("%d,0,%.0f\n", readers,
+               bench_dispatch(kernel, readers, false, 1.0));
+        printf("%d,1,%.0f\n", readers,
+               bench_dispatch(kernel, readers, true, 1.0));
+    }
+
+    return 0;
+}
@@ -0,0 +1,518 @@
+/**
+ * @file bench_micro.cpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 微内核基准测试集：队列、线程池、消息分发和微内核循环
+ * @date 2021-01-24
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../micro_kernel.hpp"
+#include "../micro_priority_thread_pool.hpp"
+#include "../micro_ring_task_queue.hpp"
+#include "../micro_steal_thread_pool.hpp"
+#include "../micro_sync_task_queue.hpp"
+#include "../micro_thread_pool.hpp"
+
+using namespace Asty;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/**
+ * @brief 一项测试结果，延迟单位为ns，没有逐次采样时分位列输出为空，
+ * 也没有平均值时平均列输出为空
+ *
+ */
+struct BenchResult {
+    std::string suite;   ///< 测试集
+    std::string name;    ///< 测试项，通常为被测实现
+    std::string param;   ///< 参数
+    double ops_per_sec;  ///< 吞吐量
+    bool sampled;        ///< 有逐次采样，分位有效
+    bool has_mean;       ///< 平均值有效
+    double mean;         ///< 平均延迟
+    uint64_t p50;        ///< 延迟50分位
+    uint64_t p90;        ///< 延迟90分位
+    uint64_t p99;        ///< 延迟99分位
+    uint64_t p999;       ///< 延迟99.9分位
+    uint64_t max;        ///< 最大延迟
+};
+
+static std::vector<BenchResult> results;  ///< 全部结果
+static bool quick = false;                ///< 缩短测试时间
+
+static uint64_t now_ns(void) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               bench_clock::now().time_since_epoch())
+        .count();
+}
+
+// 当前线程消耗的CPU时间
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    size_t idx = (size_t)(p * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+// 记录一项结果，lat为逐次采样的延迟，为空时只有吞吐量
+static void report(const std::string &suite, const std::string &name,
+                   const std::string &param, double ops_per_sec,
+                   std::vector<uint64_t> lat = std::vector<uint64_t>()) {
+    double sum = 0;
+
+    std::sort(lat.begin(), lat.end());
+
+    for (uint64_t v : lat) {
+        sum += v;
+    }
+
+    BenchResult r{suite,
+                  name,
+                  param,
+                  ops_per_sec,
+                  !lat.empty(),
+                  !lat.empty(),
+                  lat.empty() ? 0 : sum / lat.size(),
+                  percentile(lat, 0.5),
+                  percentile(lat, 0.9),
+                  percentile(lat, 0.99),
+                  percentile(lat, 0.999),
+                  lat.empty() ? 0 : lat.back()};
+
+    results.push_back(r);
+    fprintf(stderr, "%s %s %s done\n", suite.c_str(), name.c_str(),
+            param.c_str());
+}
+
+// 记录只能测得平均值的结果，分位列为空
+static void report_mean(const std::string &suite, const std::string &name,
+                        const std::string &param, double ops_per_sec,
+                        double mean) {
+    BenchResult r{suite, name, param, ops_per_sec, false, true, mean,
+                  0,     0,    0,     0,           0};
+
+    results.push_back(r);
+    fprintf(stderr, "%s %s %s done\n", suite.c_str(), name.c_str(),
+            param.c_str());
+}
+
+// 格式化一列，无效时csv为空、json为null
+static std::string column(bool valid, double value, bool json) {
+    char buf[32];
+
+    if (!valid) {
+        return json ? "null" : "";
+    }
+
+    snprintf(buf, sizeof(buf), "%.0f", value);
+    return buf;
+}
+
+// 平均值和分位列，按csv或json格式
+static std::string lat_columns(const BenchResult &r, bool json) {
+    const char *names[] = {"mean_ns", "p50_ns", "p90_ns",
+                           "p99_ns",  "p999_ns", "max_ns"};
+    double values[] = {r.mean, (double)r.p50,  (double)r.p90,
+                       (double)r.p99, (double)r.p999, (double)r.max};
+    std::string out;
+
+    for (int i = 0; i < 6; i++) {
+        std::string value = column(0 == i ? r.has_mean : r.sampled,
+                                   values[i], json);
+
+        out += json ? std::string(", \"") + names[i] + "\": " + value
+                    : "," + value;
+    }
+
+    return out;
+}
+
+static void print_csv(void) {
+    printf("suite,name,param,ops_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,"
+           "p999_ns,max_ns\n");
+
+    for (auto &r : results) {
+        printf("%s,%s,%s,%.0f%s\n", r.suite.c_str(), r.name.c_str(),
+               r.param.c_str(), r.ops_per_sec, lat_columns(r, false).c_str());
+    }
+}
+
+static void print_json(void) {
+    printf("[\n");
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        printf("  {\"suite\": \"%s\", \"name\": \"%s\", \"param\": \"%s\", "
+               "\"ops_per_sec\": %.0f%s}%s\n",
+               r.suite.c_str(), r.name.c_str(), r.param.c_str(),
+               r.ops_per_sec, lat_columns(r, true).c_str(),
+               i + 1 < results.size() ? "," : "");
+    }
+
+    printf("]\n");
+}
+
+/**
+ * @brief 队列：producers个线程写入时间戳，consumers个线程取出并记录入队到出队的延迟
+ *
+ */
+template <typename Queue>
+static void bench_queue(const char *name, int producers, int consumers) {
+    const int per_producer = (quick ? 20000 : 200000) / producers;
+    const int total = per_producer * producers;
+    Queue queue(1024);
+    std::vector<std::vector<uint64_t>> lat(consumers);
+    std::atomic<int> popped(0);
+    std::vector<std::thread> threads;
+
+    uint64_t begin = now_ns();
+
+    for (int c = 0; c < consumers; c++) {
+        lat[c].reserve(total / consumers + 1);
+        threads.emplace_back([&, c] {
+            uint64_t ts = 0;
+
+            while (popped.load(std::memory_order_relaxed) < total &&
+                   queue.pop(ts)) {
+                lat[c].push_back(now_ns() - ts);
+                if (++popped == total) {
+                    queue.stop();
+                }
+            }
+        });
+    }
+
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < per_producer; i++) {
+                queue.push(now_ns());
+            }
+        });
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    double cost = (now_ns() - begin) / 1e9;
+    std::vector<uint64_t> all;
+
+    for (auto &l : lat) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+
+    char param[32];
+    snprintf(param, sizeof(param), "p%d_c%d", producers, consumers);
+    report("queue", name, param, total / cost, all);
+}
+
+/**
+ * @brief 线程池：外部线程添加任务的吞吐量和add_task调用耗时，
+ * 以及空闲线程池从添加到开始执行的唤醒延迟
+ *
+ */
+template <typename Pool>
+static void bench_pool(const char *name, int threads) {
+    const int tasks = quick ? 20000 : 200000;
+    char param[32];
+
+    snprintf(param, sizeof(param), "t%d", threads);
+
+    {
+        Pool pool(tasks, threads);
+        std::atomic<int> done(0);
+        std::vector<uint64_t> lat;
+
+        lat.reserve(tasks / 16 + 1);
+        uint64_t begin = now_ns();
+
+        for (int i = 0; i < tasks; i++) {
+            // 每16次采样一次调用耗时，避免计时开销主导结果
+            if (i & 15) {
+                pool.add_task([&done] { done++; });
+            } else {
+                uint64_t t = now_ns();
+                pool.add_task([&done] { done++; });
+                lat.push_back(now_ns() - t);
+            }
+        }
+
+        while (done.load() < tasks) {
+            std::this_thread::yield();
+        }
+
+        report("pool_add_task", name, param,
+               tasks / ((now_ns() - begin) / 1e9), lat);
+    }
+
+    {
+        const int samples = quick ? 200 : 2000;
+        Pool pool(16, threads);
+        std::vector<uint64_t> lat;
+        std::atomic<uint64_t> started(0);
+        uint64_t begin = now_ns();
+
+        for (int i = 0; i < samples; i++) {
+            // 等待工作线程进入休眠
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+            started = 0;
+            uint64_t submit = now_ns();
+            pool.add_task([&started] { started = now_ns(); });
+
+            while (!started.load()) {
+                std::this_thread::yield();
+            }
+
+            lat.push_back(started - submit);
+        }
+
+        report("pool_wakeup", name, param,
+               samples / ((now_ns() - begin) / 1e9), lat);
+    }
+}
+
+class BenchPlugin : public IPlugin<int> {
+public:
+    BenchPlugin(int key, uint32_t period)
+        : IPlugin<int>(PluginKey<int>("bench", "1.0.0", key)),
+          period_(period),
+          streams(0) {}
+
+    virtual bool plugin_init(void) override { return true; }
+    virtual bool plugin_start(void) override { return true; }
+    virtual bool plugin_task(void) override { return true; }
+    virtual bool plugin_task_en(void) override {
+        return E_PLUGIN_TASK_ON_READY != period_;
+    }
+    virtual uint32_t plugin_task_period(void) override { return period_; }
+    virtual bool plugin_stop(void) override { return true; }
+    virtual bool plugin_exit(void) override { return true; }
+    virtual bool notice(const PluginDataT &msg) override { return true; }
+
+    virtual bool message(const PluginMessage<int> &request,
+                         PluginMessage<int> &response) override {
+        response.data.type = request.data.type;
+        return true;
+    }
+
+    // 回送时间戳，测量分发到插件开始处理的延迟
+    virtual bool stream(std::shared_ptr<IPluginStream<int>> stream) override {
+        PluginDataT data{};
+
+        data.type = (int)streams++;
+        stream->send(data, -1);
+        return true;
+    }
+
+private:
+    uint32_t period_;
+
+public:
+    std::atomic<uint32_t> streams;  ///< 收到的流数量
+};
+
+static void register_plugins(MicroKernel<int> &kernel, int cnt,
+                             uint32_t period) {
+    std::vector<std::shared_ptr<IPlugin<int>>> plugins;
+
+    for (int i = 0; i < cnt; i++) {
+        plugins.push_back(std::make_shared<BenchPlugin>(i, period));
+    }
+
+    kernel.plugin_register(plugins);
+}
+
+/**
+ * @brief 消息分发：单线程随机目标的同步分发，以及stream_open到目标插件处理的延迟
+ *
+ */
+static void bench_dispatch(int plugins) {
+    const int calls = quick ? 100000 : 1000000;
+    std::shared_ptr<MicroKernelThreadPool> pool(
+        new MicroKernelThreadPool(1024, 2));
+    std::unique_ptr<MicroKernel<int>> holder(
+        new MicroKernel<int>(plugins + 1, pool));
+    MicroKernel<int> &kernel = *holder;
+    char param[32];
+
+    snprintf(param, sizeof(param), "n%d", plugins);
+    register_plugins(kernel, plugins, E_PLUGIN_TASK_ON_READY);
+
+    std::thread loop([&kernel] { kernel.run(); });
+
+    // 等待微内核启动
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    {
+        PluginKey<int> from("bench", "1.0.0", -1);
+        PluginDataT req{};
+        PluginDataT res{};
+        std::vector<uint64_t> lat;
+        uint32_t seed = 1;
+
+        req.type = 1;
+        lat.reserve(calls / 16 + 1);
+        uint64_t begin = now_ns();
+
+        for (int i = 0; i < calls; i++) {
+            seed = seed * 1103515245 + 12345;
+            int to = (seed >> 8) % plugins;
+
+            // 每16次采样一次延迟，避免计时开销主导结果
+            if (i & 15) {
+                kernel.message_dispatch(from, to, req, res);
+            } else {
+                uint64_t t = now_ns();
+                kernel.message_dispatch(from, to, req, res);
+                lat.push_back(now_ns() - t);
+            }
+        }
+
+        report("message_dispatch", "sync", param,
+               calls / ((now_ns() - begin) / 1e9), lat);
+    }
+
+    {
+        const int streams = quick ? 2000 : 20000;
+        PluginKey<int> from("bench", "1.0.0", -1);
+        std::vector<uint64_t> lat;
+        uint64_t begin = now_ns();
+
+        for (int i = 0; i < streams; i++) {
+            uint64_t t = now_ns();
+            auto stream = kernel.stream_open(from, i % plugins, 4);
+            PluginDataT data;
+
+            if (stream && stream->recv(data, -1) > 0) {
+                lat.push_back(now_ns() - t);
+            }
+        }
+
+        report("stream_dispatch", "open_to_first_data", param,
+               streams / ((now_ns() - begin) / 1e9), lat);
+    }
+
+    // 析构时停止微内核
+    holder.reset();
+    loop.join();
+}
+
+/**
+ * @brief 微内核循环：plugins个1ms周期插件运行一段时间，
+ * 统计微内核线程每调度一个插件任务消耗的CPU时间
+ *
+ */
+static void bench_kernel_loop(int plugins) {
+    std::shared_ptr<MicroKernelThreadPool> pool(
+        new MicroKernelThreadPool(plugins * 2 + 16, 2));
+    std::unique_ptr<MicroKernel<int>> kernel(
+        new MicroKernel<int>(plugins + 1, pool, 1));
+    std::atomic<uint64_t> cpu(0);
+    char param[32];
+
+    snprintf(param, sizeof(param), "n%d", plugins);
+    register_plugins(*kernel, plugins, E_PLUGIN_TASK_PERIOD_DEFAULT);
+
+    MicroKernel<int> *k = kernel.get();
+    std::thread loop([k, &cpu] {
+        uint64_t begin = thread_cpu_ns();
+        k->run();
+        cpu = thread_cpu_ns() - begin;
+    });
+
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(quick ? 200 : 1000));
+
+    uint64_t submitted = 0;
+
+    for (int i = 0; i < plugins; i++) {
+        PluginTaskStat stat;
+        if (kernel->plugin_task_stat(i, stat)) {
+            submitted += stat.submitted + stat.coalesced;
+        }
+    }
+
+    kernel.reset();
+    loop.join();
+
+    // 吞吐量为每秒调度的插件任务数，平均列为每个任务的微内核线程CPU时间；
+    // 微内核线程的CPU时间只能整体测量，没有逐次采样，分位列为空
+    report_mean("kernel_loop", "cpu_per_task", param,
+                submitted / (quick ? 0.2 : 1.0),
+                submitted ? (double)cpu / submitted : 0);
+}
+
+int main(int argc, char **argv) {
+    bool json = false;
+    int max_threads = std::thread::hardware_concurrency();
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json")) {
+            json = true;
+        } else if (!strcmp(argv[i], "--quick")) {
+            quick = true;
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--json] [--quick] [--threads N]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (max_threads <= 0) {
+        max_threads = 1;
+    }
+
+    for (int p = 1; p <= max_threads; p <<= 1) {
+        for (int c = 1; c <= max_threads; c <<= 1) {
+            bench_queue<MicroSyncTaskQueue<uint64_t>>("list", p, c);
+            bench_queue<MicroRingTaskQueue<uint64_t>>("ring", p, c);
+        }
+    }
+
+    for (int t = 1; t <= max_threads; t <<= 1) {
+        bench_pool<MicroKernelThreadPool>("list", t);
+        bench_pool<MicroKernelRingThreadPool>("ring", t);
+        bench_pool<MicroKernelStealThreadPool>("steal", t);
+        bench_pool<MicroKernelPriorityThreadPool>("prio", t);
+    }
+
+    for (int n : {10, 1000, 100000}) {
+        bench_dispatch(n);
+    }
+
+    for (int n : {10, 1000}) {
+        bench_kernel_loop(n);
+    }
+
+    if (json) {
+        print_json();
+    } else {
+        print_csv();
+    }
+
+    return 0;
+}
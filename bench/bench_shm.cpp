@@ -0,0 +1,237 @@
+/**
+ * @file bench_shm.cpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 进程内与共享内存跨进程插件的往返延迟
+ * @date 2021-02-03
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "../micro_kernel.hpp"
+#include "../micro_shm_plugin.hpp"
+
+using namespace Asty;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static const char *kChannel = "/asty_bench_shm";  ///< 共享内存名称
+static const int kLocal = 1;                      ///< 进程内插件key
+static const int kRemote = 2;                     ///< 宿主进程插件key
+
+/**
+ * @brief 应答请求数据，流数据原样发回
+ *
+ */
+class EchoPlugin : public IPlugin<int> {
+public:
+    EchoPlugin(const PluginKey<int> &key) : IPlugin<int>(key) {}
+
+    virtual bool plugin_init(void) override { return true; }
+    virtual bool plugin_start(void) override { return true; }
+    virtual bool plugin_task(void) override { return true; }
+    virtual bool plugin_task_en(void) override { return false; }
+    virtual bool plugin_stop(void) override { return true; }
+    virtual bool plugin_exit(void) override { return true; }
+    virtual bool notice(const PluginDataT &msg) override { return true; }
+
+    virtual bool message(const PluginMessage<int> &request,
+                         PluginMessage<int> &response) override {
+        response.data = request.data;
+        return true;
+    }
+
+    virtual bool stream(std::shared_ptr<IPluginStream<int>> stream) override {
+        std::thread([stream] {
+            PluginDataT data{};
+
+            while (stream->recv(data) > 0) {
+                stream->send(data);
+            }
+        }).detach();
+
+        return true;
+    }
+};
+
+// 延迟分位，单位ns
+static uint64_t percentile(std::vector<uint64_t> &lat, double p) {
+    return lat[std::min(lat.size() - 1, (size_t)(lat.size() * p))];
+}
+
+static void report(const char *path, const char *op, int size,
+                   std::vector<uint64_t> &lat) {
+    uint64_t sum = 0;
+
+    for (uint64_t ns : lat) {
+        sum += ns;
+    }
+
+    std::sort(lat.begin(), lat.end());
+    printf("%s,%s,%d,%.0f,%lu,%lu\n", path, op, size,
+           (double)sum / lat.size(), (unsigned long)percentile(lat, 0.5),
+           (unsigned long)percentile(lat, 0.99));
+}
+
+// 同步消息分发的往返延迟
+static void bench_message(MicroKernel<int> &kernel, const char *path, int to,
+                          int size, int rounds) {
+    PluginKey<int> from("bench", "1.0.0", 0);
+    PluginDataT req{};
+    std::vector<uint64_t> lat;
+
+    req.set_buffer(kernel.buffer_alloc(size), size);
+    lat.reserve(rounds);
+
+    for (int i = 0; i < rounds; i++) {
+        PluginDataT res{};
+        auto begin = bench_clock::now();
+
+        if (!kernel.message_dispatch(from, to, req, res) || res.len != size) {
+            printf("%s,message,%d,failed\n", path, size);
+            return;
+        }
+
+        lat.push_back((bench_clock::now() - begin).count());
+    }
+
+    report(path, "message", size, lat);
+}
+
+// 流发送一个数据并收到回送的往返延迟
+static void bench_stream(MicroKernel<int> &kernel, const char *path, int to,
+                         int size, int rounds) {
+    PluginKey<int> from("bench", "1.0.0", 0);
+    auto stream = kernel.stream_open(from, to);
+    PluginDataT data{};
+    std::vector<uint64_t> lat;
+
+    if (!stream) {
+        printf("%s,stream,%d,failed\n", path, size);
+        return;
+    }
+
+    data.set_buffer(kernel.buffer_alloc(size), size);
+    lat.reserve(rounds);
+
+    for (int i = 0; i < rounds; i++) {
+        PluginDataT echo{};
+        auto begin = bench_clock::now();
+
+        if (stream->send(data) <= 0 || stream->recv(echo) <= 0) {
+            printf("%s,stream,%d,failed\n", path, size);
+            return;
+        }
+
+        lat.push_back((bench_clock::now() - begin).count());
+    }
+
+    stream->close();
+    report(path, "stream", size, lat);
+}
+
+// 宿主进程，处理完通道关闭后退出
+static void host_main(void) {
+    auto channel = MicroShmChannel::open(kChannel, 1000000);
+
+    if (!channel) {
+        _exit(1);
+    }
+
+    std::shared_ptr<IThreadPool> pool(new MicroKernelThreadPool(1024, 2));
+    MicroShmPluginHost<int> host(
+        channel,
+        std::make_shared<EchoPlugin>(PluginKey<int>("echo", "1.0.0", kRemote)),
+        pool);
+
+    host.run();
+    _exit(0);
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 0;
+
+    if (rounds <= 0) {
+        rounds = 20000;
+    }
+
+    // 在创建任何线程之前启动宿主进程
+    auto channel = MicroShmChannel::create(kChannel);
+
+    if (!channel) {
+        perror("shm_open");
+        return 1;
+    }
+
+    pid_t pid = fork();
+
+    if (0 == pid) {
+        host_main();
+    }
+
+    std::shared_ptr<MicroKernelThreadPool> pool(
+        new MicroKernelThreadPool(1024, 4));
+    std::shared_ptr<MicroKernel<int>> holder(new MicroKernel<int>(8, pool));
+    MicroKernel<int> &kernel = *holder;
+    std::shared_ptr<MicroShmPluginProxy<int>> remote(
+        new MicroShmPluginProxy<int>(
+            PluginKey<int>("echo", "1.0.0", kRemote), channel));
+
+    kernel.plugin_register(std::make_shared<EchoPlugin>(
+        PluginKey<int>("echo", "1.0.0", kLocal)));
+    kernel.plugin_register(remote);
+
+    std::thread loop([&kernel] { kernel.run(); });
+
+    while (E_PLUGIN_RUNING != remote->plugin_status()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    printf("path,op,size,mean_ns,p50_ns,p99_ns\n");
+
+    for (int size : {16, 1024, 16384}) {
+        bench_message(kernel, "local", kLocal, size, rounds);
+        bench_message(kernel, "shm", kRemote, size, rounds);
+    }
+
+    for (int size : {16, 1024}) {
+        bench_stream(kernel, "local", kLocal, size, rounds);
+        bench_stream(kernel, "shm", kRemote, size, rounds);
+    }
+
+    // 宿主进程崩溃后调用立即失败，插件进入异常状态
+    kill(pid, SIGKILL);
+
+    PluginKey<int> from("bench", "1.0.0", 0);
+    PluginDataT req{};
+    PluginDataT res{};
+    auto begin = bench_clock::now();
+
+    while (kernel.message_dispatch(from, kRemote, req, res)) {
+    }
+
+    std::chrono::duration<double, std::milli> cost =
+        bench_clock::now() - begin;
+
+    while (E_PLUGIN_BAD != remote->plugin_status()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    printf("# host killed: dispatch failed after %.1f ms\n", cost.count());
+
+    waitpid(pid, nullptr, 0);
+    holder.reset();
+    loop.join();
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file bench_stream.cpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 每个流一个线程与反应器驱动的流在大量长连接下的对比
+ * @date 2021-02-04
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "../micro_kernel.hpp"
+
+using namespace Asty;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static const int kRounds = 20;  ///< 每个流的往返次数
+
+/**
+ * @brief 流数据原样发回，reactor为false时每个流占用一个线程
+ *
+ */
+class EchoPlugin : public IPlugin<int> {
+public:
+    EchoPlugin(const PluginKey<int> &key, bool reactor)
+        : IPlugin<int>(key), reactor_(reactor) {}
+
+    virtual bool plugin_init(void) override { return true; }
+    virtual bool plugin_start(void) override { return true; }
+    virtual bool plugin_task(void) override { return true; }
+    virtual bool plugin_task_en(void) override { return false; }
+    virtual bool plugin_stop(void) override { return true; }
+    virtual bool plugin_exit(void) override { return true; }
+    virtual bool notice(const PluginDataT &msg) override { return true; }
+
+    virtual bool message(const PluginMessage<int> &request,
+                         PluginMessage<int> &response) override {
+        return true;
+    }
+
+    virtual bool stream(std::shared_ptr<IPluginStream<int>> stream) override {
+        if (reactor_) {
+            return true;
+        }
+
+        std::thread([stream] {
+            PluginDataT data{};
+
+            while (stream->recv(data) > 0) {
+                stream->send(data);
+            }
+        }).detach();
+
+        return true;
+    }
+
+    virtual bool plugin_stream_reactor(void) override { return reactor_; }
+
+    virtual bool stream_ready(
+        std::shared_ptr<IPluginStream<int>> stream) override {
+        PluginDataT data{};
+        int n;
+
+        while ((n = stream->recv(data, 0)) > 0) {
+            stream->send(data, 0);
+        }
+
+        return n >= 0;
+    }
+
+private:
+    bool reactor_;  ///< 由反应器驱动
+};
+
+// 进程当前的线程数
+static int thread_count(void) {
+    FILE *fp = fopen("/proc/self/status", "r");
+    char line[256];
+    int cnt = -1;
+
+    if (!fp) {
+        return cnt;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (!strncmp(line, "Threads:", 8)) {
+            cnt = atoi(line + 8);
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    return cnt;
+}
+
+// 打开streams个流，每轮向所有流各发一个数据再逐个收回
+static void bench_streams(const char *mode, bool reactor, int streams) {
+    std::shared_ptr<MicroKernelThreadPool> pool(
+        new MicroKernelThreadPool(streams * 2, 4));
+    std::shared_ptr<MicroKernel<int>> holder(new MicroKernel<int>(8, pool));
+    MicroKernel<int> &kernel = *holder;
+    PluginKey<int> from("bench", "1.0.0", 0);
+    std::vector<std::shared_ptr<IPluginStream<int>>> opened;
+
+    kernel.plugin_register(
+        std::make_shared<EchoPlugin>(PluginKey<int>("echo", "1.0.0", 1),
+                                     reactor));
+
+    std::thread loop([&kernel] { kernel.run(); });
+
+    for (int i = 0; i < streams; i++) {
+        auto stream = kernel.stream_open(from, 1);
+
+        if (!stream) {
+            printf("%s,%d,open failed\n", mode, streams);
+            break;
+        }
+
+        opened.push_back(stream);
+    }
+
+    uint64_t good = 0;
+    auto begin = bench_clock::now();
+
+    for (int r = 0; r < kRounds; r++) {
+        for (auto &stream : opened) {
+            PluginDataT data{};
+
+            data.type = r;
+            stream->send(data);
+        }
+
+        for (auto &stream : opened) {
+            PluginDataT data{};
+
+            if (stream->recv(data, 1000000) > 0 && data.type == r) {
+                good++;
+            }
+        }
+    }
+
+    std::chrono::duration<double> cost = bench_clock::now() - begin;
+    int threads = thread_count();
+
+    printf("%s,%d,%d,%lu,%.0f\n", mode, streams, threads, (unsigned long)good,
+           good / cost.count());
+
+    for (auto &stream : opened) {
+        stream->close();
+    }
+
+    opened.clear();
+    holder.reset();
+    loop.join();
+}
+
+int main(int argc, char **argv) {
+    int streams = argc > 1 ? atoi(argv[1]) : 0;
+
+    if (streams <= 0) {
+        streams = 1000;
+    }
+
+    printf("mode,streams,threads,echoed,echo_per_sec\n");
+
+    bench_streams("thread", false, streams);
+    bench_streams("reactor", true, streams);
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file bench_task.cpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 每次提交任务的内存分配次数
+ * @date 2021-02-02
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include "../micro_priority_thread_pool.hpp"
+#include "../micro_steal_thread_pool.hpp"
+#include "../micro_thread_pool.hpp"
+
+using namespace Asty;
+
+static const int kTasks = 100000;  ///< 每轮提交的任务数
+
+static std::atomic<uint64_t> g_allocs(0);  ///< 全局分配次数
+
+// 替换的分配函数不内联，否则编译器在调用处看到free释放operator new的
+// 结果，误报new与delete不匹配；数组形式同样计数，与单对象形式成对替换
+__attribute__((noinline)) void *operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+
+    void *p = malloc(size ? size : 1);
+
+    if (!p) {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+__attribute__((noinline)) void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+/**
+ * @brief 超过内联存储的捕获
+ *
+ */
+struct LargeCapture {
+    char pad[MicroTask::kInlineSize + 16];  ///< 填充
+};
+
+// 提交kTasks个任务并等待执行完，返回平均每个任务的分配次数
+template <typename Make>
+static double bench_submit(IThreadPool &pool, Make make) {
+    std::atomic<int> done(0);
+    uint64_t begin = g_allocs.load();
+
+    for (int i = 0; i < kTasks; i++) {
+        pool.add_task(make(done));
+    }
+
+    while (done.load() < kTasks) {
+        std::this_thread::yield();
+    }
+
+    return (double)(g_allocs.load() - begin) / kTasks;
+}
+
+template <typename Pool>
+static void bench_pool(const char *name, int threads) {
+    Pool pool(kTasks, threads);
+
+    auto small = [](std::atomic<int> &done) {
+        return [&done] { done++; };
+    };
+
+    auto large = [](std::atomic<int> &done) {
+        LargeCapture capture{};
+
+        return [&done, capture] { done += 1 + capture.pad[0]; };
+    };
+
+    // 第一轮使队列缓冲区增长到稳定容量
+    bench_submit(pool, small);
+
+    printf("%s,small,%d,%.3f\n", name, threads, bench_submit(pool, small));
+    printf("%s,large,%d,%.3f\n", name, threads, bench_submit(pool, large));
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 2;
+
+    if (threads <= 0) {
+        threads = 2;
+    }
+
+    printf("pool,capture,threads,allocs_per_task\n");
+
+    bench_pool<MicroKernelThreadPool>("sync", threads);
+    bench_pool<MicroKernelRingThreadPool>("ring", threads);
+    bench_pool<MicroKernelPriorityThreadPool>("priority", threads);
+    bench_pool<MicroKernelStealThreadPool>("steal", threads);
+
+    return 0;
+}
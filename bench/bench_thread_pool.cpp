@@ -0,0 +1,166 @@
+/**
+ * @file bench_thread_pool.cpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 线程池吞吐量对比
+ * @date 2021-01-20
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include "../micro_steal_thread_pool.hpp"
+#include "../micro_thread_pool.hpp"
+
+using namespace Asty;
+
+static const int kRootTasks = 2000;  ///< 外部提交的根任务数
+static const int kFanOut = 32;       ///< 每个根任务在工作线程内派生的子任务数
+static const int kBulk = 64;         ///< 批量提交时每批的任务数
+static const int kDrain = 16;        ///< 批量提交时工作线程每次取出的任务数
+
+// 模拟少量计算
+static void spin_work(int n) {
+    volatile int x = 0;
+    for (int i = 0; i < n; i++) {
+        x += i;
+    }
+}
+
+/**
+ * @brief 嵌套派生：外部提交根任务，根任务在工作线程内继续添加子任务，
+ * 对应stream_dispatch和message_dispatch扇出的场景
+ *
+ */
+static double bench_fan_out(IThreadPool &pool) {
+    std::atomic<int> done(0);
+    const int total = kRootTasks * (kFanOut + 1);
+    auto begin = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < kRootTasks; i++) {
+        pool.add_task([&pool, &done] {
+            for (int j = 0; j < kFanOut; j++) {
+                pool.add_task([&done] {
+                    spin_work(200);
+                    done++;
+                });
+            }
+            done++;
+        });
+    }
+
+    while (done.load() < total) {
+        std::this_thread::yield();
+    }
+
+    std::chrono::duration<double> cost =
+        std::chrono::steady_clock::now() - begin;
+
+    return total / cost.count();
+}
+
+/**
+ * @brief 外部提交：所有任务都由外部线程提交，没有嵌套
+ *
+ */
+static double bench_flat(IThreadPool &pool) {
+    std::atomic<int> done(0);
+    const int total = kRootTasks * kFanOut;
+    auto begin = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < total; i++) {
+        pool.add_task([&done] {
+            spin_work(200);
+            done++;
+        });
+    }
+
+    while (done.load() < total) {
+        std::this_thread::yield();
+    }
+
+    std::chrono::duration<double> cost =
+        std::chrono::steady_clock::now() - begin;
+
+    return total / cost.count();
+}
+
+/**
+ * @brief 批量提交：外部线程每次提交kBulk个任务，工作线程每次取出kDrain个，
+ * 对应微内核循环每个周期整批提交插件任务的场景
+ *
+ */
+static double bench_bulk(IThreadPool &pool) {
+    std::atomic<int> done(0);
+    const int total = kRootTasks * kFanOut;
+    thread_task_t tasks[kBulk];
+    auto begin = std::chrono::steady_clock::now();
+
+    pool.set_drain_batch(kDrain);
+
+    for (int i = 0; i < total; i += kBulk) {
+        int cnt = std::min(kBulk, total - i);
+
+        for (int j = 0; j < cnt; j++) {
+            tasks[j] = [&done] {
+                spin_work(200);
+                done++;
+            };
+        }
+
+        pool.add_tasks(tasks, cnt, -1);
+    }
+
+    while (done.load() < total) {
+        std::this_thread::yield();
+    }
+
+    std::chrono::duration<double> cost =
+        std::chrono::steady_clock::now() - begin;
+
+    return total / cost.count();
+}
+
+template <typename Pool>
+static void bench_pool(const char *name, int threads) {
+    // 队列容量需容纳嵌套派生的任务，否则共享队列的线程池会在工作线程内阻塞
+    const size_t limit = kRootTasks * (kFanOut + 1);
+
+    {
+        Pool pool(limit, threads);
+        printf("%s,fan_out,%d,%.0f\n", name, threads, bench_fan_out(pool));
+    }
+
+    {
+        Pool pool(limit, threads);
+        printf("%s,flat,%d,%.0f\n", name, threads, bench_flat(pool));
+    }
+
+    {
+        Pool pool(limit, threads);
+        printf("%s,bulk,%d,%.0f\n", name, threads, bench_bulk(pool));
+    }
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 0;
+
+    if (max_threads <= 0) {
+        max_threads = std::thread::hardware_concurrency() * 2;
+    }
+
+    printf("pool,workload,threads,tasks_per_sec\n");
+
+    for (int threads = 1; threads <= max_threads; threads <<= 1) {
+        bench_pool<MicroKernelThreadPool>("sync", threads);
+        bench_pool<MicroKernelRingThreadPool>("ring", threads);
+        bench_pool<MicroKernelStealThreadPool>("steal", threads);
+    }
+
+    return 0;
+}
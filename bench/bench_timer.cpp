@@ -0,0 +1,130 @@
+/**
+ * @file bench_timer.cpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 大量等待中的定时器的添加、取消开销和内存占用
+ * @date 2021-02-05
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../micro_thread_pool.hpp"
+#include "../micro_timer_wheel.hpp"
+
+using namespace Asty;
+
+typedef std::chrono::steady_clock bench_clock;
+
+// 进程当前的常驻内存(KB)
+static long rss_kb(void) {
+    FILE *fp = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+
+    if (!fp) {
+        return kb;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (!strncmp(line, "VmRSS:", 6)) {
+            kb = atol(line + 6);
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    return kb;
+}
+
+static double ns_per(bench_clock::time_point begin, size_t cnt) {
+    return std::chrono::duration<double, std::nano>(bench_clock::now() -
+                                                    begin)
+               .count() /
+           cnt;
+}
+
+int main(int argc, char **argv) {
+    int timers = argc > 1 ? atoi(argv[1]) : 0;
+
+    if (timers <= 0) {
+        timers = 500000;
+    }
+
+    std::shared_ptr<IThreadPool> pool(new MicroKernelThreadPool(4096, 2));
+    MicroTimerWheel wheel(pool);
+    std::vector<uint64_t> ids;
+    std::mt19937 rng(1);
+    std::atomic<int> fired(0);
+
+    ids.reserve(timers);
+
+    // 模拟请求截止时间，1s到60s
+    long before = rss_kb();
+    auto begin = bench_clock::now();
+
+    for (int i = 0; i < timers; i++) {
+        ids.push_back(wheel.add(1000 + rng() % 59000, 0, [&fired] {
+            fired++;
+        }));
+    }
+
+    double add_ns = ns_per(begin, timers);
+    long after = rss_kb();
+
+    // 绝大多数请求在截止时间前完成
+    begin = bench_clock::now();
+
+    for (uint64_t id : ids) {
+        wheel.cancel(id);
+    }
+
+    double cancel_ns = ns_per(begin, timers);
+
+    printf("timers,add_ns,cancel_ns,bytes_per_timer\n");
+    printf("%d,%.1f,%.1f,%.1f\n", timers, add_ns, cancel_ns,
+           (after - before) * 1024.0 / timers);
+
+    // 到期精度
+    const int kFire = 1000;
+    std::vector<int64_t> late(kFire);
+
+    fired = 0;
+
+    for (int i = 0; i < kFire; i++) {
+        uint32_t delay = rng() % 500;
+        auto want = bench_clock::now() + std::chrono::milliseconds(delay);
+
+        wheel.add(delay, 0, [&late, &fired, i, want] {
+            late[i] = std::chrono::duration_cast<std::chrono::microseconds>(
+                          bench_clock::now() - want)
+                          .count();
+            fired++;
+        });
+    }
+
+    while (fired < kFire) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    int64_t sum = 0;
+    int64_t worst = 0;
+
+    for (int64_t us : late) {
+        sum += us;
+        worst = us > worst ? us : worst;
+    }
+
+    printf("# fired %d: mean late %.0f us, max late %ld us\n", kFire,
+           (double)sum / kFire, (long)worst);
+
+    return 0;
+}
@@ -7,9 +7,13 @@
  * @copyright Copyright (c) 2021
  *
  */
+#include <stdio.h>
 #include <string.h>
-#include <iostream>
+#include <chrono>
+#include <thread>
 #include "micro_kernel.hpp"
+#include "micro_plugin_loader.hpp"
+#include "micro_priority_thread_pool.hpp"
 #include "plugin.hpp"
 
 using namespace Asty;
@@ -17,6 +21,7 @@ using namespace Asty;
 typedef enum : int {
     E_DOMAIN_BASIC = 0,
     E_DOMAIN_ALARM = 1,
+    E_DOMAIN_SAMPLE = 100,  ///< plugins目录中的动态库插件
 } domain_type;
 
 class PluginStream : public IPluginStream<domain_type> {
@@ -32,14 +37,14 @@ public:
     virtual bool is_closed(void) override { return false; }
 
     // 发送数据
-    virtual int send(const PluginDataT &data, const time_t wait = -1) override {
-        std::cout << "send.." << std::endl;
+    virtual int send(const PluginDataT &data, const int64_t wait = -1) override {
+        printf("send..\n");
         return 0;
     }
 
     // 接收数据
-    virtual int recv(PluginDataT &data, const time_t wait = -1) override {
-        std::cout << "recv.." << std::endl;
+    virtual int recv(PluginDataT &data, const int64_t wait = -1) override {
+        printf("recv..\n");
         return 0;
     }
 
@@ -54,19 +59,19 @@ public:
 
     // 初始化
     virtual bool plugin_init(void) override {
-        std::cout << "basic init" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "basic init");
         return true;
     }
 
     // 启动
     virtual bool plugin_start(void) override {
-        std::cout << "basic start" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "basic start");
         return true;
     }
 
     // cycle调用
     virtual bool plugin_task(void) override {
-        std::cout << "basic invok" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "basic invok");
         domain_type t1 = E_DOMAIN_BASIC;
         domain_type t2 = E_DOMAIN_ALARM;
         PluginKey<domain_type> from{"basic", "1.0.0", E_DOMAIN_BASIC};
@@ -75,20 +80,18 @@ public:
 
         to.key = t2;
 
-        char reqb[128] = "hello alarm";
-        char resb[128] = "";
-        PluginDataT req;
-        PluginDataT res;
+        // 请求使用微内核缓冲区，转发时只传递引用
+        PluginBuffer reqb = get_micro_kernel_service()->buffer_alloc(128);
+        PluginDataT req{};
+        PluginDataT res{};
 
-        req.len = strlen(reqb);
-        req.data = reqb;
+        req.set_buffer(reqb, snprintf((char *)reqb.data(), reqb.capacity(),
+                                      "hello alarm"));
 
-        res.len = sizeof(resb);
-        res.data = resb;
-
-        get_micro_kernel_service()->message_dispatch(from, t2, req, res);
-
-        std::cout << "message back : " << (char *)res.data << std::endl;
+        if (get_micro_kernel_service()->message_dispatch(from, t2, req, res)) {
+            get_micro_kernel_service()->log(E_LOG_INFO, "message back : %s",
+                                            (char *)res.data);
+        }
 
         return true;
     }
@@ -99,33 +102,33 @@ public:
 
     // 停止
     virtual bool plugin_stop(void) override {
-        std::cout << "basic stop" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "basic stop");
         return true;
     }
 
     // 退出
     virtual bool plugin_exit(void) override {
-        std::cout << "basic exit" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "basic exit");
         return true;
     }
 
     // 消息通知，来自微内核
     virtual bool notice(const PluginDataT &msg) override {
-        std::cout << "basic notice" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "basic notice");
         return true;
     }
 
     // 消息处理
     virtual bool message(const PluginMessage<domain_type> &request,
                          PluginMessage<domain_type> &response) override {
-        std::cout << "basic message" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "basic message");
         return true;
     }
 
     // 流式消息处理
     virtual bool stream(
-        std::shared_ptr<IPluginStream<domain_type>> &stream) override {
-        std::cout << "basic message" << std::endl;
+        std::shared_ptr<IPluginStream<domain_type>> stream) override {
+        get_micro_kernel_service()->log(E_LOG_INFO, "basic message");
         return true;
     }
 };
@@ -137,19 +140,20 @@ public:
 
     // 初始化
     virtual bool plugin_init(void) override {
-        std::cout << "alarm init" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "alarm init");
         return true;
     }
 
     // 启动
     virtual bool plugin_start(void) override {
-        std::cout << "alarm start" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "alarm start");
         return true;
     }
 
     // cycle调用
     virtual bool plugin_task(void) override {
-        std::cout << "alarm invok : [type = " << (int)plugin_key().key << "]" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "alarm invok : [type = %d]",
+                                        (int)plugin_key().key);
         return true;
     }
 
@@ -157,47 +161,62 @@ public:
         return true;
     }
 
+    // 告警处理延迟敏感
+    virtual thread_task_prio plugin_task_prio(void) override {
+        return E_TASK_PRIO_HIGH;
+    }
+
+    // 依赖basic插件，basic启动后才初始化
+    virtual std::vector<domain_type> plugin_depends(void) override {
+        return std::vector<domain_type>{E_DOMAIN_BASIC};
+    }
+
     // 停止
     virtual bool plugin_stop(void) override {
-        std::cout << "alarm stop" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "alarm stop");
         return true;
     }
 
     // 退出
     virtual bool plugin_exit(void) override {
-        std::cout << "alarm exit" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "alarm exit");
         return true;
     }
 
     // 消息通知，来自微内核
     virtual bool notice(const PluginDataT &msg) override {
-        std::cout << "alarm notice" << std::endl;
+        get_micro_kernel_service()->log(E_LOG_INFO, "alarm notice");
         return true;
     }
 
     // 消息处理
     virtual bool message(const PluginMessage<domain_type> &request,
                          PluginMessage<domain_type> &response) override {
-        std::cout << "alarm message, from : " << request.from.name
-                  << ", msg : " << (char *)request.data.data << std::endl;
+        get_micro_kernel_service()->log(
+            E_LOG_INFO, "alarm message, from : %s, msg : %s",
+            request.from.name.c_str(), (char *)request.data.data);
 
-        sprintf((char *)response.data.data, "hihi basic");
-        response.data.len = strlen("hihi basic");
+        // 应答由处理方分配缓冲区，请求方不需要预先准备
+        PluginBuffer resb = get_micro_kernel_service()->buffer_alloc(32);
+        response.data.set_buffer(
+            resb,
+            snprintf((char *)resb.data(), resb.capacity(), "hihi basic"));
 
         return true;
     }
 
     // 流式消息处理
     virtual bool stream(
-        std::shared_ptr<IPluginStream<domain_type>> &stream) override {
-        std::cout << "alarm message" << std::endl;
+        std::shared_ptr<IPluginStream<domain_type>> stream) override {
+        get_micro_kernel_service()->log(E_LOG_INFO, "alarm message");
         return true;
     }
 };
 
 int main(void) {
-    std::shared_ptr<MicroKernelThreadPool> thread_pool(
-        new MicroKernelThreadPool);
+    // 告警插件的任务优先于其他插件执行
+    std::shared_ptr<MicroKernelPriorityThreadPool> thread_pool(
+        new MicroKernelPriorityThreadPool);
     std::shared_ptr<MicroKernel<domain_type>> micro_kernel(
         new MicroKernel<domain_type>(200, thread_pool));
 
@@ -213,7 +232,28 @@ int main(void) {
         micro_kernel->plugin_register(alarm);
     }
 
+    // 插件目录中的动态库插件按清单注册，首次使用时加载
+    MicroPluginLoader<domain_type> loader(*micro_kernel);
+    loader.load_dir("plugins");
+
+    // 微内核启动后第一条消息触发加载，应答后注销并卸载动态库
+    std::thread sample([micro_kernel, &loader] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        PluginKey<domain_type> from{"demo", "1.0.0", E_DOMAIN_BASIC};
+        PluginDataT req{};
+        PluginDataT res{};
+
+        if (micro_kernel->message_dispatch(from, E_DOMAIN_SAMPLE, req, res)) {
+            micro_kernel->log(E_LOG_INFO, "sample back : %s",
+                              (char *)res.data);
+        }
+
+        loader.unload(E_DOMAIN_SAMPLE);
+    });
+
     micro_kernel->run();
+    sample.join();
 
     return 0;
 }
\ No newline at end of file
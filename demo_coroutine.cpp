@@ -0,0 +1,152 @@
+/**
+ * @file demo_coroutine.cpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 协程插件示例，需要-std=c++20
+ * @date 2021-01-31
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include "micro_coroutine.hpp"
+#include "micro_kernel.hpp"
+#include "plugin.hpp"
+
+using namespace Asty;
+
+typedef enum : int {
+    E_DOMAIN_ECHO = 0,
+    E_DOMAIN_CLIENT = 1,
+} domain_type;
+
+class EchoPlugin : public IPlugin<domain_type> {
+public:
+    EchoPlugin(const PluginKey<domain_type> &key)
+        : IPlugin<domain_type>(key) {}
+
+    virtual bool plugin_init(void) override { return true; }
+
+    virtual bool plugin_start(void) override { return true; }
+
+    virtual bool plugin_task(void) override { return true; }
+
+    virtual bool plugin_task_en(void) override { return false; }
+
+    virtual bool plugin_stop(void) override { return true; }
+
+    virtual bool plugin_exit(void) override { return true; }
+
+    virtual bool notice(const PluginDataT &msg) override { return true; }
+
+    // 消息原样应答
+    virtual bool message(const PluginMessage<domain_type> &request,
+                         PluginMessage<domain_type> &response) override {
+        response.data = request.data;
+        return true;
+    }
+
+    // 流由协程处理，等待数据时不占用工作线程
+    virtual bool stream(
+        std::shared_ptr<IPluginStream<domain_type>> stream) override {
+        co_spawn(get_micro_kernel_service(), echo(stream));
+        return true;
+    }
+
+private:
+    // 收到的数据原样发回，连接关闭后结束
+    MicroCoTask echo(std::shared_ptr<IPluginStream<domain_type>> stream) {
+        IMicroKernelServices<domain_type> *srv = get_micro_kernel_service();
+        PluginDataT data{};
+
+        while (co_await co_recv(srv, stream, data) > 0) {
+            if (co_await co_send(srv, stream, data) <= 0) {
+                break;
+            }
+        }
+
+        co_return true;
+    }
+};
+
+class ClientPlugin : public IMicroCoPlugin<domain_type> {
+public:
+    ClientPlugin(const PluginKey<domain_type> &key)
+        : IMicroCoPlugin<domain_type>(key) {}
+
+    virtual bool plugin_init(void) override { return true; }
+
+    virtual bool plugin_start(void) override { return true; }
+
+    virtual bool plugin_task_en(void) override { return true; }
+
+    virtual uint32_t plugin_task_period(void) override { return 1000; }
+
+    virtual bool plugin_stop(void) override { return true; }
+
+    virtual bool plugin_exit(void) override { return true; }
+
+    virtual bool notice(const PluginDataT &msg) override { return true; }
+
+    virtual bool message(const PluginMessage<domain_type> &request,
+                         PluginMessage<domain_type> &response) override {
+        return false;
+    }
+
+    virtual bool stream(
+        std::shared_ptr<IPluginStream<domain_type>> stream) override {
+        return false;
+    }
+
+    // 依次等待消息应答、流应答和定时，每一步挂起时都不占用工作线程
+    virtual MicroCoTask plugin_co_task(void) override {
+        IMicroKernelServices<domain_type> *srv = get_micro_kernel_service();
+        PluginBuffer reqb = srv->buffer_alloc(64);
+        PluginDataT req{};
+
+        req.set_buffer(reqb, snprintf((char *)reqb.data(), reqb.capacity(),
+                                      "hello echo"));
+
+        MicroCoCallResult res =
+            co_await co_message(srv, plugin_key(), E_DOMAIN_ECHO, req, 100);
+
+        srv->log(E_LOG_INFO, "message back : [status = %d] %s",
+                 (int)res.status,
+                 E_PLUGIN_CALL_DONE == res.status ? (char *)res.response.data
+                                                  : "");
+
+        auto stream = srv->stream_open(plugin_key(), E_DOMAIN_ECHO);
+
+        if (stream) {
+            PluginDataT back{};
+
+            co_await co_send(srv, stream, req);
+            if (co_await co_recv(srv, stream, back, 100000) > 0) {
+                srv->log(E_LOG_INFO, "stream back : %s", (char *)back.data);
+            }
+            stream->close();
+        }
+
+        co_await co_sleep(srv, 100);
+        srv->log(E_LOG_INFO, "client wake up");
+
+        co_return true;
+    }
+};
+
+int main(void) {
+    // 工作线程少于等待中的协程也不会阻塞
+    std::shared_ptr<MicroKernelThreadPool> thread_pool(
+        new MicroKernelThreadPool(100, 2));
+    std::shared_ptr<MicroKernel<domain_type>> micro_kernel(
+        new MicroKernel<domain_type>(10, thread_pool));
+
+    micro_kernel->plugin_register(std::make_shared<EchoPlugin>(
+        PluginKey<domain_type>{"echo", "1.0.0", E_DOMAIN_ECHO}));
+    micro_kernel->plugin_register(std::make_shared<ClientPlugin>(
+        PluginKey<domain_type>{"client", "1.0.0", E_DOMAIN_CLIENT}));
+
+    micro_kernel->run();
+
+    return 0;
+}
@@ -0,0 +1,360 @@
+/**
+ * @file micro_buffer_pool.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 微内核引用计数缓冲区池
+ * @date 2021-01-22
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Asty {
+
+/**
+ * @brief 缓冲区池的大小级别统计
+ *
+ */
+struct PluginBufferStat {
+    size_t block_size;  ///< 级别的块大小，0表示超出最大级别直接分配的缓冲区
+    uint64_t allocs;    ///< 累计分配次数
+    uint64_t frees;     ///< 累计释放次数
+    uint64_t live;      ///< 当前使用中的缓冲区数
+    uint64_t reserved;  ///< 已向系统申请的块数(含空闲)
+};
+
+/**
+ * @brief 缓冲区头，位于数据之前
+ *
+ */
+struct MicroBufferHeader {
+    std::atomic<uint32_t> ref;  ///< 引用计数
+    uint32_t cls;               ///< 大小级别
+    size_t capacity;            ///< 数据容量
+};
+
+class MicroBufferPool;
+
+/**
+ * @brief 引用计数缓冲区句柄，复制句柄只增加引用计数，最后一个句柄释放时归还缓冲区池
+ *
+ */
+class PluginBuffer {
+public:
+    PluginBuffer() : head_(nullptr) {}
+    PluginBuffer(const PluginBuffer &buffer) : head_(buffer.head_) {
+        if (head_) {
+            head_->ref.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    PluginBuffer(PluginBuffer &&buffer) : head_(buffer.head_) {
+        buffer.head_ = nullptr;
+    }
+    ~PluginBuffer() { reset(); }
+
+    PluginBuffer &operator=(const PluginBuffer &buffer) {
+        PluginBuffer tmp(buffer);
+        std::swap(head_, tmp.head_);
+        return *this;
+    }
+
+    PluginBuffer &operator=(PluginBuffer &&buffer) {
+        std::swap(head_, buffer.head_);
+        return *this;
+    }
+
+    // 数据地址
+    void *data(void) const { return head_ ? head_ + 1 : nullptr; }
+
+    // 数据容量
+    size_t capacity(void) const { return head_ ? head_->capacity : 0; }
+
+    // 引用计数
+    uint32_t use_count(void) const {
+        return head_ ? head_->ref.load(std::memory_order_relaxed) : 0;
+    }
+
+    explicit operator bool(void) const { return head_ != nullptr; }
+
+    // 释放引用
+    inline void reset(void);
+
+private:
+    friend class MicroBufferPool;
+    explicit PluginBuffer(MicroBufferHeader *head) : head_(head) {}
+
+private:
+    MicroBufferHeader *head_;  ///< 缓冲区头
+};
+
+/**
+ * @brief 缓冲区池
+ * @details 按大小级别管理缓冲区，块从成批申请的slab中切分，释放后不归还系统；
+ * 每个线程有各级别的本地缓存，本地缓存空或满时才与全局空闲链表成批交换
+ *
+ */
+class MicroBufferPool {
+public:
+    static const uint32_t kClasses = 6;         ///< 大小级别数
+    static const uint32_t kLarge = kClasses;    ///< 超出最大级别的缓冲区
+    static const size_t kCacheLimit = 64;       ///< 线程本地缓存的块数上限
+    static const size_t kBatch = 32;            ///< 与全局空闲链表交换的批量
+    static const size_t kSlabSize = 64 * 1024;  ///< slab的最小大小
+    static const uint32_t kShards = 8;          ///< 统计计数的分片数
+
+    // 进程唯一的缓冲区池，不释放，线程退出时本地缓存仍可归还
+    static MicroBufferPool &instance(void) {
+        static MicroBufferPool *pool = new MicroBufferPool();
+        return *pool;
+    }
+
+    // 分配至少size字节的缓冲区，引用计数为1
+    PluginBuffer alloc(size_t size) {
+        uint32_t cls = size_class(size);
+        MicroBufferHeader *head = nullptr;
+
+        if (kLarge == cls) {
+            head = static_cast<MicroBufferHeader *>(
+                malloc(sizeof(MicroBufferHeader) + size));
+            if (!head) {
+                throw std::bad_alloc();
+            }
+            head->capacity = size;
+        } else {
+            head = static_cast<MicroBufferHeader *>(pop_block(cls));
+            head->capacity = class_size(cls);
+        }
+
+        new (&head->ref) std::atomic<uint32_t>(1);
+        head->cls = cls;
+
+        counter(cls).allocs.fetch_add(1, std::memory_order_relaxed);
+
+        return PluginBuffer(head);
+    }
+
+    // 各大小级别的统计，合并各分片，使用中的数量由分配和释放次数相减
+    void stat(std::vector<PluginBufferStat> &stat) {
+        stat.clear();
+
+        for (uint32_t cls = 0; cls <= kLarge; cls++) {
+            PluginBufferStat item{};
+
+            item.block_size = kLarge == cls ? 0 : class_size(cls);
+
+            for (auto &shard : stats_) {
+                item.allocs +=
+                    shard[cls].allocs.load(std::memory_order_relaxed);
+                item.frees += shard[cls].frees.load(std::memory_order_relaxed);
+                item.reserved +=
+                    shard[cls].reserved.load(std::memory_order_relaxed);
+            }
+
+            // 各分片读取时刻不同，释放可能先于分配被读到
+            item.live =
+                item.allocs > item.frees ? item.allocs - item.frees : 0;
+            stat.push_back(item);
+        }
+    }
+
+    // 大小级别的块大小
+    static size_t class_size(uint32_t cls) { return (size_t)64 << (cls * 2); }
+
+    // 大小对应的级别：64 256 1K 4K 16K 64K
+    static uint32_t size_class(size_t size) {
+        for (uint32_t cls = 0; cls < kClasses; cls++) {
+            if (size <= class_size(cls)) {
+                return cls;
+            }
+        }
+
+        return kLarge;
+    }
+
+private:
+    friend class PluginBuffer;
+
+    /**
+     * @brief 级别统计分片计数，按缓存行隔开
+     *
+     */
+    struct Counter {
+        Counter() : allocs(0), frees(0), reserved(0) {}
+
+        std::atomic<uint64_t> allocs;    ///< 累计分配次数
+        std::atomic<uint64_t> frees;     ///< 累计释放次数
+        std::atomic<uint64_t> reserved;  ///< 已申请的块数
+        char pad[40];                    ///< 缓存行填充
+    };
+
+    MicroBufferPool() {}
+
+    // 引用计数归零时归还
+    void free(MicroBufferHeader *head) {
+        uint32_t cls = head->cls;
+
+        counter(cls).frees.fetch_add(1, std::memory_order_relaxed);
+
+        if (kLarge == cls) {
+            ::free(head);
+            return;
+        }
+
+        push_block(cls, head);
+    }
+
+    /**
+     * @brief 线程本地缓存，线程退出时归还全局空闲链表
+     *
+     */
+    struct Cache {
+        ~Cache() {
+            for (uint32_t cls = 0; cls < kClasses; cls++) {
+                instance().put_global(cls, blocks[cls], blocks[cls].size());
+            }
+            cache_dead() = true;
+        }
+
+        std::vector<void *> blocks[kClasses];  ///< 各级别的空闲块
+    };
+
+    // 线程本地缓存已析构的标记，平凡析构，析构后仍可访问
+    static bool &cache_dead(void) {
+        static thread_local bool dead = false;
+        return dead;
+    }
+
+    // 线程本地缓存，线程退出过程中返回空
+    static Cache *local(void) {
+        if (cache_dead()) {
+            return nullptr;
+        }
+
+        static thread_local Cache cache;
+        return &cache;
+    }
+
+    // 当前线程所在分片的级别计数，不同线程的计数分散在不同缓存行
+    Counter &counter(uint32_t cls) {
+        static std::atomic<uint32_t> seq(0);
+        static thread_local uint32_t idx = seq++ % kShards;
+        return stats_[idx][cls];
+    }
+
+    void *pop_block(uint32_t cls) {
+        Cache *cache = local();
+
+        if (!cache) {
+            std::vector<void *> blocks;
+            get_global(cls, blocks, 1);
+            return blocks.back();
+        }
+
+        std::vector<void *> &blocks = cache->blocks[cls];
+
+        if (blocks.empty()) {
+            get_global(cls, blocks, kBatch);
+        }
+
+        void *block = blocks.back();
+        blocks.pop_back();
+
+        return block;
+    }
+
+    void push_block(uint32_t cls, void *block) {
+        Cache *cache = local();
+
+        if (!cache) {
+            std::vector<void *> blocks(1, block);
+            put_global(cls, blocks, 1);
+            return;
+        }
+
+        std::vector<void *> &blocks = cache->blocks[cls];
+
+        blocks.push_back(block);
+
+        // 本地缓存过多时成批归还，避免生产者线程囤积
+        if (blocks.size() > kCacheLimit) {
+            put_global(cls, blocks, kBatch);
+        }
+    }
+
+    // 从全局空闲链表取出n块追加到blocks，不足时申请新的slab
+    void get_global(uint32_t cls, std::vector<void *> &blocks, size_t n) {
+        Global &global = globals_[cls];
+        std::lock_guard<std::mutex> lck(global.mutex);
+
+        if (global.blocks.size() < n) {
+            grow(cls, global.blocks);
+        }
+
+        blocks.insert(blocks.end(), global.blocks.end() - n,
+                      global.blocks.end());
+        global.blocks.resize(global.blocks.size() - n);
+    }
+
+    // 把blocks末尾的n块归还全局空闲链表
+    void put_global(uint32_t cls, std::vector<void *> &blocks, size_t n) {
+        Global &global = globals_[cls];
+        std::lock_guard<std::mutex> lck(global.mutex);
+
+        global.blocks.insert(global.blocks.end(), blocks.end() - n,
+                             blocks.end());
+        blocks.resize(blocks.size() - n);
+    }
+
+    // 申请slab并切分为块，需持有全局锁
+    void grow(uint32_t cls, std::vector<void *> &blocks) {
+        size_t block = sizeof(MicroBufferHeader) + class_size(cls);
+        size_t cnt = kSlabSize / block;
+
+        if (cnt < kBatch) {
+            cnt = kBatch;
+        }
+
+        char *slab = static_cast<char *>(malloc(block * cnt));
+        if (!slab) {
+            throw std::bad_alloc();
+        }
+
+        for (size_t i = 0; i < cnt; i++) {
+            blocks.push_back(slab + i * block);
+        }
+
+        counter(cls).reserved.fetch_add(cnt, std::memory_order_relaxed);
+    }
+
+private:
+    /**
+     * @brief 全局空闲链表
+     *
+     */
+    struct Global {
+        std::mutex mutex;            ///< 空闲链表锁
+        std::vector<void *> blocks;  ///< 空闲块
+    };
+
+    Global globals_[kClasses];            ///< 各级别的全局空闲链表
+    Counter stats_[kShards][kLarge + 1];  ///< 各分片各级别的统计
+};
+
+void PluginBuffer::reset(void) {
+    if (head_ && 1 == head_->ref.fetch_sub(1, std::memory_order_acq_rel)) {
+        MicroBufferPool::instance().free(head_);
+    }
+
+    head_ = nullptr;
+}
+
+}
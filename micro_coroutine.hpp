@@ -0,0 +1,609 @@
+/**
+ * @file micro_coroutine.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 插件协程接口，等待消息、流和定时时不占用线程池工作线程
+ * @date 2021-01-31
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#if __cplusplus < 202002L
+#error "micro_coroutine.hpp requires -std=c++20"
+#endif
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "plugin.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 协程等待表
+ * @details 挂起的协程登记在执行它的等待表中，等待的事件到达后由等待表
+ * 恢复，恢复期间该表为当前线程的等待表；关闭后销毁仍挂起的协程，之后到达
+ * 的事件被忽略，新的等待不挂起而立即以取消返回
+ *
+ */
+class MicroCoWaits : public std::enable_shared_from_this<MicroCoWaits> {
+public:
+    MicroCoWaits() : next_(0), closed_(false) {}
+
+    // 当前线程正在执行的协程所属的等待表，不属于插件时为不会关闭的公共表
+    static std::shared_ptr<MicroCoWaits> current(void) {
+        MicroCoWaits *waits = local();
+        return waits ? waits->shared_from_this() : common();
+    }
+
+    // 以本表为当前线程的等待表执行fn
+    template <typename Fn>
+    void run(Fn fn) {
+        MicroCoWaits *prev = local();
+
+        local() = this;
+        fn();
+        local() = prev;
+    }
+
+    // 登记挂起的协程，返回等待标识，已关闭时返回0
+    uint64_t suspend(std::coroutine_handle<> handle) {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        if (closed_) {
+            return 0;
+        }
+
+        waits_[++next_].handle = handle;
+
+        return next_;
+    }
+
+    // 设置等待结束(恢复或关闭)时的清理，已不在等待时返回false
+    bool set_cleanup(uint64_t id, const std::function<void(void)> &cleanup) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        auto item = waits_.find(id);
+
+        if (item == waits_.end()) {
+            return false;
+        }
+
+        item->second.cleanup = cleanup;
+
+        return true;
+    }
+
+    // 仍在等待时在锁内执行fn，等待对象在协程帧中，只能由此访问
+    template <typename Fn>
+    bool locked(uint64_t id, Fn fn) {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        if (waits_.find(id) == waits_.end()) {
+            return false;
+        }
+
+        fn();
+
+        return true;
+    }
+
+    // 清理后恢复仍在等待的协程，已恢复或已关闭时忽略
+    void resume(uint64_t id) {
+        Wait wait;
+
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            auto item = waits_.find(id);
+
+            if (item == waits_.end()) {
+                return;
+            }
+
+            wait = std::move(item->second);
+            waits_.erase(item);
+        }
+
+        if (wait.cleanup) {
+            wait.cleanup();
+        }
+
+        run([&wait] { wait.handle.resume(); });
+    }
+
+    // 关闭并销毁挂起的协程，cleanup为true时先执行各等待的清理，
+    // 微内核已销毁时不能清理
+    void close(bool cleanup) {
+        std::map<uint64_t, Wait> waits;
+
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            closed_ = true;
+            waits.swap(waits_);
+        }
+
+        for (auto &item : waits) {
+            if (cleanup && item.second.cleanup) {
+                item.second.cleanup();
+            }
+        }
+
+        for (auto &item : waits) {
+            item.second.handle.destroy();
+        }
+    }
+
+private:
+    /**
+     * @brief 挂起的等待
+     *
+     */
+    struct Wait {
+        std::coroutine_handle<> handle;     ///< 挂起的协程
+        std::function<void(void)> cleanup;  ///< 等待结束时的清理
+    };
+
+    static MicroCoWaits *&local(void) {
+        static thread_local MicroCoWaits *waits = nullptr;
+        return waits;
+    }
+
+    static std::shared_ptr<MicroCoWaits> common(void) {
+        static std::shared_ptr<MicroCoWaits> waits =
+            std::make_shared<MicroCoWaits>();
+        return waits;
+    }
+
+private:
+    std::mutex mtx_;                  ///< 等待表锁
+    std::map<uint64_t, Wait> waits_;  ///< 挂起的等待
+    uint64_t next_;                   ///< 上一个等待标识
+    bool closed_;                     ///< 已关闭
+};
+
+/**
+ * @brief 协程任务
+ * @details 创建后挂起，由co_spawn提交到线程池或start在当前线程开始执行，
+ * co_return任务结果，执行结束后协程帧自行销毁；未开始的任务析构时销毁，
+ * 挂起时被等待表销毁的任务以失败通知完成
+ *
+ */
+class MicroCoTask {
+public:
+    /**
+     * @brief 协程承诺对象
+     *
+     */
+    struct promise_type {
+        MicroCoTask get_return_object(void) {
+            return MicroCoTask(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend(void) noexcept { return {}; }
+
+        ~promise_type() {
+            if (done) {
+                done(false);
+            }
+        }
+
+        // 结束时通知完成，之后协程帧自行销毁
+        std::suspend_never final_suspend(void) noexcept {
+            std::function<void(bool)> cb;
+
+            cb.swap(done);
+            if (cb) {
+                cb(result);
+            }
+            return {};
+        }
+
+        void return_value(bool ret) { result = ret; }
+
+        // 未捕获的异常视为任务失败
+        void unhandled_exception(void) { result = false; }
+
+        std::function<void(bool)> done;  ///< 完成回调
+        bool result = false;             ///< 任务结果
+    };
+
+    typedef std::coroutine_handle<promise_type> handle_t;
+
+    MicroCoTask(MicroCoTask &&task) noexcept : handle_(task.handle_) {
+        task.handle_ = nullptr;
+    }
+
+    MicroCoTask(const MicroCoTask &) = delete;
+    MicroCoTask &operator=(const MicroCoTask &) = delete;
+
+    ~MicroCoTask() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    // 在当前线程开始执行，第一次挂起或结束时返回，done在结束时调用
+    void start(const std::function<void(bool)> &done = nullptr) {
+        handle_t handle = handle_;
+
+        if (!handle) {
+            return;
+        }
+
+        handle_ = nullptr;
+        handle.promise().done = done;
+        handle.resume();
+    }
+
+private:
+    explicit MicroCoTask(handle_t handle) : handle_(handle) {}
+
+private:
+    handle_t handle_;  ///< 未开始执行的协程
+};
+
+// 在线程池中开始执行协程任务，结束后以任务结果调用done，
+// 任务属于当前线程的等待表
+template <typename T>
+void co_spawn(IMicroKernelServices<T> *srv, MicroCoTask &&task,
+              const std::function<void(bool)> &done = nullptr) {
+    std::shared_ptr<MicroCoTask> start =
+        std::make_shared<MicroCoTask>(std::move(task));
+    std::shared_ptr<MicroCoWaits> waits = MicroCoWaits::current();
+
+    srv->task_post([start, done, waits] {
+        waits->run([&start, &done] { start->start(done); });
+    });
+}
+
+/**
+ * @brief 协程消息调用结果
+ *
+ */
+struct MicroCoCallResult {
+    plugin_call_status status;  ///< 调用状态
+    PluginDataT response;       ///< 应答数据，status为DONE时有效
+};
+
+/**
+ * @brief 等待异步消息分发完成
+ * @details 通过message_dispatch_async发出请求，完成、失败或超时后
+ * 协程在线程池中恢复执行，等待期间不占用工作线程；等待表关闭时取消调用，
+ * 已关闭时不分发，返回CANCELED
+ *
+ * @tparam T 插件Key的类型
+ */
+template <typename T>
+class MicroCoMessage {
+public:
+    MicroCoMessage(IMicroKernelServices<T> *srv, const PluginKey<T> &from,
+                   const T &to_key, const PluginDataT &request,
+                   uint32_t timeout)
+        : srv_(srv),
+          from_(from),
+          to_key_(to_key),
+          request_(request),
+          timeout_(timeout),
+          result_{E_PLUGIN_CALL_PENDING, PluginDataT{}} {}
+
+    bool await_ready(void) const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        std::shared_ptr<MicroCoWaits> waits = MicroCoWaits::current();
+        uint64_t id = waits->suspend(handle);
+
+        if (!id) {
+            result_.status = E_PLUGIN_CALL_CANCELED;
+            return false;
+        }
+
+        IMicroKernelServices<T> *srv = srv_;
+        MicroCoCallResult *result = &result_;
+        // 回调可能在分发返回前恢复协程并销毁本对象，参数先复制到栈上
+        PluginKey<T> from = from_;
+        T to_key = to_key_;
+        PluginDataT request = request_;
+        uint32_t timeout = timeout_;
+
+        std::shared_ptr<PluginCall> call = srv->message_dispatch_async(
+            from, to_key, request,
+            [srv, waits, id, result](plugin_call_status status,
+                                     const PluginDataT &response) {
+                bool waiting = waits->locked(id, [&] {
+                    result->status = status;
+                    result->response = response;
+                });
+
+                if (waiting) {
+                    srv->task_post([waits, id] { waits->resume(id); });
+                }
+            },
+            timeout);
+
+        if (call) {
+            waits->set_cleanup(id, [call] { call->cancel(); });
+        }
+
+        return true;
+    }
+
+    MicroCoCallResult await_resume(void) { return std::move(result_); }
+
+private:
+    IMicroKernelServices<T> *srv_;  ///< 微内核服务
+    PluginKey<T> from_;             ///< 源插件
+    T to_key_;                      ///< 目的插件
+    PluginDataT request_;           ///< 请求数据
+    uint32_t timeout_;              ///< 超时时间(ms)，0不设截止时间
+    MicroCoCallResult result_;      ///< 调用结果
+};
+
+/**
+ * @brief 等待到达指定时间
+ * @details 由微内核定时器到期后在线程池中恢复，到时返回true；
+ * 等待表已关闭时不挂起，返回false
+ *
+ * @tparam T 插件Key的类型
+ */
+template <typename T>
+class MicroCoSleep {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    MicroCoSleep(IMicroKernelServices<T> *srv, clock::time_point when)
+        : srv_(srv), when_(when), cancelled_(false) {}
+
+    bool await_ready(void) const { return clock::now() >= when_; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        std::shared_ptr<MicroCoWaits> waits = MicroCoWaits::current();
+        uint64_t id = waits->suspend(handle);
+
+        if (!id) {
+            cancelled_ = true;
+            return false;
+        }
+
+        srv_->task_post_at(when_, [waits, id] { waits->resume(id); });
+
+        return true;
+    }
+
+    bool await_resume(void) const { return !cancelled_; }
+
+private:
+    IMicroKernelServices<T> *srv_;  ///< 微内核服务
+    clock::time_point when_;        ///< 恢复时间
+    bool cancelled_;                ///< 等待被取消
+};
+
+/**
+ * @brief 等待流可收发
+ * @details 先不等待地收发一次，未完成时挂起，由微内核反应器在流的就绪
+ * 事件到达后重试，流或微内核不支持就绪事件时按指数退避轮询；收发成功、
+ * 连接关闭或超过等待时间后在线程池中恢复，返回值与IPluginStream的send和
+ * recv相同，等待表已关闭时不挂起，返回-1
+ *
+ * @tparam T 插件Key的类型
+ */
+template <typename T>
+class MicroCoStreamIo {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    // in非空时发送in，否则接收到out，wait为等待时间(us)，-1一直等待
+    MicroCoStreamIo(IMicroKernelServices<T> *srv,
+                    const std::shared_ptr<IPluginStream<T>> &stream,
+                    const PluginDataT *in, PluginDataT *out, int64_t wait)
+        : srv_(srv),
+          stream_(stream),
+          in_(in),
+          out_(out),
+          wait_(wait),
+          ret_(0) {}
+
+    bool await_ready(void) {
+        ret_ = io();
+        return ret_ || 0 == wait_;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        std::shared_ptr<MicroCoWaits> waits = MicroCoWaits::current();
+        uint64_t id = waits->suspend(handle);
+
+        if (!id) {
+            ret_ = -1;
+            return false;
+        }
+
+        IMicroKernelServices<T> *srv = srv_;
+        // 重试一次，完成时恢复协程，返回是否仍需等待；
+        // 协程恢复后本对象随之销毁，只在仍在等待时访问
+        std::function<bool(void)> retry = [this, waits, id] {
+            bool done = false;
+
+            if (!waits->locked(id, [this, &done] { done = attempt(); })) {
+                return false;
+            }
+
+            if (done) {
+                waits->resume(id);
+            }
+
+            return !done;
+        };
+
+        int fd = stream_->event_fd();
+        uint64_t watch = fd < 0 ? 0 : srv->fd_watch(fd, [retry] { retry(); });
+        uint64_t timer = 0;
+
+        if (!watch) {
+            poll(srv, retry, kPollMinUs);
+        }
+
+        // 超时后以0恢复
+        if (wait_ > 0) {
+            timer = srv->timer_add(
+                (uint32_t)std::min<int64_t>((wait_ + 999) / 1000, UINT32_MAX),
+                0, [waits, id] { waits->resume(id); });
+        }
+
+        // 等待结束时取消监视和定时器，已恢复时在此取消
+        std::function<void(void)> cleanup = [srv, watch, timer] {
+            if (watch) {
+                srv->fd_unwatch(watch);
+            }
+            if (timer) {
+                srv->timer_cancel(timer);
+            }
+        };
+
+        if (!waits->set_cleanup(id, cleanup)) {
+            cleanup();
+        }
+
+        return true;
+    }
+
+    int await_resume(void) const { return ret_; }
+
+private:
+    // 不等待地收发一次
+    int io(void) {
+        return in_ ? stream_->send(*in_, 0) : stream_->recv(*out_, 0);
+    }
+
+    // 清除就绪事件后重试，之后的新数据、空间或关闭会再次触发
+    bool attempt(void) {
+        stream_->event_clear();
+        ret_ = io();
+        return ret_ != 0;
+    }
+
+    // 不支持就绪事件时在线程池中轮询，未完成时加倍间隔后再次重试
+    static void poll(IMicroKernelServices<T> *srv,
+                     const std::function<bool(void)> &retry, int64_t delay) {
+        srv->task_post_at(clock::now() + std::chrono::microseconds(delay),
+                          [srv, retry, delay] {
+                              if (retry()) {
+                                  poll(srv, retry,
+                                       std::min(delay * 2, kPollMaxUs));
+                              }
+                          });
+    }
+
+private:
+    static constexpr int64_t kPollMinUs = 100;   ///< 首次重试间隔(us)
+    static constexpr int64_t kPollMaxUs = 4000;  ///< 最大重试间隔(us)
+
+    IMicroKernelServices<T> *srv_;              ///< 微内核服务
+    std::shared_ptr<IPluginStream<T>> stream_;  ///< 流
+    const PluginDataT *in_;                     ///< 发送的数据
+    PluginDataT *out_;                          ///< 接收的数据
+    int64_t wait_;                              ///< 等待时间(us)
+    int ret_;                                   ///< 收发结果
+};
+
+// 等待消息分发完成，timeout(ms)为0表示不设截止时间
+template <typename T>
+MicroCoMessage<T> co_message(IMicroKernelServices<T> *srv,
+                             const PluginKey<T> &from, const T &to_key,
+                             const PluginDataT &request,
+                             uint32_t timeout = 0) {
+    return MicroCoMessage<T>(srv, from, to_key, request, timeout);
+}
+
+// 等待到达when，返回false表示等待被取消
+template <typename T>
+MicroCoSleep<T> co_sleep_until(IMicroKernelServices<T> *srv,
+                               std::chrono::steady_clock::time_point when) {
+    return MicroCoSleep<T>(srv, when);
+}
+
+// 等待ms毫秒，返回false表示等待被取消
+template <typename T>
+MicroCoSleep<T> co_sleep(IMicroKernelServices<T> *srv, uint32_t ms) {
+    return MicroCoSleep<T>(srv, std::chrono::steady_clock::now() +
+                                    std::chrono::milliseconds(ms));
+}
+
+// 等待接收数据，wait(us)和返回值同IPluginStream::recv
+template <typename T>
+MicroCoStreamIo<T> co_recv(IMicroKernelServices<T> *srv,
+                           const std::shared_ptr<IPluginStream<T>> &stream,
+                           PluginDataT &data, int64_t wait = -1) {
+    return MicroCoStreamIo<T>(srv, stream, nullptr, &data, wait);
+}
+
+// 等待发送数据，wait(us)和返回值同IPluginStream::send
+template <typename T>
+MicroCoStreamIo<T> co_send(IMicroKernelServices<T> *srv,
+                           const std::shared_ptr<IPluginStream<T>> &stream,
+                           const PluginDataT &data, int64_t wait = -1) {
+    return MicroCoStreamIo<T>(srv, stream, &data, nullptr, wait);
+}
+
+/**
+ * @brief 协程插件
+ * @details 插件任务写为协程，每次调度在工作线程上执行到第一次挂起，
+ * 之后由等待的事件在线程池中恢复；上一个协程任务未结束时合并本次调度。
+ * 插件的协程及其co_spawn的协程登记在插件的等待表中，插件被停止或注销后
+ * 挂起的协程被销毁，之后的等待立即以取消返回，协程收到取消后应尽快结束。
+ * 协程插件不应使用actor模式，恢复执行不经过插件邮箱
+ *
+ * @tparam T 插件Key的类型
+ */
+template <typename T>
+class IMicroCoPlugin : public IPlugin<T> {
+public:
+    IMicroCoPlugin(const PluginKey<T> &key)
+        : IPlugin<T>(key),
+          co_waits_(std::make_shared<MicroCoWaits>()),
+          co_running_(false) {}
+
+    // 销毁仍挂起的协程，等待正在执行的协程任务结束，避免插件销毁后协程恢复
+    virtual ~IMicroCoPlugin() {
+        co_waits_->close(false);
+
+        while (co_running_) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // 取消挂起协程的等待并销毁协程，子类重写时需调用
+    virtual void plugin_detach(void) override { co_waits_->close(true); }
+
+    // 协程插件任务
+    virtual MicroCoTask plugin_co_task(void) = 0;
+
+    // 开始一个协程任务，上一个未结束时合并
+    virtual bool plugin_task(void) override {
+        if (co_running_.exchange(true)) {
+            return true;
+        }
+
+        co_waits_->run([this] {
+            plugin_co_task().start([this](bool) { co_running_ = false; });
+        });
+
+        return true;
+    }
+
+    // 协程任务是否正在执行或挂起
+    bool co_running(void) const { return co_running_; }
+
+private:
+    std::shared_ptr<MicroCoWaits> co_waits_;  ///< 插件协程的等待表
+    std::atomic_bool co_running_;             ///< 协程任务未结束
+};
+
+}
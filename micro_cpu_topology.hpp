@@ -0,0 +1,228 @@
+/**
+ * @file micro_cpu_topology.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief CPU和NUMA拓扑发现，工作线程绑核
+ * @date 2021-01-29
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <vector>
+
+namespace Asty {
+
+#ifndef MICRO_SYS_NODE_DIR
+#define MICRO_SYS_NODE_DIR "/sys/devices/system/node"  ///< NUMA节点目录
+#endif
+
+/**
+ * @brief 工作线程放置方式
+ *
+ */
+typedef enum {
+    E_THREAD_PLACE_NONE = 0,    ///< 不绑核
+    E_THREAD_PLACE_CPUSET = 1,  ///< 所有工作线程绑定到cpuset
+    E_THREAD_PLACE_NODE = 2,    ///< 按NUMA节点分组，绑定到节点的CPU
+    E_THREAD_PLACE_CORE = 3,    ///< 按NUMA节点分组，每个工作线程绑定一个CPU
+} thread_placement_mode;
+
+/**
+ * @brief 工作线程放置策略
+ *
+ */
+struct ThreadPlacement {
+    ThreadPlacement(thread_placement_mode m = E_THREAD_PLACE_NONE,
+                    const std::vector<int> &c = std::vector<int>())
+        : mode(m), cpus(c) {}
+
+    thread_placement_mode mode;  ///< 放置方式
+    std::vector<int> cpus;       ///< 可用的CPU，为空时使用进程允许的所有CPU
+};
+
+/**
+ * @brief CPU拓扑
+ * @details 从进程的CPU亲和性和/sys下的NUMA节点信息发现拓扑，
+ * 读取失败或单节点机器上所有CPU属于节点0
+ *
+ */
+class MicroCpuTopology {
+public:
+    // 进程启动时的拓扑，首次调用时发现
+    static const MicroCpuTopology &instance(void) {
+        static MicroCpuTopology topology;
+        return topology;
+    }
+
+    // 进程允许使用的CPU
+    const std::vector<int> &cpus(void) const { return cpus_; }
+
+    // NUMA节点，按节点号排序
+    const std::vector<int> &nodes(void) const { return nodes_; }
+
+    // 节点内进程允许使用的CPU，节点不存在时返回空
+    std::vector<int> node_cpus(int node) const {
+        auto item = node_cpus_.find(node);
+        return item == node_cpus_.end() ? std::vector<int>() : item->second;
+    }
+
+    // CPU所在的节点，未知的CPU返回-1
+    int cpu_node(int cpu) const {
+        auto item = cpu_node_.find(cpu);
+        return item == cpu_node_.end() ? -1 : item->second;
+    }
+
+    // 把调用线程绑定到cpus，为空时不绑定
+    static bool pin(const std::vector<int> &cpus) {
+        cpu_set_t set;
+
+        if (cpus.empty()) {
+            return false;
+        }
+
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+
+        return 0 == sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    // 解析cpulist格式，如0-3,8,10-11
+    static std::vector<int> parse_cpulist(const char *list) {
+        std::vector<int> cpus;
+
+        while (list && *list) {
+            char *end = nullptr;
+            long first = strtol(list, &end, 10);
+
+            if (end == list) {
+                break;
+            }
+
+            long last = first;
+            list = end;
+
+            if ('-' == *list) {
+                last = strtol(list + 1, &end, 10);
+                list = end;
+            }
+
+            for (long cpu = first; cpu <= last; cpu++) {
+                cpus.push_back((int)cpu);
+            }
+
+            if (',' != *list) {
+                break;
+            }
+            list++;
+        }
+
+        return cpus;
+    }
+
+private:
+    MicroCpuTopology() {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        if (0 == sched_getaffinity(0, sizeof(set), &set)) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus_.push_back(cpu);
+                }
+            }
+        }
+
+        if (cpus_.empty()) {
+            for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency();
+                 cpu++) {
+                cpus_.push_back((int)cpu);
+            }
+        }
+
+        discover_nodes();
+
+        // 没有节点信息时所有CPU属于节点0
+        if (nodes_.empty()) {
+            nodes_.push_back(0);
+            node_cpus_[0] = cpus_;
+            for (int cpu : cpus_) {
+                cpu_node_[cpu] = 0;
+            }
+        }
+    }
+
+    // 读取各节点的cpulist，只保留进程允许使用的CPU
+    void discover_nodes(void) {
+        DIR *dir = opendir(MICRO_SYS_NODE_DIR);
+
+        if (!dir) {
+            return;
+        }
+
+        while (struct dirent *entry = readdir(dir)) {
+            int node = 0;
+            char path[512];
+            char list[4096];
+
+            if (1 != sscanf(entry->d_name, "node%d", &node)) {
+                continue;
+            }
+
+            snprintf(path, sizeof(path), MICRO_SYS_NODE_DIR "/%s/cpulist",
+                     entry->d_name);
+
+            FILE *fp = fopen(path, "r");
+
+            if (!fp) {
+                continue;
+            }
+
+            bool ok = nullptr != fgets(list, sizeof(list), fp);
+            fclose(fp);
+
+            if (!ok) {
+                continue;
+            }
+
+            std::vector<int> cpus;
+
+            for (int cpu : parse_cpulist(list)) {
+                if (std::find(cpus_.begin(), cpus_.end(), cpu) != cpus_.end()) {
+                    cpus.push_back(cpu);
+                    cpu_node_[cpu] = node;
+                }
+            }
+
+            // 没有可用CPU的节点(如纯内存节点)不参与调度
+            if (!cpus.empty()) {
+                nodes_.push_back(node);
+                node_cpus_[node] = cpus;
+            }
+        }
+
+        closedir(dir);
+        std::sort(nodes_.begin(), nodes_.end());
+    }
+
+private:
+    std::vector<int> cpus_;                      ///< 允许使用的CPU
+    std::vector<int> nodes_;                     ///< 有可用CPU的节点
+    std::map<int, std::vector<int>> node_cpus_;  ///< 节点内的CPU
+    std::map<int, int> cpu_node_;                ///< CPU所在节点
+};
+
+}
@@ -0,0 +1,89 @@
+/**
+ * @file micro_event_count.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 无锁结构的等待通知
+ * @date 2021-01-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace Asty {
+
+/**
+ * @brief 事件计数器
+ * @details 供无锁结构在条件不满足时休眠，通知方只有在存在等待者时才加锁，
+ * 快速路径上只有一次原子读
+ *
+ */
+class MicroEventCount {
+public:
+    MicroEventCount() : waiters_(0) {}
+
+    // 等待直到条件满足，条件在持锁时检查
+    template <typename Pred>
+    void wait(Pred pred) {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        waiters_.fetch_add(1);
+        while (!pred()) {
+            cond_.wait(lck);
+        }
+        waiters_.fetch_sub(1);
+    }
+
+    // 带超时的等待，超时返回条件的最后结果
+    template <typename Pred, typename Rep, typename Period>
+    bool wait_for(Pred pred, const std::chrono::duration<Rep, Period> &timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        bool ret = true;
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        waiters_.fetch_add(1);
+        while (!pred()) {
+            if (std::cv_status::timeout == cond_.wait_until(lck, deadline)) {
+                ret = pred();
+                break;
+            }
+        }
+        waiters_.fetch_sub(1);
+
+        return ret;
+    }
+
+    // 唤醒一个等待者，调用前需已发布条件的变化
+    void notify_one(void) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed)) {
+            { std::lock_guard<std::mutex> lck(mutex_); }
+            cond_.notify_one();
+        }
+    }
+
+    // 唤醒全部等待者
+    void notify_all(void) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed)) {
+            { std::lock_guard<std::mutex> lck(mutex_); }
+            cond_.notify_all();
+        }
+    }
+
+    // 当前等待者数量，并发时为近似值
+    uint32_t waiters(void) const {
+        return waiters_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint32_t> waiters_;  ///< 等待者数量
+    std::mutex mutex_;               ///< 休眠锁
+    std::condition_variable cond_;   ///< 休眠条件变量
+};
+
+}
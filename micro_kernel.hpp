@@ -9,10 +9,23 @@
  */
 #pragma once
 
-#include <iostream>
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <list>
 #include <mutex>
+#include <set>
 #include <stdexcept>
+#include <vector>
+#include "micro_plugin_stream.hpp"
+#include "micro_rcu.hpp"
+#include "micro_reactor.hpp"
+#include "micro_scheduler.hpp"
 #include "micro_thread_pool.hpp"
+#include "micro_timer_wheel.hpp"
 #include "plugin.hpp"
 
 namespace Asty {
@@ -27,10 +40,17 @@ namespace Asty {
 template <typename T>
 class MicroKernel : public IMicroKernelServices<T> {
 public:
-    MicroKernel(uint32_t plugin_limit, std::shared_ptr<IThreadPool> thread_pool)
+    // task_period为插件默认调度周期(ms)
+    MicroKernel(uint32_t plugin_limit, std::shared_ptr<IThreadPool> thread_pool,
+                uint32_t task_period = 10)
         : version_(MICRO_KERNEL_VERSION),
           limit_(plugin_limit),
+          plugins_(new plugin_map()),
+          topics_(new topic_map()),
+          notice_inflight_(0),
           thread_pool_(thread_pool),
+          scheduler_(task_period),
+          timers_(thread_pool),
           running_(false),
           exit_(false) {
         if (!thread_pool_) {
@@ -49,91 +69,846 @@ public:
         }
 
         std::list<PluginKey<T>> bad_plugin;
+        std::set<PluginKey<T>> failed;
+        std::vector<plugin_list> levels;
+        plugin_list unresolved;
+        std::vector<char> ok;
+        auto begin = std::chrono::steady_clock::now();
+
+        plugin_levels(*plugins_.load(), levels, unresolved);
+
+        // 依赖缺失或成环的插件
+        for (auto &plugin : unresolved) {
+            plugin->set_plugin_status(E_PLUGIN_BAD);
+            log(E_LOG_ERROR,
+                "plugin : [name = %s] [version = %s] depends unresolved",
+                plugin->plugin_key_.name.c_str(),
+                plugin->plugin_key_.version.c_str());
+            bad_plugin.push_front(plugin->plugin_key_);
+        }
 
-        // 初始化
-        for (auto &plugin : plugins_) {
-            if (plugin.second) {
-                plugin.second->set_micro_kernel_srv(this);
-                if (!plugin.second->plugin_init()) {
-                    plugin.second->set_plugin_status(E_PLUGIN_BAD);
-                    std::cout << "plugin : [name = " << plugin.first.name
-                              << "] [version = " << plugin.first.version
-                              << "] init failed" << std::endl;
-                    bad_plugin.push_front(plugin.first);
+        // 按依赖分层，同一层的插件在线程池中并发初始化和启动
+        for (auto &level : levels) {
+            plugin_list runnable;
+
+            for (auto &plugin : level) {
+                if (depends_failed(plugin, failed)) {
+                    plugin->set_plugin_status(E_PLUGIN_BAD);
+                    log(E_LOG_ERROR,
+                        "plugin : [name = %s] [version = %s] depends failed",
+                        plugin->plugin_key_.name.c_str(),
+                        plugin->plugin_key_.version.c_str());
+                    failed.insert(plugin->plugin_key_);
+                    bad_plugin.push_front(plugin->plugin_key_);
+                } else {
+                    runnable.push_back(plugin);
                 }
             }
-        }
 
-        // 清除初始化异常的插件
-        for (auto &item : bad_plugin) {
-            auto k = plugins_.find(item);
+            run_parallel(runnable, ok, [this](const plugin_ptr &plugin) {
+                return start_plugin(plugin);
+            });
 
-            if (k != plugins_.end()) {
-                plugins_.erase(k);
+            for (size_t i = 0; i < runnable.size(); i++) {
+                if (!ok[i]) {
+                    failed.insert(runnable[i]->plugin_key_);
+                    bad_plugin.push_front(runnable[i]->plugin_key_);
+                }
             }
         }
 
+        // 清除初始化或启动异常的插件
+        erase_plugins(bad_plugin);
+
         bad_plugin.clear();
 
-        // 启动插件
-        for (auto &plugin : plugins_) {
-            if (plugin.second) {
-                if (!plugin.second->plugin_start()) {
-                    plugin.second->set_plugin_status(E_PLUGIN_BAD);
-                    std::cout << "plugin : [name = " << plugin.first.name
-                              << "] [version = " << plugin.first.version
-                              << "] start failed" << std::endl;
-                    bad_plugin.push_front(plugin.first);
+        log(E_LOG_INFO,
+            "plugins started : [count = %u] [levels = %u] [cost = %.3f ms]",
+            (uint32_t)plugins_.load()->size(), (uint32_t)levels.size(),
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - begin)
+                .count());
+
+        // 启动用的插件列表在微内核循环期间不再使用，释放引用，
+        // 使之后注销的插件能随插件表释放
+        levels.clear();
+        unresolved.clear();
+
+        // 加入调度
+        scheduler_.reset();
+        for (auto &plugin : *plugins_.load()) {
+            scheduler_.add(plugin.second);
+        }
+
+        running_ = true;
+        exit_ = false;
+
+        lck.unlock();
+
+        std::vector<std::shared_ptr<IPlugin<T>>> due;
+        std::vector<std::shared_ptr<IPlugin<T>>> ready;
+        TaskBatch batch;
+
+        // 进入微内核循环，没有到期或就绪的插件时休眠；
+        // 每个周期的插件任务整批提交一次
+        while (running_ && scheduler_.wait(due, ready)) {
+            for (auto &plugin : due) {
+                batch_task(plugin, false, batch);
+            }
+
+            for (auto &plugin : ready) {
+                batch_task(plugin, true, batch);
+            }
+
+            flush_tasks(batch);
+
+            due.clear();
+            ready.clear();
+        }
+
+        // 持锁通知，避免stop返回后条件变量已被析构
+        lck.lock();
+        exit_ = true;
+        micro_kernel_exited_.notify_one();
+    }
+
+private:
+    typedef std::shared_ptr<IPlugin<T>> plugin_ptr;
+    typedef std::map<PluginKey<T>, plugin_ptr> plugin_map;
+    typedef std::vector<plugin_ptr> plugin_list;
+    typedef std::map<uint32_t, std::shared_ptr<const plugin_list>> topic_map;
+
+    static const size_t kNoticeBatch = 16;  ///< 每个线程池任务通知的订阅者数
+    static const uint32_t kRetryDelay = 1;  ///< 被拒绝的提交重试的间隔(ms)
+    static const int kPumpWait = 10;        ///< 工作线程中每次等待流就绪的时间(ms)
+
+    /**
+     * @brief 反应器监视的流
+     *
+     */
+    struct StreamWatch {
+        StreamWatch(const plugin_ptr &plugin,
+                    const std::shared_ptr<IPluginStream<T>> &stream)
+            : plugin(plugin), stream(stream), pending(0) {}
+
+        plugin_ptr plugin;                         ///< 处理就绪的插件
+        std::shared_ptr<IPluginStream<T>> stream;  ///< 流
+        std::atomic<int64_t> pending;              ///< 未处理的就绪事件数
+    };
+
+    /**
+     * @brief 反应器监视的描述符
+     *
+     */
+    struct FdWatch {
+        explicit FdWatch(const std::function<void(void)> &cb)
+            : cb(cb), pending(0) {}
+
+        std::function<void(void)> cb;  ///< 可读时执行的回调
+        std::atomic<int64_t> pending;  ///< 未处理的触发数
+    };
+
+    // 查找插件，读路径无锁，item_key非空时同时返回插件信息
+    std::shared_ptr<IPlugin<T>> find_plugin(const T &key,
+                                            PluginKey<T> *item_key = nullptr) {
+        MicroRcuReadGuard guard;
+        const plugin_map *plugins = plugins_.load();
+
+        PluginKey<T> tmp;
+        tmp.key = key;
+
+        auto item = plugins->find(tmp);
+
+        // 插件未找到
+        if (item == plugins->end()) {
+            return nullptr;
+        }
+
+        if (item_key) {
+            *item_key = item->first;
+        }
+
+        return item->second;
+    }
+
+    // 按依赖关系把插件分层，每层只依赖之前各层的插件，
+    // 依赖缺失、成环或依赖这些插件的插件放入unresolved
+    static void plugin_levels(const plugin_map &plugins,
+                              std::vector<plugin_list> &levels,
+                              plugin_list &unresolved) {
+        std::map<PluginKey<T>, size_t> pending;
+        std::map<PluginKey<T>, plugin_list> dependents;
+        plugin_list level;
+
+        for (auto &item : plugins) {
+            size_t cnt = 0;
+
+            for (auto &key : item.second->plugin_depends()) {
+                PluginKey<T> dep;
+                dep.key = key;
+
+                // 缺失的依赖不会被满足
+                dependents[dep].push_back(item.second);
+                cnt++;
+            }
+
+            pending[item.first] = cnt;
+
+            if (!cnt) {
+                level.push_back(item.second);
+            }
+        }
+
+        while (!level.empty()) {
+            plugin_list next;
+
+            for (auto &plugin : level) {
+                auto item = dependents.find(plugin->plugin_key_);
+
+                if (item == dependents.end()) {
+                    continue;
+                }
+
+                for (auto &dependent : item->second) {
+                    if (!--pending[dependent->plugin_key_]) {
+                        next.push_back(dependent);
+                    }
                 }
-                plugin.second->set_plugin_status(E_PLUGIN_RUNING);
             }
+
+            levels.push_back(std::move(level));
+            level.swap(next);
         }
 
-        // 清除启动异常的插件
-        for (auto &item : bad_plugin) {
-            auto k = plugins_.find(item);
+        for (auto &item : plugins) {
+            if (pending[item.first]) {
+                unresolved.push_back(item.second);
+            }
+        }
+    }
 
-            if (k != plugins_.end()) {
-                plugins_.erase(k);
+    // 依赖的插件是否都已注册
+    static bool depends_registered(const plugin_map &plugins,
+                                   const plugin_ptr &plugin) {
+        for (auto &key : plugin->plugin_depends()) {
+            PluginKey<T> dep;
+            dep.key = key;
+
+            if (!plugins.count(dep)) {
+                return false;
             }
         }
 
-        bad_plugin.clear();
+        return true;
+    }
 
-        running_ = true;
-        exit_ = false;
+    // 是否有依赖的插件已失败
+    static bool depends_failed(const plugin_ptr &plugin,
+                               const std::set<PluginKey<T>> &failed) {
+        for (auto &key : plugin->plugin_depends()) {
+            PluginKey<T> dep;
+            dep.key = key;
 
-        lck.unlock();
+            if (failed.count(dep)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // 在线程池中并发执行fn并等待全部完成，ok返回每个插件的结果，
+    // 只有一个插件或线程池未接收时直接执行
+    template <typename Fn>
+    void run_parallel(const plugin_list &plugins, std::vector<char> &ok,
+                      Fn fn) {
+        std::mutex mutex;
+        std::condition_variable cond;
+        size_t done = 0;
 
-        // 进入微内核循环
-        while (running_) {
-            // 整个插件循环一次才进行解锁
-            lck.lock();
-
-            // 循环添加任务到线程池进行执行
-            for (auto plugin : plugins_) {
-                // 判断一次退出
-                if (!running_) {
-                    lck.unlock();
-                    goto __exit;
+        ok.assign(plugins.size(), 0);
+
+        if (plugins.size() <= 1) {
+            for (size_t i = 0; i < plugins.size(); i++) {
+                ok[i] = fn(plugins[i]);
+            }
+            return;
+        }
+
+        for (size_t i = 0; i < plugins.size(); i++) {
+            thread_task_add_status status = thread_pool_->add_task_for([&, i] {
+                bool ret = fn(plugins[i]);
+
+                // 持锁通知，避免等待方返回后条件变量已被析构
+                std::lock_guard<std::mutex> lck(mutex);
+                ok[i] = ret;
+                if (++done == plugins.size()) {
+                    cond.notify_one();
                 }
+            }, -1, keep_attr());
+
+            // 线程池已停止等原因未接收时在当前线程执行
+            if (!accepted(status)) {
+                bool ret = fn(plugins[i]);
+
+                std::lock_guard<std::mutex> lck(mutex);
+                ok[i] = ret;
+                ++done;
+            }
+        }
+
+        std::unique_lock<std::mutex> lck(mutex);
+        cond.wait(lck, [&] { return done == plugins.size(); });
+    }
+
+    // 初始化并启动插件，记录耗时
+    bool start_plugin(const plugin_ptr &plugin) {
+        const PluginKey<T> &key = plugin->plugin_key_;
+        auto begin = std::chrono::steady_clock::now();
+
+        plugin->set_micro_kernel_srv(this);
+
+        if (!plugin->plugin_init()) {
+            plugin->set_plugin_status(E_PLUGIN_BAD);
+            log(E_LOG_ERROR, "plugin : [name = %s] [version = %s] init failed",
+                key.name.c_str(), key.version.c_str());
+            return false;
+        }
+
+        auto inited = std::chrono::steady_clock::now();
+        plugin->metrics_.record_init(elapsed_ns(begin, inited));
+
+        if (!plugin->plugin_start()) {
+            plugin->set_plugin_status(E_PLUGIN_BAD);
+            log(E_LOG_ERROR, "plugin : [name = %s] [version = %s] start failed",
+                key.name.c_str(), key.version.c_str());
+            return false;
+        }
+
+        plugin->metrics_.record_start(
+            elapsed_ns(inited, std::chrono::steady_clock::now()));
+        plugin->set_plugin_status(E_PLUGIN_RUNING);
+
+        return true;
+    }
+
+    // 停止插件，记录耗时，actor插件等邮箱处理完后停止
+    bool stop_plugin(const plugin_ptr &plugin) {
+        auto begin = std::chrono::steady_clock::now();
+
+        while (plugin->actor_pending_ > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        plugin->plugin_stop();
+        plugin->plugin_exit();
+        plugin->plugin_detach();
+        plugin->set_plugin_status(E_PLUGIN_STOP);
+        plugin->metrics_.record_stop(
+            elapsed_ns(begin, std::chrono::steady_clock::now()));
 
-                if (plugin.second->plugin_task_en()) {
-                    thread_pool_->add_task(
-                        [plugin] { plugin.second->plugin_task(); });
+        return true;
+    }
+
+    static uint64_t elapsed_ns(std::chrono::steady_clock::time_point begin,
+                               std::chrono::steady_clock::time_point end) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   end - begin)
+            .count();
+    }
+
+    // 复制插件表并删除插件后发布新快照，同时删除插件的订阅，需持有mtx_
+    void erase_plugins(const std::list<PluginKey<T>> &keys) {
+        if (keys.empty()) {
+            return;
+        }
+
+        plugin_map *plugins = new plugin_map(*plugins_.load());
+
+        for (auto &item : keys) {
+            plugins->erase(item);
+        }
+
+        plugins_.update(plugins);
+
+        // 先发布插件表，之后的订阅找不到已删除的插件
+        std::unique_lock<std::mutex> lck(topic_mtx_);
+        topic_map *topics = new topic_map();
+
+        for (auto &topic : *topics_.load()) {
+            plugin_list *subs = new plugin_list();
+
+            for (auto &plugin : *topic.second) {
+                if (std::find(keys.begin(), keys.end(), plugin->plugin_key_) ==
+                    keys.end()) {
+                    subs->push_back(plugin);
                 }
             }
 
-            lck.unlock();
+            if (subs->empty()) {
+                delete subs;
+                continue;
+            }
+
+            (*topics)[topic.first] = std::shared_ptr<const plugin_list>(subs);
         }
 
-    __exit:
+        topics_.update(topics);
+    }
 
-        exit_ = true;
-        micro_kernel_exited_.notify_one();
+    // 复制主题表并替换一个主题的订阅者后发布新快照，需持有topic_mtx_
+    void update_topic(uint32_t topic, plugin_list *subs) {
+        topic_map *topics = new topic_map(*topics_.load());
+
+        if (subs->empty()) {
+            delete subs;
+            topics->erase(topic);
+        } else {
+            (*topics)[topic] = std::shared_ptr<const plugin_list>(subs);
+        }
+
+        topics_.update(topics);
+    }
+
+    /**
+     * @brief 一个调度周期内待提交的任务
+     *
+     */
+    struct TaskBatch {
+        void clear(void) {
+            plugins.clear();
+            tasks.clear();
+            attrs.clear();
+            merges.clear();
+        }
+
+        std::vector<plugin_ptr> plugins;    ///< 任务所属插件
+        std::vector<thread_task_t> tasks;   ///< 任务
+        std::vector<ThreadTaskAttr> attrs;  ///< 任务属性
+        std::vector<char> merges;           ///< 是否为唤醒或补调
+    };
+
+    // 提交插件任务，不等待线程池队列，被拒绝时计数，等下一次调度
+    void submit_task(const plugin_ptr &plugin, bool merge) {
+        ThreadTaskAttr attr;
+
+        if (reserve_task(plugin, merge, attr)) {
+            post_task(plugin, merge, attr);
+        }
+    }
+
+    // 不等待地投递已占用并发名额的插件任务
+    void post_task(const plugin_ptr &plugin, bool merge,
+                   const ThreadTaskAttr &attr) {
+        thread_task_add_status status =
+            post(plugin, [this, plugin] { run_task(plugin); }, attr, 0);
+
+        finish_task(plugin, merge, status);
+    }
+
+    // 插件任务加入本周期的批量提交，actor插件的任务直接投递到邮箱
+    void batch_task(const plugin_ptr &plugin, bool merge, TaskBatch &batch) {
+        ThreadTaskAttr attr;
+
+        if (!reserve_task(plugin, merge, attr)) {
+            return;
+        }
+
+        if (plugin->actor_batch_) {
+            post_task(plugin, merge, attr);
+            return;
+        }
+
+        batch.plugins.push_back(plugin);
+        batch.tasks.emplace_back([this, plugin] { run_task(plugin); });
+        batch.attrs.push_back(attr);
+        batch.merges.push_back(merge);
+    }
+
+    // 整批提交到线程池，不等待队列，未被接收的任务按拒绝处理
+    void flush_tasks(TaskBatch &batch) {
+        size_t n = thread_pool_->add_tasks(
+            batch.tasks.data(), batch.tasks.size(), 0, batch.attrs.data());
+
+        for (size_t i = 0; i < batch.plugins.size(); i++) {
+            finish_task(batch.plugins[i], batch.merges[i],
+                        i < n ? E_TASK_ADD_OK : E_TASK_ADD_FULL);
+        }
+
+        batch.clear();
+    }
+
+    // 占用插件的一个并发名额并确定任务属性，
+    // 排队或执行中的任务达到插件并发上限时合并，
+    // merge为true时在执行结束后补调一次，否则直接跳过；
+    // 周期任务以下一个周期到期为截止时间
+    bool reserve_task(const plugin_ptr &plugin, bool merge,
+                      ThreadTaskAttr &attr) {
+        if (!running_ || plugin->draining_ ||
+            E_PLUGIN_RUNING != plugin->plugin_status() ||
+            !plugin->plugin_task_en()) {
+            return false;
+        }
+
+        uint32_t limit = plugin->plugin_task_concurrency();
+        uint32_t inflight = plugin->task_inflight_.load();
+
+        if (!limit) {
+            limit = 1;
+        }
+
+        for (;;) {
+            if (inflight < limit) {
+                if (plugin->task_inflight_.compare_exchange_weak(
+                        inflight, inflight + 1)) {
+                    break;
+                }
+                continue;
+            }
+
+            if (merge) {
+                plugin->task_rerun_ = true;
+
+                // 任务可能恰好执行结束而错过补调标记，此时收回标记自行提交
+                inflight = plugin->task_inflight_.load();
+                if (inflight < limit && plugin->task_rerun_.exchange(false)) {
+                    continue;
+                }
+            }
+
+            plugin->task_coalesced_++;
+            return false;
+        }
+
+        // 占用名额后插件才开始停止时归还，停止方总能看到其中之一
+        if (plugin->draining_) {
+            plugin->task_inflight_--;
+            drain_notify(plugin);
+            return false;
+        }
+
+        attr = task_attr(plugin);
+        uint32_t period = merge ? 0 : scheduler_.period(plugin);
+
+        if (period) {
+            attr.deadline = ThreadTaskAttr::clock::now() +
+                            std::chrono::milliseconds(period);
+        }
+
+        return true;
+    }
+
+    // 记录提交结果，被拒绝时归还并发名额，周期任务等下一个周期；
+    // 唤醒和补调没有下一个周期，稍后重新唤醒，不能丢失
+    void finish_task(const plugin_ptr &plugin, bool merge,
+                     thread_task_add_status status) {
+        if (!accepted(status)) {
+            plugin->task_inflight_--;
+            plugin->task_rejected_++;
+            drain_notify(plugin);
+            if (merge && E_TASK_ADD_STOPPED != status) {
+                scheduler_.retry(plugin, kRetryDelay);
+            }
+            return;
+        }
+
+        plugin->task_submitted_++;
+    }
+
+    // 按线程池的溢出策略添加时的等待时间，阻塞策略一直等待，其他策略不等待
+    int64_t policy_wait(void) {
+        return E_TASK_OVERFLOW_BLOCK == thread_pool_->overflow_policy() ? -1
+                                                                        : 0;
+    }
+
+    // 线程池是否接收了任务
+    static bool accepted(thread_task_add_status status) {
+        return E_TASK_ADD_OK == status || E_TASK_ADD_CALLER_RAN == status;
+    }
+
+    // 微内核内部任务的属性，等待计数依赖这些任务执行，溢出时不能丢弃
+    static ThreadTaskAttr keep_attr(
+        thread_task_prio prio = E_TASK_PRIO_NORMAL) {
+        ThreadTaskAttr attr(prio);
+
+        attr.keep = true;
+
+        return attr;
+    }
+
+    // 插件在线程池中执行的优先级和亲和性
+    static ThreadTaskAttr task_attr(const plugin_ptr &plugin) {
+        ThreadTaskAttr attr = keep_attr(plugin->plugin_task_prio());
+
+        attr.node = plugin->plugin_task_node();
+        attr.cpu = plugin->plugin_task_cpu();
+
+        return attr;
+    }
+
+    // 当前线程正在处理邮箱的actor插件
+    static IPlugin<T> *&current_actor(void) {
+        static thread_local IPlugin<T> *actor = nullptr;
+        return actor;
+    }
+
+    // 投递插件的调用，actor插件投递到邮箱，未处理邮件数从0增加时提交
+    // 一次激活；其他插件按wait(us)提交到线程池
+    thread_task_add_status post(const plugin_ptr &plugin, thread_task_t &&task,
+                                const ThreadTaskAttr &attr, int64_t wait) {
+        if (!plugin->actor_batch_) {
+            return thread_pool_->add_task_for(std::move(task), wait, attr);
+        }
+
+        // 链接到邮箱后再计数
+        plugin->mailbox_.push(std::move(task));
+
+        if (0 == plugin->actor_pending_.fetch_add(1)) {
+            post_activate(plugin, attr, wait);
+        }
+
+        // 抵消了激活方暂时扣成负数的计数
+        drain_notify(plugin);
+
+        return E_TASK_ADD_OK;
+    }
+
+    // 提交actor插件的激活，激活不能丢失，队列满时等待wait(us)，
+    // 仍被拒绝时稍后重试，定时器已停止时一直等待
+    void post_activate(const plugin_ptr &plugin, const ThreadTaskAttr &attr,
+                       int64_t wait) {
+        thread_task_add_status status = thread_pool_->add_task_for(
+            [this, plugin] { activate(plugin); }, wait, attr);
+
+        if (accepted(status) || E_TASK_ADD_STOPPED == status) {
+            return;
+        }
+
+        if (!timers_.add(kRetryDelay, 0, [this, plugin, attr] {
+                post_activate(plugin, attr, 0);
+            })) {
+            thread_pool_->add_task_for([this, plugin] { activate(plugin); },
+                                       -1, attr);
+        }
+    }
+
+    // 处理actor插件的邮件，每次最多actor_batch_个，之后让出线程
+    void activate(const plugin_ptr &plugin) {
+        thread_task_t task;
+        IPlugin<T> *prev = current_actor();
+        int64_t done = 0;
+
+        current_actor() = plugin.get();
+
+        for (uint32_t i = 0; i < plugin->actor_batch_; i++) {
+            if (!plugin->mailbox_.pop(task)) {
+                break;
+            }
+            task();
+            task = nullptr;
+            done++;
+        }
+
+        current_actor() = prev;
+
+        // 扣除本次处理的邮件数，仍有未处理的邮件时重新激活；
+        // 清除激活后不能再访问邮箱，新的投递方可能已开始处理。
+        // 已取出但投递方尚未计数的邮件使计数暂时为负，投递方计数时抵消
+        if (plugin->actor_pending_.fetch_sub(done) > done) {
+            thread_pool_->add_task_for([this, plugin] { activate(plugin); },
+                                       -1, task_attr(plugin));
+        } else {
+            drain_notify(plugin);
+        }
+    }
+
+    // 等待已标记停止的插件提交的任务和actor邮箱中的邮件执行完，
+    // 调用方不能持有mtx_，不能在该插件的调用中执行
+    void drain_plugin(const plugin_ptr &plugin) {
+        std::unique_lock<std::mutex> lck(drain_mtx_);
+
+        drain_cond_.wait(lck, [&plugin] {
+            return !plugin->task_inflight_ && !plugin->actor_pending_;
+        });
+    }
+
+    // 插件的任务或邮件执行完，插件正在停止且已全部执行完时通知等待方
+    void drain_notify(const plugin_ptr &plugin) {
+        if (plugin->draining_ && !plugin->task_inflight_ &&
+            !plugin->actor_pending_) {
+            std::lock_guard<std::mutex> lck(drain_mtx_);
+            drain_cond_.notify_all();
+        }
+    }
+
+    // 通知任务执行完，微内核停止后最后一个通知任务通知等待方
+    void notice_done(void) {
+        if (1 == notice_inflight_.fetch_sub(1) && !running_) {
+            std::lock_guard<std::mutex> lck(drain_mtx_);
+            drain_cond_.notify_all();
+        }
+    }
+
+    // 执行插件任务
+    void run_task(const std::shared_ptr<IPlugin<T>> &plugin) {
+        MicroMetricsTimer timer(true);
+        bool ret = plugin->plugin_task();
+        plugin->metrics_.record_task(timer, ret);
+        plugin->task_inflight_--;
+        drain_notify(plugin);
+
+        // 执行期间被合并的唤醒补调一次
+        if (plugin->task_rerun_.exchange(false)) {
+            submit_task(plugin, true);
+        }
+    }
+
+    // 分发消息给已找到的插件，同步和异步分发共用
+    bool dispatch_message(const std::shared_ptr<IPlugin<T>> &plugin,
+                          const PluginKey<T> &from, const PluginKey<T> &to,
+                          const PluginDataT &request, PluginDataT &response) {
+        const PluginMessage<T> req_msg{from, to, request};
+
+        PluginMessage<T> res_msg{to, (PluginKey<T>)from, response};
+
+        // 插件消息处理
+        MicroMetricsTimer timer;
+        bool ret = plugin->message(req_msg, res_msg);
+        plugin->metrics_.record_message(timer, ret);
+
+        response = res_msg.data;
+
+        return ret;
+    }
+
+    // 完成异步调用，已完成时不改变状态，并取消截止时间定时器
+    void finish_call(const std::shared_ptr<PluginCall> &call,
+                     plugin_call_status st,
+                     const PluginDataT &response = PluginDataT{}) {
+        call->complete(st, response);
+
+        if (call->timer_) {
+            timers_.cancel(call->timer_);
+        }
+    }
+
+    // 反应器监视插件接受的流，描述符每次触发时提交一次就绪处理，
+    // 处理期间的触发合并为处理结束后的一次补调；
+    // 反应器无法监视时在当前工作线程中处理该流
+    void watch_stream(const plugin_ptr &plugin,
+                      const std::shared_ptr<IPluginStream<T>> &stream) {
+        std::shared_ptr<StreamWatch> watch(new StreamWatch(plugin, stream));
+
+        uint64_t watched =
+            reactor_.add(stream->event_fd(), [this, watch](uint64_t id) {
+                if (0 == watch->pending.fetch_add(1)) {
+                    post_stream(watch, id);
+                }
+            });
+
+        if (!watched) {
+            log(E_LOG_WARN,
+                "plugin : [name = %s] [version = %s] stream not watched, "
+                "handled in worker",
+                plugin->plugin_key_.name.c_str(),
+                plugin->plugin_key_.version.c_str());
+            pump_stream(plugin, stream);
+        }
+    }
+
+    // 在当前线程中等待流就绪并处理，直到插件返回false，与按原方式处理流
+    // 一样占用一个工作线程；每次最多等待kPumpWait，微内核停止或插件正在
+    // 停止时返回，不阻塞停止
+    void pump_stream(const plugin_ptr &plugin,
+                     const std::shared_ptr<IPluginStream<T>> &stream) {
+        struct pollfd pfd = {stream->event_fd(), POLLIN, 0};
+        int ready = 1;
+
+        while (running_ && !plugin->draining_) {
+            if (ready > 0) {
+                stream->event_clear();
+
+                if (!plugin->stream_ready(stream)) {
+                    return;
+                }
+            }
+
+            ready = poll(&pfd, 1, kPumpWait);
+
+            if (ready < 0 && EINTR != errno) {
+                return;
+            }
+        }
+    }
+
+    // 提交流就绪处理，不等待队列空位，避免阻塞反应器线程；
+    // 线程池拒绝时稍后重试，期间的触发合并到这次处理
+    void post_stream(const std::shared_ptr<StreamWatch> &watch, uint64_t id) {
+        thread_task_add_status status =
+            post(watch->plugin, [this, watch, id] { run_stream(watch, id); },
+                 task_attr(watch->plugin), 0);
+
+        if (!accepted(status) && E_TASK_ADD_STOPPED != status) {
+            timers_.add(kRetryDelay, 0,
+                        [this, watch, id] { post_stream(watch, id); });
+        }
+    }
+
+    // 处理流就绪，插件返回false时取消监视
+    void run_stream(const std::shared_ptr<StreamWatch> &watch, uint64_t id) {
+        int64_t seen = watch->pending.load();
+
+        watch->stream->event_clear();
+
+        if (!watch->plugin->stream_ready(watch->stream)) {
+            reactor_.remove(id);
+            return;
+        }
+
+        if (watch->pending.fetch_sub(seen) > seen) {
+            post_stream(watch, id);
+        }
+    }
+
+    // 提交描述符回调，与流就绪处理一样不等待队列空位，拒绝时稍后重试
+    void post_fd(const std::shared_ptr<FdWatch> &watch) {
+        thread_task_add_status status = thread_pool_->add_task_for(
+            thread_task_t([this, watch] { run_fd(watch); }), 0, keep_attr());
+
+        if (!accepted(status) && E_TASK_ADD_STOPPED != status) {
+            timers_.add(kRetryDelay, 0, [this, watch] { post_fd(watch); });
+        }
+    }
+
+    // 执行描述符回调，期间的触发合并为一次补调
+    void run_fd(const std::shared_ptr<FdWatch> &watch) {
+        int64_t seen = watch->pending.load();
+
+        watch->cb();
+
+        if (watch->pending.fetch_sub(seen) > seen) {
+            post_fd(watch);
+        }
+    }
+
+    // 导出一个直方图
+    static void dump_histogram(std::string &out, const char *name,
+                               const MicroHistogramStat &h, bool json) {
+        char buf[256];
+
+        snprintf(buf, sizeof(buf),
+                 json ? ", \"%s\": {\"count\": %lu, \"failed\": %lu, "
+                        "\"sum_ns\": %lu, \"p50_ns\": %lu, \"p90_ns\": %lu, "
+                        "\"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu}"
+                      : " %s[count=%lu failed=%lu sum_ns=%lu p50_ns=%lu "
+                        "p90_ns=%lu p99_ns=%lu p999_ns=%lu max_ns=%lu]",
+                 name, (unsigned long)h.count, (unsigned long)h.failed,
+                 (unsigned long)h.sum, (unsigned long)h.p50,
+                 (unsigned long)h.p90, (unsigned long)h.p99,
+                 (unsigned long)h.p999, (unsigned long)h.max);
+        out += buf;
     }
 
-private:
     // 停止微内核
     void stop(void) {
         std::unique_lock<std::mutex> lck(mtx_);
@@ -143,16 +918,58 @@ private:
         }
 
         running_ = false;
+        scheduler_.stop();
+
+        // 先停止反应器并取消全部监视，插件停止后不再处理流就绪
+        reactor_.stop();
+        timers_.stop();
 
         // 等待微内核退出
         micro_kernel_exited_.wait(lck, [this] { return exit_; });
 
-        for (auto &plugin : plugins_) {
-            if (E_PLUGIN_RUNING == plugin.second->plugin_status()) {
-                plugin.second->plugin_stop();
-                plugin.second->plugin_exit();
-                plugin.second->set_plugin_status(E_PLUGIN_STOP);
+        // 标记全部插件正在停止，释放锁后等待已提交的插件任务、邮件和
+        // 主题通知执行完，避免与plugin_stop并发；执行中的调用仍可使用
+        // 需要加锁的微内核接口
+        plugin_list plugins;
+
+        for (auto &plugin : *plugins_.load()) {
+            plugin.second->draining_ = true;
+            plugins.push_back(plugin.second);
+        }
+
+        lck.unlock();
+
+        for (auto &plugin : plugins) {
+            drain_plugin(plugin);
+        }
+
+        {
+            std::unique_lock<std::mutex> drain(drain_mtx_);
+            drain_cond_.wait(drain, [this] { return !notice_inflight_; });
+        }
+
+        lck.lock();
+
+        std::vector<plugin_list> levels;
+        plugin_list unresolved;
+        std::vector<char> ok;
+
+        // 按依赖逆序分层并发停止，依赖已不完整的插件最先停止
+        plugin_levels(*plugins_.load(), levels, unresolved);
+        levels.push_back(std::move(unresolved));
+
+        for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+            plugin_list running;
+
+            for (auto &plugin : *level) {
+                if (E_PLUGIN_RUNING == plugin->plugin_status()) {
+                    running.push_back(plugin);
+                }
             }
+
+            run_parallel(running, ok, [this](const plugin_ptr &plugin) {
+                return stop_plugin(plugin);
+            });
         }
     }
 
@@ -161,160 +978,680 @@ public:
     virtual std::string micro_kernel_version(void) override { return version_; }
 
     // 插件数量
-    virtual uint32_t plugin_cnt(void) override { return plugins_.size(); }
-    // 插件注册
+    virtual uint32_t plugin_cnt(void) override {
+        MicroRcuReadGuard guard;
+        return plugins_.load()->size();
+    }
+    // 插件注册，复制插件表后发布新快照，不影响正在进行的分发
     bool plugin_register(std::shared_ptr<IPlugin<T>> plugin) {
+        return 1 == plugin_register(
+                        std::vector<std::shared_ptr<IPlugin<T>>>{plugin});
+    }
+    // 批量插件注册，只复制和发布一次插件表，返回注册成功的数量
+    size_t plugin_register(
+        const std::vector<std::shared_ptr<IPlugin<T>>> &plugins) {
         std::unique_lock<std::mutex> lck(mtx_);
+        plugin_map *new_plugins = new plugin_map(*plugins_.load());
+        plugin_list added;
 
-        // 插件数量达到限制
-        if (plugins_.size() >= limit_) {
-            return false;
-        }
+        for (auto &plugin : plugins) {
+            // 插件数量达到限制
+            if (new_plugins->size() >= limit_) {
+                break;
+            }
 
-        auto item = plugins_.find(plugin->plugin_key_);
+            auto item = new_plugins->find(plugin->plugin_key_);
 
-        // 插件冲突
-        if (item != plugins_.end()) {
-            return false;
+            // 插件冲突
+            if (item != new_plugins->end()) {
+                continue;
+            }
+
+            plugin->set_micro_kernel_srv(this);
+            plugin->actor_batch_ = plugin->plugin_actor_batch();
+            plugin->draining_ = false;
+
+            // 如果正在运行，依赖的插件已注册时执行初始化和启动
+            if (running_) {
+                if (!depends_registered(*new_plugins, plugin) ||
+                    !start_plugin(plugin)) {
+                    continue;
+                }
+            }
+
+            new_plugins->insert(
+                std::pair<PluginKey<T>, std::shared_ptr<IPlugin<T>>>(
+                    plugin->plugin_key_, plugin));
+            added.push_back(plugin);
         }
 
-        plugin->set_micro_kernel_srv(this);
+        if (added.empty()) {
+            delete new_plugins;
+            return 0;
+        }
+
+        plugins_.update(new_plugins);
 
-        // 如果正在运行，则执行初始化和启动
         if (running_) {
-            if (!plugin->plugin_init() || !plugin->plugin_start()) {
-                return false;
+            for (auto &plugin : added) {
+                scheduler_.add(plugin);
             }
-            plugin->set_plugin_status(E_PLUGIN_RUNING);
         }
 
-        plugins_.insert(std::pair<PluginKey<T>, std::shared_ptr<IPlugin<T>>>(
-            plugin->plugin_key_, plugin));
-
-        return true;
+        return added.size();
     }
-    // 插件注销
+    // 插件注销，从插件表快照中移除，等待已提交的调用执行完后停止插件，
+    // 不能在该插件的调用中注销自身
     bool plugin_unregister(const T &key) {
         std::unique_lock<std::mutex> lck(mtx_);
 
         PluginKey<T> plugin_key;
         plugin_key.key = key;
 
-        auto item = plugins_.find(plugin_key);
+        auto item = plugins_.load()->find(plugin_key);
 
         // 插件未找到
-        if (item == plugins_.end()) {
+        if (item == plugins_.load()->end()) {
             return false;
         }
 
+        auto plugin = item->second;
+
+        erase_plugins(std::list<PluginKey<T>>{plugin_key});
+
         // 微内核未运行则直接返回
         if (!running_) {
             return true;
         }
 
-        // 插件退出
-        if (E_PLUGIN_RUNING == item->second->plugin_status()) {
-            item->second->plugin_stop();
-            item->second->plugin_exit();
-            item->second->set_plugin_status(E_PLUGIN_STOP);
+        // 标记插件正在停止，释放锁后等待已提交的任务和邮件执行完再退出，
+        // 执行中的调用仍可使用需要加锁的微内核接口
+        plugin->draining_ = true;
+        lck.unlock();
+        drain_plugin(plugin);
+
+        if (E_PLUGIN_RUNING == plugin->plugin_status()) {
+            plugin->plugin_stop();
+            plugin->plugin_exit();
+            plugin->plugin_detach();
+            plugin->set_plugin_status(E_PLUGIN_STOP);
         }
 
         return true;
     }
     // 信息查询
     virtual bool plugin_key(const T &key, PluginKey<T> &item_key) override {
-        std::unique_lock<std::mutex> lck(mtx_);
+        return find_plugin(key, &item_key) != nullptr;
+    }
 
-        PluginKey<T> tmp;
-        tmp.key = key;
+    // 消息分发
+    virtual bool message_dispatch(const PluginKey<T> &from, const T &to_key,
+                                  const PluginDataT &request,
+                                  PluginDataT &response) override {
+        PluginKey<T> to;
 
-        auto item = plugins_.find(tmp);
+        auto plugin = find_plugin(to_key, &to);
 
         // 插件未找到
-        if (item == plugins_.end()) {
+        if (!plugin) {
             return false;
         }
 
-        item_key = item->first;
+        // actor插件在邮箱中处理，等待处理完成，插件给自己发消息时直接处理；
+        // 工作线程内等待可能耗尽线程池或与对方互相等待，拒绝，需异步分发
+        if (plugin->actor_batch_ && current_actor() != plugin.get()) {
+            if (thread_pool_->in_worker()) {
+                log(E_LOG_WARN,
+                    "plugin : [name = %s] [version = %s] synchronous "
+                    "dispatch to actor from worker rejected, use "
+                    "message_dispatch_async",
+                    to.name.c_str(), to.version.c_str());
+                return false;
+            }
+
+            std::shared_ptr<PluginCall> call =
+                std::make_shared<PluginCall>(nullptr, 0);
+            PluginKey<T> src = from;
 
-        return true;
-    }
+            post(plugin, [this, call, plugin, src, to, request] {
+                PluginDataT res{};
+                bool ret = dispatch_message(plugin, src, to, request, res);
+                call->complete(ret ? E_PLUGIN_CALL_DONE : E_PLUGIN_CALL_FAILED,
+                               res);
+            }, task_attr(plugin), -1);
 
-    // 消息分发
-    virtual bool message_dispatch(const PluginKey<T> &from, const T &to_key,
-                                  const PluginDataT &request,
-                                  PluginDataT &response) override {
-        std::unique_lock<std::mutex> lck(mtx_);
+            if (E_PLUGIN_CALL_DONE != call->wait()) {
+                return false;
+            }
+
+            response = call->response();
+            return true;
+        }
 
+        return dispatch_message(plugin, from, to, request, response);
+    }
+    // 异步消息分发
+    virtual std::shared_ptr<PluginCall> message_dispatch_async(
+        const PluginKey<T> &from, const T &to_key, const PluginDataT &request,
+        const plugin_call_cb_t &cb = nullptr, uint32_t timeout = 0) override {
+        std::shared_ptr<PluginCall> call =
+            std::make_shared<PluginCall>(cb, timeout);
         PluginKey<T> to;
-        to.key = to_key;
 
-        auto item = plugins_.find(to);
+        auto plugin = find_plugin(to_key, &to);
 
         // 插件未找到
-        if (item == plugins_.end()) {
-            return false;
+        if (!plugin) {
+            call->complete(E_PLUGIN_CALL_FAILED, PluginDataT{});
+            return call;
         }
 
-        // 重新赋值
-        to = item->first;
-        to.key = to_key;
+        // 截止时间到期时由定时器完成超时，不持有调用结果，
+        // 调用先完成时取消定时器
+        if (call->has_deadline()) {
+            std::weak_ptr<PluginCall> weak = call;
+            call->timer_ = timers_.add_at(call->deadline(), 0, [weak] {
+                auto c = weak.lock();
+                if (c) {
+                    c->complete(E_PLUGIN_CALL_TIMEOUT, PluginDataT{});
+                }
+            });
+        }
 
-        auto plugin = item->second;
+        PluginKey<T> src = from;
+        ThreadTaskAttr attr = task_attr(plugin);
 
-        lck.unlock();
+        if (call->has_deadline()) {
+            attr.deadline = call->deadline();
+        }
 
-        const PluginMessage<T> req_msg{from, to, request};
+        thread_task_t task = [this, call, plugin, src, to, request] {
+            // 已取消或超时的调用不再处理
+            if (E_PLUGIN_CALL_PENDING != call->status()) {
+                finish_call(call, E_PLUGIN_CALL_CANCELED);
+                return;
+            }
 
-        PluginMessage<T> res_msg{to, (PluginKey<T>)from, response};
+            if (call->expired()) {
+                finish_call(call, E_PLUGIN_CALL_TIMEOUT);
+                return;
+            }
 
-        // 插件消息处理
-        bool ret = item->second->message(req_msg, res_msg);
+            PluginDataT response{};
+            bool ret = dispatch_message(plugin, src, to, request, response);
 
-        response = res_msg.data;
+            if (call->expired()) {
+                finish_call(call, E_PLUGIN_CALL_TIMEOUT);
+            } else {
+                finish_call(call,
+                            ret ? E_PLUGIN_CALL_DONE : E_PLUGIN_CALL_FAILED,
+                            response);
+            }
+        };
 
-        return ret;
+        // 线程池拒绝时调用失败
+        if (!accepted(post(plugin, std::move(task), attr, policy_wait()))) {
+            finish_call(call, E_PLUGIN_CALL_FAILED);
+        }
+
+        return call;
     }
     // 消息流分发
     virtual bool stream_dispatch(
         std::shared_ptr<IPluginStream<T>> stream) override {
-        std::unique_lock<std::mutex> lck(mtx_);
+        PluginKey<T> to;
 
-        auto item = plugins_.find(stream->to_);
+        auto plugin = find_plugin(stream->to_.key, &to);
 
         // 插件未找到
-        if (item == plugins_.end()) {
+        if (!plugin) {
             return false;
         }
 
         // 重新赋值
-        stream->to_.name = item->first.name;
-        stream->to_.version = item->first.version;
+        stream->to_.name = to.name;
+        stream->to_.version = to.version;
 
-        auto plugin = item->second;
+        // 有对端的流把对端交给目的插件
+        std::shared_ptr<IPluginStream<T>> remote = stream->remote();
 
-        lck.unlock();
+        if (remote) {
+            remote->from_ = stream->to_;
+        } else {
+            remote = stream;
+        }
 
-        // 流式消息添加到线程池任务内去传递
-        thread_pool_->add_task([=] { plugin->stream(stream); });
+        // 流式消息添加到线程池任务内去传递，线程池拒绝时返回false
+        return accepted(post(plugin, [this, plugin, remote] {
+            MicroMetricsTimer timer(true);
+            bool ret = plugin->stream(remote);
+            plugin->metrics_.record_stream(timer, ret);
+
+            // 反应器驱动的插件接受流后由反应器在流就绪时调度，不占用工作线程；
+            // 接受后再读取，延迟加载的插件首次接受流时也能生效
+            if (ret && plugin->plugin_stream_reactor() &&
+                remote->event_fd() >= 0) {
+                watch_stream(plugin, remote);
+            }
+        }, task_attr(plugin), policy_wait()));
+    }
+    // 创建进程内流并分发
+    virtual std::shared_ptr<IPluginStream<T>> stream_open(
+        const PluginKey<T> &from, const T &to_key,
+        size_t capacity = 64) override {
+        PluginKey<T> to;
+        to.key = to_key;
+
+        std::shared_ptr<IPluginStream<T>> stream =
+            MicroPluginStream<T>::create(from, to, capacity);
+
+        if (!stream_dispatch(stream)) {
+            return nullptr;
+        }
+
+        return stream;
+    }
+
+    // 唤醒插件
+    virtual bool plugin_wakeup(const T &key) override {
+        auto plugin = find_plugin(key);
+
+        // 插件未找到
+        if (!plugin) {
+            return false;
+        }
+
+        scheduler_.wakeup(plugin);
 
         return true;
     }
 
+    // 在线程池中执行任务，任务不能丢失，队列满时等待
+    virtual void task_post(const std::function<void(void)> &task) override {
+        thread_pool_->add_task_for(thread_task_t(task), -1, keep_attr());
+    }
+
+    // 到达when后由定时器提交到线程池
+    virtual void task_post_at(std::chrono::steady_clock::time_point when,
+                              const std::function<void(void)> &task) override {
+        timers_.add_at(when, 0, task);
+    }
+
+    // 添加定时器
+    virtual uint64_t timer_add(uint32_t delay, uint32_t period,
+                               const std::function<void(void)> &cb) override {
+        return timers_.add(delay, period, cb);
+    }
+
+    // 取消定时器
+    virtual bool timer_cancel(uint64_t id) override {
+        return timers_.cancel(id);
+    }
+
+    // 由反应器监视描述符
+    virtual uint64_t fd_watch(int fd,
+                              const std::function<void(void)> &cb) override {
+        std::shared_ptr<FdWatch> watch(new FdWatch(cb));
+
+        return reactor_.add(fd, [this, watch](uint64_t) {
+            if (0 == watch->pending.fetch_add(1)) {
+                post_fd(watch);
+            }
+        });
+    }
+
+    // 取消监视
+    virtual void fd_unwatch(uint64_t id) override { reactor_.remove(id); }
+
+    // 重新读取插件调度周期，周期调度的插件加入定时器
+    virtual bool plugin_reschedule(const T &key) override {
+        auto plugin = find_plugin(key);
+
+        // 插件未找到
+        if (!plugin) {
+            return false;
+        }
+
+        if (running_) {
+            scheduler_.add(plugin);
+        }
+
+        return true;
+    }
+
+    // 插件任务提交统计
+    virtual bool plugin_task_stat(const T &key, PluginTaskStat &stat) override {
+        auto plugin = find_plugin(key);
+
+        // 插件未找到
+        if (!plugin) {
+            return false;
+        }
+
+        stat.submitted = plugin->task_submitted_;
+        stat.coalesced = plugin->task_coalesced_;
+        stat.rejected = plugin->task_rejected_;
+        stat.inflight = plugin->task_inflight_;
+
+        return true;
+    }
+
+    // 订阅主题
+    virtual bool subscribe(const T &key, uint32_t topic) override {
+        // 主题表写锁在读保护之外获取
+        auto plugin = find_plugin(key);
+
+        // 插件未找到
+        if (!plugin) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lck(topic_mtx_);
+
+        // 查找后插件可能已注销，注销在发布插件表后才清理主题表
+        if (find_plugin(key) != plugin) {
+            return false;
+        }
+
+        const topic_map *topics = topics_.load();
+        auto subs = topics->find(topic);
+        plugin_list *new_subs = new plugin_list();
+
+        if (subs != topics->end()) {
+            // 已订阅
+            if (std::find(subs->second->begin(), subs->second->end(),
+                          plugin) != subs->second->end()) {
+                delete new_subs;
+                return true;
+            }
+            *new_subs = *subs->second;
+        }
+
+        new_subs->push_back(plugin);
+        update_topic(topic, new_subs);
+
+        return true;
+    }
+
+    // 取消订阅
+    virtual bool unsubscribe(const T &key, uint32_t topic) override {
+        std::unique_lock<std::mutex> lck(topic_mtx_);
+
+        const topic_map *topics = topics_.load();
+        auto subs = topics->find(topic);
+
+        // 主题没有订阅者
+        if (subs == topics->end()) {
+            return false;
+        }
+
+        plugin_list *new_subs = new plugin_list();
+
+        for (auto &plugin : *subs->second) {
+            if (!(plugin->plugin_key_.key == key)) {
+                new_subs->push_back(plugin);
+            }
+        }
+
+        // 插件未订阅该主题
+        if (new_subs->size() == subs->second->size()) {
+            delete new_subs;
+            return false;
+        }
+
+        update_topic(topic, new_subs);
+
+        return true;
+    }
+
+    // 发布消息，查找一次主题，订阅者按批提交到线程池
+    virtual int publish(uint32_t topic, const PluginDataT &msg) override {
+        std::shared_ptr<const plugin_list> subs;
+
+        {
+            MicroRcuReadGuard guard;
+            const topic_map *topics = topics_.load();
+            auto item = topics->find(topic);
+
+            // 主题没有订阅者
+            if (item == topics->end()) {
+                return 0;
+            }
+
+            subs = item->second;
+        }
+
+        // 所有订阅者共享一份数据，外部数据复制到缓冲区中
+        std::shared_ptr<PluginDataT> data = std::make_shared<PluginDataT>(msg);
+
+        if (msg.data && msg.len > 0 && msg.data != msg.buf.data()) {
+            PluginBuffer buffer = buffer_alloc(msg.len);
+            memcpy(buffer.data(), msg.data, msg.len);
+            data->set_buffer(buffer, msg.len);
+        }
+
+        size_t cnt = subs->size();
+
+        int64_t wait = policy_wait();
+        size_t posted = 0;
+
+        for (size_t begin = 0; begin < cnt; begin += kNoticeBatch) {
+            size_t end = std::min(cnt, begin + kNoticeBatch);
+
+            thread_task_t task = [this, subs, data, begin, end] {
+                for (size_t i = begin; i < end; i++) {
+                    const plugin_ptr &plugin = (*subs)[i];
+
+                    if (E_PLUGIN_RUNING != plugin->plugin_status()) {
+                        continue;
+                    }
+
+                    // actor插件的通知投递到邮箱
+                    if (plugin->actor_batch_) {
+                        notice_inflight_++;
+                        post(plugin, [this, plugin, data] {
+                            plugin->notice(*data);
+                            plugin->metrics_.record_notice();
+                            notice_done();
+                        }, task_attr(plugin), -1);
+                        continue;
+                    }
+
+                    plugin->notice(*data);
+                    plugin->metrics_.record_notice();
+                }
+                notice_done();
+            };
+
+            notice_inflight_++;
+
+            // 线程池拒绝的一批订阅者收不到本次通知
+            if (!accepted(thread_pool_->add_task_for(std::move(task), wait,
+                                                     keep_attr()))) {
+                notice_done();
+                continue;
+            }
+
+            posted += end - begin;
+        }
+
+        return (int)posted;
+    }
+
+    // 插件运行指标快照
+    virtual bool plugin_metrics(const T &key,
+                                PluginMetricsStat &stat) override {
+        auto plugin = find_plugin(key);
+
+        // 插件未找到
+        if (!plugin) {
+            return false;
+        }
+
+        plugin->metrics_.stat(stat);
+
+        return true;
+    }
+
+    // 线程池运行统计
+    virtual bool thread_pool_stat(ThreadPoolStat &stat) override {
+        return thread_pool_->stat(stat);
+    }
+
+    // 导出指标，没有任何记录的插件不导出
+    virtual std::string metrics_dump(bool json = false) override {
+        plugin_list plugins;
+        std::string out;
+        ThreadPoolStat pool;
+        char buf[256];
+
+        {
+            MicroRcuReadGuard guard;
+            for (auto &plugin : *plugins_.load()) {
+                plugins.push_back(plugin.second);
+            }
+        }
+
+        out = json ? "{\"thread_pool\": " : "";
+
+        if (thread_pool_->stat(pool)) {
+            snprintf(buf, sizeof(buf),
+                     json ? "{\"threads\": %u, \"queued\": %lu, "
+                            "\"executed\": %lu, \"busy_ns\": %lu, "
+                            "\"uptime_ns\": %lu, \"utilization\": %.4f"
+                          : "thread_pool threads=%u queued=%lu executed=%lu "
+                            "busy_ns=%lu uptime_ns=%lu utilization=%.4f",
+                     pool.threads, (unsigned long)pool.queued,
+                     (unsigned long)pool.executed, (unsigned long)pool.busy_ns,
+                     (unsigned long)pool.uptime_ns, pool.utilization);
+            out += buf;
+
+            // 自适应大小的线程数上下限和增减次数
+            snprintf(buf, sizeof(buf),
+                     json ? ", \"min_threads\": %u, \"max_threads\": %u, "
+                            "\"grown\": %lu, \"shrunk\": %lu"
+                          : " min_threads=%u max_threads=%u grown=%lu "
+                            "shrunk=%lu",
+                     pool.min_threads, pool.max_threads,
+                     (unsigned long)pool.grown, (unsigned long)pool.shrunk);
+            out += buf;
+
+            // 队列满时被拒绝、丢弃和在调用线程执行的任务数
+            snprintf(buf, sizeof(buf),
+                     json ? ", \"rejected\": %lu, \"shed\": %lu, "
+                            "\"caller_runs\": %lu"
+                          : " rejected=%lu shed=%lu caller_runs=%lu",
+                     (unsigned long)pool.rejected, (unsigned long)pool.shed,
+                     (unsigned long)pool.caller_runs);
+            out += buf;
+
+            // 各优先级类别的排队数和错过截止时间数
+            snprintf(buf, sizeof(buf),
+                     json ? ", \"class_queued\": [%lu, %lu, %lu], "
+                            "\"class_missed\": [%lu, %lu, %lu]}"
+                          : " class_queued=%lu/%lu/%lu "
+                            "class_missed=%lu/%lu/%lu\n",
+                     (unsigned long)pool.class_queued[E_TASK_PRIO_HIGH],
+                     (unsigned long)pool.class_queued[E_TASK_PRIO_NORMAL],
+                     (unsigned long)pool.class_queued[E_TASK_PRIO_LOW],
+                     (unsigned long)pool.class_missed[E_TASK_PRIO_HIGH],
+                     (unsigned long)pool.class_missed[E_TASK_PRIO_NORMAL],
+                     (unsigned long)pool.class_missed[E_TASK_PRIO_LOW]);
+            out += buf;
+        } else if (json) {
+            out += "null";
+        }
+
+        if (json) {
+            out += ", \"plugins\": [";
+        }
+
+        bool first = true;
+
+        for (auto &plugin : plugins) {
+            PluginMetricsStat stat;
+            plugin->metrics_.stat(stat);
+
+            if (!stat.task.count && !stat.message.count &&
+                !stat.stream.count && !stat.notices) {
+                continue;
+            }
+
+            if (json) {
+                out += first ? "" : ", ";
+                out += "{\"name\": \"" + plugin->plugin_key_.name +
+                       "\", \"version\": \"" + plugin->plugin_key_.version +
+                       "\"";
+            } else {
+                out += "plugin " + plugin->plugin_key_.name + " " +
+                       plugin->plugin_key_.version;
+            }
+
+            dump_histogram(out, "task", stat.task, json);
+            dump_histogram(out, "message", stat.message, json);
+            dump_histogram(out, "stream", stat.stream, json);
+
+            snprintf(buf, sizeof(buf),
+                     json ? ", \"notices\": %lu, \"init_ns\": %lu, "
+                            "\"start_ns\": %lu, \"stop_ns\": %lu}"
+                          : " notices=%lu init_ns=%lu start_ns=%lu "
+                            "stop_ns=%lu\n",
+                     (unsigned long)stat.notices, (unsigned long)stat.init_ns,
+                     (unsigned long)stat.start_ns,
+                     (unsigned long)stat.stop_ns);
+            out += buf;
+            first = false;
+        }
+
+        if (json) {
+            out += "]}\n";
+        }
+
+        return out;
+    }
+
+    // 分配引用计数缓冲区
+    virtual PluginBuffer buffer_alloc(size_t size) override {
+        return MicroBufferPool::instance().alloc(size);
+    }
+
+    // 缓冲区池统计
+    virtual void buffer_stat(std::vector<PluginBufferStat> &stat) override {
+        MicroBufferPool::instance().stat(stat);
+    }
+
     // 日志
     virtual void log(const std::string &message) override {
-        // TODO
+        MicroLogger::instance().write(E_LOG_INFO, "%s", message.c_str());
+    }
+
+    // 格式化日志
+    virtual void log(micro_log_level level, const char *fmt, ...) override
+        __attribute__((format(printf, 3, 4))) {
+        va_list ap;
+
+        va_start(ap, fmt);
+        MicroLogger::instance().vwrite(level, fmt, ap);
+        va_end(ap);
     }
 
 private:
-    std::mutex mtx_;       ///< 操作锁，TODO:替换为读写锁
-    std::string version_;  ///< 微内核版本
-    uint32_t limit_;       ///< 插件数量限制
-    std::map<PluginKey<T>, std::shared_ptr<IPlugin<T>>> plugins_;  ///< 插件列表
+    std::mutex mtx_;        ///< 写操作锁，分发等读路径通过插件表快照无锁访问
+    std::mutex topic_mtx_;  ///< 主题表写锁，插件启动时可订阅，在mtx_之后加锁
+    std::string version_;   ///< 微内核版本
+    uint32_t limit_;        ///< 插件数量限制
+    MicroRcuPtr<const plugin_map> plugins_;        ///< 插件表快照
+    MicroRcuPtr<const topic_map> topics_;          ///< 主题订阅表快照
+    std::atomic<uint32_t> notice_inflight_;        ///< 排队或执行中的通知任务数
     std::shared_ptr<IThreadPool> thread_pool_;     ///< 线程池
+    MicroKernelScheduler<T> scheduler_;            ///< 插件任务调度器
+    MicroTimerWheel timers_;                       ///< 定时器
     std::condition_variable micro_kernel_exited_;  ///< 微内核退出条件变量
+    std::mutex drain_mtx_;                         ///< 等待插件停止的锁
+    std::condition_variable drain_cond_;           ///< 插件任务、邮件和通知执行完
     std::atomic_bool running_;                     ///< 微内核运行状态
     bool exit_;                                    ///< 微内核退出标记
+    MicroReactor reactor_;                         ///< 反应器驱动的流
 };
 
 }
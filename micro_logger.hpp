@@ -0,0 +1,403 @@
+/**
+ * @file micro_logger.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 微内核异步日志
+ * @date 2021-01-26
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "micro_metrics.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 日志级别
+ *
+ */
+typedef enum {
+    E_LOG_DEBUG = 0,  ///< 调试
+    E_LOG_INFO = 1,   ///< 信息
+    E_LOG_WARN = 2,   ///< 警告
+    E_LOG_ERROR = 3,  ///< 错误
+    E_LOG_OFF = 4,    ///< 关闭
+} micro_log_level;
+
+/**
+ * @brief 异步日志
+ * @details 每个线程有自己的单生产者单消费者记录环，写日志只格式化到环中，
+ * 不加锁也没有系统调用，环满时丢弃并计数；后台线程定期收集所有环中的记录，
+ * 加上时间和级别后用writev成批写出，时间戳记录时只读TSC，写出时再换算
+ *
+ */
+class MicroLogger {
+public:
+    static const size_t kRecordSize = 256;  ///< 每条记录的最大长度(含记录头)
+    static const size_t kRingSize = 512;    ///< 每个线程环的记录数，2的幂
+    static const uint32_t kFlushMs = 10;    ///< 后台写出间隔(ms)
+
+    // 进程唯一的日志，不释放，后台线程在首次写日志时启动，进程退出时写出剩余记录
+    static MicroLogger &instance(void) {
+        static MicroLogger *logger = new MicroLogger();
+        return *logger;
+    }
+
+    // 日志级别，低于该级别的日志直接丢弃
+    void set_level(micro_log_level level) { level_ = level; }
+    micro_log_level level(void) const { return level_; }
+
+    // 是否输出该级别
+    bool enabled(micro_log_level level) const {
+        return level >= level_.load(std::memory_order_relaxed);
+    }
+
+    // 输出到文件，追加写入，失败时保持原输出
+    bool open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lck(flush_mutex_);
+
+        drain();
+        if (fd_ > STDERR_FILENO) {
+            ::close(fd_);
+        }
+        fd_ = fd;
+
+        return true;
+    }
+
+    // 写日志
+    void write(micro_log_level level, const char *fmt, ...)
+        __attribute__((format(printf, 3, 4))) {
+        va_list ap;
+
+        va_start(ap, fmt);
+        vwrite(level, fmt, ap);
+        va_end(ap);
+    }
+
+    // 写日志，va_list版本
+    void vwrite(micro_log_level level, const char *fmt, va_list ap) {
+        if (!enabled(level)) {
+            return;
+        }
+
+        Ring *ring = local();
+
+        // 线程退出过程中没有本地环
+        if (!ring) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        size_t tail = ring->tail.load(std::memory_order_relaxed);
+
+        if (tail - ring->head.load(std::memory_order_acquire) >= kRingSize) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Record &rec = ring->records[tail & (kRingSize - 1)];
+        int len = vsnprintf(rec.text, sizeof(rec.text), fmt, ap);
+
+        rec.ticks = MicroMetricsClock::now();
+        rec.level = level;
+        rec.len = len < 0 ? 0 : std::min<uint32_t>(len, sizeof(rec.text) - 1);
+
+        ring->tail.store(tail + 1, std::memory_order_release);
+        start();
+    }
+
+    // 写出所有线程已记录的日志，用于退出前或需要立即落盘时
+    void flush(void) {
+        std::lock_guard<std::mutex> lck(flush_mutex_);
+        drain();
+    }
+
+    // 累计丢弃的记录数
+    uint64_t dropped(void) {
+        uint64_t n = dropped_.load(std::memory_order_relaxed);
+
+        for (Ring *r = head_.load(); r; r = r->next) {
+            n += r->dropped.load(std::memory_order_relaxed);
+        }
+
+        return n;
+    }
+
+private:
+    /**
+     * @brief 一条日志记录
+     *
+     */
+    struct Record {
+        uint64_t ticks;               ///< 记录时的TSC计数
+        uint32_t level;               ///< 级别
+        uint32_t len;                 ///< 正文长度
+        char text[kRecordSize - 16];  ///< 正文
+    };
+
+    /**
+     * @brief 线程的记录环，线程退出后留给新线程复用，已记录的内容仍会写出
+     *
+     */
+    struct Ring {
+        Ring() : head(0), tail(0), dropped(0), used(true), next(nullptr) {}
+
+        Record records[kRingSize];      ///< 记录
+        std::atomic<size_t> head;       ///< 后台线程读位置
+        char pad[56];                   ///< 缓存行填充
+        std::atomic<size_t> tail;       ///< 写线程写位置
+        std::atomic<uint64_t> dropped;  ///< 环满丢弃数
+        std::atomic_bool used;          ///< 是否被线程占用
+        Ring *next;                     ///< 下一个环
+    };
+
+    /**
+     * @brief 线程局部的记录环，线程退出时归还
+     *
+     */
+    struct Local {
+        Local() : ring(instance().acquire()) {}
+        ~Local() {
+            ring->used.store(false, std::memory_order_release);
+            local_dead() = true;
+        }
+
+        Ring *ring;  ///< 记录环
+    };
+
+    MicroLogger()
+        : level_(E_LOG_INFO),
+          fd_(STDERR_FILENO),
+          head_(nullptr),
+          dropped_(0),
+          reported_(0),
+          started_(false),
+          wall_base_(wall_ns()),
+          tick_base_(MicroMetricsClock::now()),
+          ns_per_tick_(0),
+          cached_sec_(0) {
+        cached_time_[0] = '\0';
+    }
+
+    static uint64_t wall_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // 线程局部环已析构的标记，平凡析构，析构后仍可访问
+    static bool &local_dead(void) {
+        static thread_local bool dead = false;
+        return dead;
+    }
+
+    static Ring *local(void) {
+        if (local_dead()) {
+            return nullptr;
+        }
+
+        static thread_local Local l;
+        return l.ring;
+    }
+
+    // 占用一个记录环，优先复用已退出线程的环
+    Ring *acquire(void) {
+        for (Ring *r = head_.load(); r; r = r->next) {
+            bool used = false;
+            if (!r->used && r->used.compare_exchange_strong(used, true)) {
+                return r;
+            }
+        }
+
+        Ring *r = new Ring();
+        Ring *head = head_.load();
+
+        do {
+            r->next = head;
+        } while (!head_.compare_exchange_weak(head, r));
+
+        return r;
+    }
+
+    // 首次写日志时启动后台线程
+    void start(void) {
+        if (started_.load(std::memory_order_relaxed) ||
+            started_.exchange(true)) {
+            return;
+        }
+
+        std::thread([this] { flush_loop(); }).detach();
+        atexit([] { MicroLogger::instance().flush(); });
+    }
+
+    void flush_loop(void) {
+        uint32_t ms = kFlushMs;
+        const std::chrono::milliseconds period(ms);
+
+        for (;;) {
+            std::this_thread::sleep_for(period);
+            flush();
+        }
+    }
+
+    // TSC计数换算为墙上时间，需持有flush_mutex_
+    uint64_t to_wall_ns(uint64_t ticks) {
+        if (!ns_per_tick_) {
+            ns_per_tick_ = MicroMetricsClock::ns_per_tick();
+        }
+
+        return wall_base_ +
+               (int64_t)((int64_t)(ticks - tick_base_) * ns_per_tick_);
+    }
+
+    // 格式化记录前缀，秒级时间字符串缓存复用，返回前缀长度
+    size_t prefix(const Record &rec, char *buf, size_t size) {
+        static const char *names[] = {"DEBUG", "INFO", "WARN", "ERROR", "OFF"};
+        uint64_t ns = to_wall_ns(rec.ticks);
+        time_t sec = (time_t)(ns / 1000000000);
+
+        if (sec != cached_sec_) {
+            struct tm tm;
+            localtime_r(&sec, &tm);
+            strftime(cached_time_, sizeof(cached_time_), "%Y-%m-%d %H:%M:%S",
+                     &tm);
+            cached_sec_ = sec;
+        }
+
+        int n = snprintf(buf, size, "%s.%06u [%s] ", cached_time_,
+                         (unsigned)(ns % 1000000000 / 1000),
+                         names[rec.level < 5 ? rec.level : 4]);
+
+        return n < 0 ? 0 : std::min<size_t>(n, size - 1);
+    }
+
+    // 写出所有环中的记录，需持有flush_mutex_
+    void drain(void) {
+        struct iovec iov[kIovMax];
+        char prefixes[kIovMax / 3][kPrefixSize];
+        char newline = '\n';
+        int cnt = 0;
+        int recs = 0;
+
+        for (Ring *r = head_.load(); r; r = r->next) {
+            size_t head = r->head.load(std::memory_order_relaxed);
+            size_t tail = r->tail.load(std::memory_order_acquire);
+
+            while (head != tail) {
+                // 写出前不能归还记录，批满时先写出
+                if (recs == kIovMax / 3) {
+                    writev_all(iov, cnt);
+                    cnt = 0;
+                    recs = 0;
+                    r->head.store(head, std::memory_order_release);
+                }
+
+                Record &rec = r->records[head & (kRingSize - 1)];
+
+                iov[cnt].iov_base = prefixes[recs];
+                iov[cnt++].iov_len = prefix(rec, prefixes[recs], kPrefixSize);
+                iov[cnt].iov_base = rec.text;
+                iov[cnt++].iov_len = rec.len;
+                iov[cnt].iov_base = &newline;
+                iov[cnt++].iov_len = 1;
+                recs++;
+                head++;
+            }
+
+            if (cnt) {
+                writev_all(iov, cnt);
+                cnt = 0;
+                recs = 0;
+            }
+
+            r->head.store(head, std::memory_order_release);
+        }
+
+        report_dropped();
+    }
+
+    // 报告新增的丢弃数
+    void report_dropped(void) {
+        uint64_t n = dropped();
+
+        if (n == reported_) {
+            return;
+        }
+
+        char buf[128];
+        int len = snprintf(buf, sizeof(buf),
+                           "[WARN] micro logger dropped %lu records\n",
+                           (unsigned long)(n - reported_));
+
+        if (len > 0 && ::write(fd_, buf, len) < 0) {
+            return;
+        }
+
+        reported_ = n;
+    }
+
+    void writev_all(struct iovec *iov, int cnt) {
+        while (cnt > 0) {
+            ssize_t n = ::writev(fd_, iov, cnt);
+
+            if (n < 0) {
+                return;
+            }
+
+            // 部分写入时跳过已写出的部分
+            while (cnt > 0 && (size_t)n >= iov->iov_len) {
+                n -= iov->iov_len;
+                iov++;
+                cnt--;
+            }
+
+            if (cnt > 0) {
+                iov->iov_base = (char *)iov->iov_base + n;
+                iov->iov_len -= n;
+            }
+        }
+    }
+
+private:
+    static const int kIovMax = IOV_MAX / 3 * 3;  ///< 单次writev的向量数
+    static const size_t kPrefixSize = 48;  ///< 前缀最大长度
+
+    std::atomic<micro_log_level> level_;  ///< 日志级别
+    int fd_;                              ///< 输出文件
+    std::atomic<Ring *> head_;            ///< 记录环链表
+    std::atomic<uint64_t> dropped_;       ///< 线程退出过程中丢弃的记录数
+    uint64_t reported_;                   ///< 已报告的丢弃数
+    std::atomic_bool started_;            ///< 后台线程已启动
+    std::mutex flush_mutex_;              ///< 写出锁
+    uint64_t wall_base_;                  ///< 校准起点的墙上时间
+    uint64_t tick_base_;                  ///< 校准起点的TSC计数
+    double ns_per_tick_;                  ///< 每个计数对应的ns
+    time_t cached_sec_;                   ///< 缓存的秒
+    char cached_time_[32];                ///< 缓存的秒级时间字符串
+};
+
+}
@@ -0,0 +1,87 @@
+/**
+ * @file micro_mailbox.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 多生产者单消费者无锁邮箱
+ * @date 2021-01-30
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace Asty {
+
+/**
+ * @brief 多生产者单消费者无锁邮箱(Vyukov)
+ * @details 生产者只做一次原子交换和一次链接写入，消费者沿链表取出，
+ * 不需要加锁；生产者在交换和链接之间被打断时，消费者暂时看不到其后的内容，
+ * 由投递方在链接完成后负责再次激活消费者
+ *
+ * @tparam T 邮件类型
+ */
+template <typename T>
+class MicroMailbox {
+public:
+    MicroMailbox() : head_(new Node()), tail_(head_.load()) {}
+
+    ~MicroMailbox() {
+        T item;
+
+        while (pop(item)) {
+        }
+
+        delete tail_;
+    }
+
+    MicroMailbox(const MicroMailbox &) = delete;
+    MicroMailbox &operator=(const MicroMailbox &) = delete;
+
+    // 投递，任意线程调用
+    void push(T &&item) {
+        Node *node = new Node(std::move(item));
+        Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // 取出，只允许一个消费者调用
+    bool pop(T &item) {
+        Node *next = tail_->next.load(std::memory_order_acquire);
+
+        if (!next) {
+            return false;
+        }
+
+        item = std::move(next->item);
+        delete tail_;
+        tail_ = next;
+
+        return true;
+    }
+
+    // 是否没有已链接的邮件，只允许消费者调用
+    bool empty(void) const { return !tail_->next.load(); }
+
+private:
+    /**
+     * @brief 邮件节点
+     *
+     */
+    struct Node {
+        Node() : next(nullptr) {}
+        explicit Node(T &&i) : next(nullptr), item(std::move(i)) {}
+
+        std::atomic<Node *> next;  ///< 下一个节点
+        T item;                    ///< 邮件
+    };
+
+private:
+    std::atomic<Node *> head_;  ///< 最后投递的节点，生产者竞争
+    char pad_[64];              ///< 缓存行填充
+    Node *tail_;                ///< 已取出的最后一个节点，消费者独占
+};
+
+}
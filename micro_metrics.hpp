@@ -0,0 +1,511 @@
+/**
+ * @file micro_metrics.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 微内核运行指标：按线程分片的对数分桶延迟直方图
+ * @date 2021-01-25
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "thread_pool.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace Asty {
+
+/**
+ * @brief 指标计时时钟
+ * @details x86上读取TSC，记录时只有一条指令，读数时与稳定时钟对比校准后
+ * 换算为ns，其他平台直接使用稳定时钟
+ *
+ */
+class MicroMetricsClock {
+public:
+    // 当前计数
+    static uint64_t now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return steady_ns();
+#endif
+    }
+
+    // 每个计数对应的ns，首次调用需要约10ms校准
+    static double ns_per_tick(void) {
+#if defined(__x86_64__) || defined(__i386__)
+        const Base &b = base();
+        uint64_t ns = steady_ns();
+
+        if (ns - b.ns < kCalibrateNs) {
+            std::this_thread::sleep_for(
+                std::chrono::nanoseconds(kCalibrateNs - (ns - b.ns)));
+            ns = steady_ns();
+        }
+
+        uint64_t ticks = now();
+
+        return ticks > b.ticks ? (double)(ns - b.ns) / (ticks - b.ticks) : 1.0;
+#else
+        return 1.0;
+#endif
+    }
+
+private:
+    static uint64_t steady_ns(void) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /**
+     * @brief 校准起点
+     *
+     */
+    struct Base {
+        Base() : ticks(now()), ns(steady_ns()) {}
+
+        uint64_t ticks;  ///< 起点计数
+        uint64_t ns;     ///< 起点时间
+    };
+
+    static const Base &base(void) {
+        static Base b;
+        return b;
+    }
+
+private:
+    static const uint64_t kCalibrateNs = 10000000;  ///< 最短校准间隔
+};
+
+/**
+ * @brief 线程所在的指标分片
+ *
+ */
+class MicroMetricsShard {
+public:
+    static const uint32_t kShards = 8;  ///< 分片数
+
+    static uint32_t index(void) {
+        static std::atomic<uint32_t> seq(0);
+        static thread_local uint32_t idx = seq++ % kShards;
+        return idx;
+    }
+};
+
+/**
+ * @brief 耗时采样计时器
+ * @details 每个线程每kSampleRate次只计时一次，调用次数仍然全部统计，
+ * 使热路径上的开销只剩一次原子加
+ *
+ */
+class MicroMetricsTimer {
+public:
+    static const uint32_t kSampleRate = 16;  ///< 采样间隔
+
+    // always为true时每次都计时，用于执行时间较长的调用
+    explicit MicroMetricsTimer(bool always = false)
+        : begin_(always || sample() ? MicroMetricsClock::now() : 0) {}
+
+    // 本次是否计时
+    bool timed(void) const { return begin_ != 0; }
+
+    // 开始以来的计数
+    uint64_t elapsed(void) const { return MicroMetricsClock::now() - begin_; }
+
+private:
+    static bool sample(void) {
+        static thread_local uint32_t cnt = 0;
+        return 0 == cnt++ % kSampleRate;
+    }
+
+private:
+    uint64_t begin_;  ///< 开始计数，0表示不计时
+};
+
+/**
+ * @brief 延迟直方图统计，时间单位为ns
+ *
+ */
+struct MicroHistogramStat {
+    uint64_t count;   ///< 调用次数
+    uint64_t failed;  ///< 失败次数
+    uint64_t sum;     ///< 总耗时，由采样按调用次数折算
+    uint64_t max;     ///< 最大耗时
+    uint64_t p50;     ///< 50分位耗时
+    uint64_t p90;     ///< 90分位耗时
+    uint64_t p99;     ///< 99分位耗时
+    uint64_t p999;    ///< 99.9分位耗时
+};
+
+/**
+ * @brief 对数分桶直方图
+ * @details 每个2的幂区间再等分为4个子桶，相对误差不超过25%，
+ * 调用次数每次统计，耗时只统计采样，读数时合并
+ *
+ */
+class MicroHistogram {
+public:
+    static const uint32_t kSubBits = 2;           ///< 子桶位数
+    static const uint32_t kMaxBits = 40;          ///< 可记录的最大位数
+    static const uint32_t kSub = 1u << kSubBits;  ///< 每个区间的子桶数
+    static const uint32_t kBuckets =
+        (kMaxBits - kSubBits + 1) * kSub;  ///< 桶数
+
+    MicroHistogram() : count_(0), failed_(0), sampled_(0), sum_(0), max_(0) {
+        for (auto &bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // 记录一次调用
+    void record(const MicroMetricsTimer &timer, bool ok) {
+        count_.fetch_add(1, std::memory_order_relaxed);
+
+        if (!ok) {
+            failed_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (timer.timed()) {
+            sample(timer.elapsed());
+        }
+    }
+
+    // 记录一次耗时采样
+    void sample(uint64_t value) {
+        sampled_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        buckets_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+
+        // 最大值很少更新，先读再写
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max &&
+               !max_.compare_exchange_weak(max, value,
+                                           std::memory_order_relaxed)) {
+        }
+    }
+
+    // 累加到out中
+    void merge_to(MicroHistogram &out) const {
+        out.count_ += count_.load(std::memory_order_relaxed);
+        out.failed_ += failed_.load(std::memory_order_relaxed);
+        out.sampled_ += sampled_.load(std::memory_order_relaxed);
+        out.sum_ += sum_.load(std::memory_order_relaxed);
+
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        if (max > out.max_) {
+            out.max_ = max;
+        }
+
+        for (uint32_t i = 0; i < kBuckets; i++) {
+            out.buckets_[i] += buckets_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    // 统计结果，scale为每个记录单位对应的ns
+    void stat(MicroHistogramStat &stat, double scale = 1.0) const {
+        stat.count = count_;
+        stat.failed = failed_;
+        stat.sum = sampled_ ? (uint64_t)((double)sum_ * count_ / sampled_ * scale)
+                            : 0;
+        stat.max = (uint64_t)(max_ * scale);
+        stat.p50 = (uint64_t)(percentile(0.5) * scale);
+        stat.p90 = (uint64_t)(percentile(0.9) * scale);
+        stat.p99 = (uint64_t)(percentile(0.99) * scale);
+        stat.p999 = (uint64_t)(percentile(0.999) * scale);
+    }
+
+    // 数值所在的桶
+    static uint32_t bucket(uint64_t value) {
+        if (value >> kMaxBits) {
+            value = (1ull << kMaxBits) - 1;
+        }
+
+        if (value < kSub) {
+            return (uint32_t)value;
+        }
+
+        uint32_t msb = 63 - __builtin_clzll(value);
+
+        return (msb - kSubBits + 1) * kSub +
+               (uint32_t)((value >> (msb - kSubBits)) & (kSub - 1));
+    }
+
+    // 桶的上界
+    static uint64_t bucket_upper(uint32_t idx) {
+        uint32_t group = idx / kSub;
+        uint64_t sub = idx % kSub;
+
+        if (!group) {
+            return sub;
+        }
+
+        uint32_t shift = group - 1;
+        return ((kSub + sub + 1) << shift) - 1;
+    }
+
+private:
+    // 分位数，返回所在桶的上界，不超过最大值
+    uint64_t percentile(double p) const {
+        uint64_t count = sampled_;
+        uint64_t rank = (uint64_t)(p * count);
+        uint64_t seen = 0;
+
+        if (!count) {
+            return 0;
+        }
+
+        if (rank >= count) {
+            rank = count - 1;
+        }
+
+        for (uint32_t i = 0; i < kBuckets; i++) {
+            seen += buckets_[i];
+
+            if (seen > rank) {
+                uint64_t upper = bucket_upper(i);
+                return upper < max_ ? upper : (uint64_t)max_;
+            }
+        }
+
+        return max_;
+    }
+
+private:
+    std::atomic<uint64_t> count_;              ///< 次数
+    std::atomic<uint64_t> failed_;             ///< 失败次数
+    std::atomic<uint64_t> sampled_;            ///< 耗时采样次数
+    std::atomic<uint64_t> sum_;                ///< 总和
+    std::atomic<uint64_t> max_;                ///< 最大值
+    std::atomic<uint64_t> buckets_[kBuckets];  ///< 各桶次数
+};
+
+/**
+ * @brief 插件运行指标统计
+ *
+ */
+struct PluginMetricsStat {
+    MicroHistogramStat task;     ///< plugin_task耗时
+    MicroHistogramStat message;  ///< message处理耗时
+    MicroHistogramStat stream;   ///< stream会话耗时
+    uint64_t notices;            ///< notice通知次数
+    uint64_t init_ns;            ///< plugin_init耗时
+    uint64_t start_ns;           ///< plugin_start耗时
+    uint64_t stop_ns;            ///< plugin_stop和plugin_exit耗时
+};
+
+/**
+ * @brief 按线程分片的直方图
+ * @details 分片在线程首次记录时分配，未使用时只占用分片指针的空间
+ *
+ */
+class MicroShardedHistogram {
+public:
+    MicroShardedHistogram() {
+        for (auto &shard : shards_) {
+            shard.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~MicroShardedHistogram() {
+        for (auto &shard : shards_) {
+            delete shard.load();
+        }
+    }
+
+    MicroShardedHistogram(const MicroShardedHistogram &) = delete;
+    MicroShardedHistogram &operator=(const MicroShardedHistogram &) = delete;
+
+    // 记录到当前线程的分片
+    void record(const MicroMetricsTimer &timer, bool ok) {
+        shard().record(timer, ok);
+    }
+
+    // 合并各分片
+    void stat(MicroHistogramStat &stat, double scale) const {
+        MicroHistogram sum;
+
+        for (auto &item : shards_) {
+            MicroHistogram *shard = item.load(std::memory_order_acquire);
+
+            if (shard) {
+                shard->merge_to(sum);
+            }
+        }
+
+        sum.stat(stat, scale);
+    }
+
+private:
+    MicroHistogram &shard(void) {
+        std::atomic<MicroHistogram *> &item =
+            shards_[MicroMetricsShard::index()];
+        MicroHistogram *shard = item.load(std::memory_order_acquire);
+
+        if (shard) {
+            return *shard;
+        }
+
+        MicroHistogram *created = new MicroHistogram();
+
+        if (item.compare_exchange_strong(shard, created,
+                                         std::memory_order_acq_rel)) {
+            return *created;
+        }
+
+        delete created;
+        return *shard;
+    }
+
+private:
+    std::atomic<MicroHistogram *> shards_[MicroMetricsShard::kShards];  ///< 分片
+};
+
+/**
+ * @brief 插件运行指标
+ *
+ */
+class PluginMetrics {
+public:
+    PluginMetrics() : notices_(0), init_ns_(0), start_ns_(0), stop_ns_(0) {}
+
+    // 记录plugin_task
+    void record_task(const MicroMetricsTimer &timer, bool ok) {
+        task_.record(timer, ok);
+    }
+
+    // 记录message处理
+    void record_message(const MicroMetricsTimer &timer, bool ok) {
+        message_.record(timer, ok);
+    }
+
+    // 记录stream会话
+    void record_stream(const MicroMetricsTimer &timer, bool ok) {
+        stream_.record(timer, ok);
+    }
+
+    // 记录notice通知
+    void record_notice(void) {
+        notices_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 记录生命周期接口耗时(ns)
+    void record_init(uint64_t ns) { init_ns_ = ns; }
+    void record_start(uint64_t ns) { start_ns_ = ns; }
+    void record_stop(uint64_t ns) { stop_ns_ = ns; }
+
+    // 指标快照
+    void stat(PluginMetricsStat &stat) const {
+        double scale = MicroMetricsClock::ns_per_tick();
+
+        task_.stat(stat.task, scale);
+        message_.stat(stat.message, scale);
+        stream_.stat(stat.stream, scale);
+        stat.notices = notices_.load(std::memory_order_relaxed);
+        stat.init_ns = init_ns_;
+        stat.start_ns = start_ns_;
+        stat.stop_ns = stop_ns_;
+    }
+
+private:
+    MicroShardedHistogram task_;      ///< plugin_task耗时
+    MicroShardedHistogram message_;   ///< message处理耗时
+    MicroShardedHistogram stream_;    ///< stream会话耗时
+    std::atomic<uint64_t> notices_;   ///< notice通知次数
+    std::atomic<uint64_t> init_ns_;   ///< plugin_init耗时
+    std::atomic<uint64_t> start_ns_;  ///< plugin_start耗时
+    std::atomic<uint64_t> stop_ns_;   ///< plugin_stop和plugin_exit耗时
+};
+
+/**
+ * @brief 线程池运行指标，按线程分片记录任务数和采样的执行时间
+ *
+ */
+class MicroPoolMetrics {
+public:
+    MicroPoolMetrics() : start_(MicroMetricsClock::now()) {}
+
+    // 记录一个任务
+    void record(const MicroMetricsTimer &timer) {
+        Counter &counter = counters_[MicroMetricsShard::index()];
+
+        counter.executed.fetch_add(1, std::memory_order_relaxed);
+
+        if (timer.timed()) {
+            counter.timed.fetch_add(1, std::memory_order_relaxed);
+            counter.busy.fetch_add(timer.elapsed(), std::memory_order_relaxed);
+        }
+    }
+
+    // 合并各分片
+    void stat(ThreadPoolStat &stat, uint32_t threads, uint64_t queued) const {
+        double scale = MicroMetricsClock::ns_per_tick();
+        uint64_t executed = 0;
+        uint64_t timed = 0;
+        double busy = 0;
+
+        for (auto &counter : counters_) {
+            uint64_t n = counter.executed.load(std::memory_order_relaxed);
+            uint64_t t = counter.timed.load(std::memory_order_relaxed);
+
+            // 各分片按自己的采样比例折算
+            if (t) {
+                busy += (double)counter.busy.load(std::memory_order_relaxed) *
+                        n / t;
+            }
+
+            executed += n;
+            timed += t;
+        }
+
+        stat.threads = threads;
+        stat.min_threads = threads;
+        stat.max_threads = threads;
+        stat.grown = 0;
+        stat.shrunk = 0;
+        stat.rejected = 0;
+        stat.shed = 0;
+        stat.caller_runs = 0;
+        stat.queued = queued;
+
+        // 不区分类别的线程池所有任务都是默认类别
+        for (uint32_t i = 0; i < E_TASK_PRIO_CNT; i++) {
+            stat.class_queued[i] = 0;
+            stat.class_missed[i] = 0;
+        }
+        stat.class_queued[E_TASK_PRIO_NORMAL] = queued;
+        stat.executed = executed;
+        stat.busy_ns = (uint64_t)(busy * scale);
+        stat.uptime_ns =
+            (uint64_t)((MicroMetricsClock::now() - start_) * scale);
+        stat.utilization =
+            stat.uptime_ns && threads
+                ? (double)stat.busy_ns / stat.uptime_ns / threads
+                : 0.0;
+    }
+
+private:
+    /**
+     * @brief 分片计数，按缓存行隔开
+     *
+     */
+    struct Counter {
+        Counter() : executed(0), timed(0), busy(0) {}
+
+        std::atomic<uint64_t> executed;  ///< 已执行任务数
+        std::atomic<uint64_t> timed;     ///< 计时的任务数
+        std::atomic<uint64_t> busy;      ///< 计时任务的执行时间计数
+        char pad[40];                    ///< 缓存行填充
+    };
+
+    uint64_t start_;                               ///< 启动时的计数
+    Counter counters_[MicroMetricsShard::kShards];  ///< 分片计数
+};
+
+}
@@ -0,0 +1,432 @@
+/**
+ * @file micro_plugin_loader.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 动态库插件加载
+ * @date 2021-01-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "micro_kernel.hpp"
+#include "plugin.hpp"
+
+namespace Asty {
+
+#define MICRO_PLUGIN_MANIFEST "plugins.manifest"     ///< 插件目录中的清单文件
+#define MICRO_PLUGIN_CREATE "micro_plugin_create"    ///< 插件工厂符号
+#define MICRO_PLUGIN_DESTROY "micro_plugin_destroy"  ///< 插件销毁符号
+
+/**
+ * @brief 导出插件工厂，插件动态库中使用一次
+ * @details 工厂为C接口，创建的插件由同一动态库中的销毁接口释放，
+ * 插件信息需与清单中的一致
+ *
+ */
+#define MICRO_PLUGIN_EXPORT(T, PLUGIN)                                  \
+    extern "C" Asty::IPlugin<T> *micro_plugin_create(void) {           \
+        return new PLUGIN();                                            \
+    }                                                                   \
+    extern "C" void micro_plugin_destroy(Asty::IPlugin<T> *plugin) {   \
+        delete plugin;                                                  \
+    }
+
+/**
+ * @brief 插件清单项
+ * @details 清单每行一个插件：key name version library [eager]，
+ * key为整数，library为相对插件目录的动态库文件名，#开头为注释
+ *
+ * @tparam T 插件Key的类型
+ */
+template <typename T>
+struct PluginManifestItem {
+    PluginKey<T> key;     ///< 插件信息
+    std::string library;  ///< 动态库路径
+    bool eager;           ///< 启动时加载，否则首次使用时加载
+};
+
+/**
+ * @brief 动态库插件代理
+ * @details 代理按清单中的插件信息注册到微内核，动态库在首次收到消息、流、
+ * 通知或被唤醒时才映射并解析工厂符号，创建插件后执行初始化和启动，
+ * 之后的调用全部转发给插件，加载前的调度属性使用默认值；
+ * 代理析构时释放插件并卸载动态库，
+ * 注销后等到正在执行的调用和插件表旧快照都释放后才会卸载
+ *
+ * @tparam T 插件Key的类型
+ */
+template <typename T>
+class MicroPluginProxy : public IPlugin<T> {
+public:
+    MicroPluginProxy(const PluginManifestItem<T> &item)
+        : IPlugin<T>(item.key),
+          item_(item),
+          handle_(nullptr),
+          destroy_(nullptr),
+          plugin_(nullptr),
+          failed_(false) {}
+
+    virtual ~MicroPluginProxy() {
+        IPlugin<T> *plugin = plugin_.load();
+
+        // 未经微内核停止就注销的插件在卸载前退出
+        if (plugin) {
+            if (E_PLUGIN_RUNING == plugin->plugin_status()) {
+                plugin->plugin_stop();
+                plugin->plugin_exit();
+                plugin->plugin_detach();
+            }
+            destroy_(plugin);
+        }
+
+        if (handle_) {
+            dlclose(handle_);
+        }
+    }
+
+    // 动态库是否已加载
+    bool loaded(void) const { return plugin_.load() != nullptr; }
+
+    // 初始化，动态库加载后执行
+    virtual bool plugin_init(void) override { return true; }
+
+    // 启动，启动时加载的插件在这里加载
+    virtual bool plugin_start(void) override {
+        return !item_.eager || load();
+    }
+
+    virtual bool plugin_task(void) override {
+        IPlugin<T> *plugin = load();
+        return plugin && plugin->plugin_task();
+    }
+
+    // 未加载时允许唤醒触发加载
+    virtual bool plugin_task_en(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return !plugin || plugin->plugin_task_en();
+    }
+
+    // 未加载时只在唤醒后调度，避免周期调度触发加载
+    virtual uint32_t plugin_task_period(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return plugin ? plugin->plugin_task_period() : E_PLUGIN_TASK_ON_READY;
+    }
+
+    virtual uint32_t plugin_task_concurrency(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return plugin ? plugin->plugin_task_concurrency() : 1;
+    }
+
+    virtual std::vector<T> plugin_depends(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return plugin ? plugin->plugin_depends() : IPlugin<T>::plugin_depends();
+    }
+
+    virtual thread_task_prio plugin_task_prio(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return plugin ? plugin->plugin_task_prio()
+                      : IPlugin<T>::plugin_task_prio();
+    }
+
+    virtual int32_t plugin_task_node(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return plugin ? plugin->plugin_task_node()
+                      : IPlugin<T>::plugin_task_node();
+    }
+
+    virtual int32_t plugin_task_cpu(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return plugin ? plugin->plugin_task_cpu()
+                      : IPlugin<T>::plugin_task_cpu();
+    }
+
+    virtual bool plugin_stop(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return !plugin || plugin->plugin_stop();
+    }
+
+    virtual bool plugin_exit(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+
+        if (plugin) {
+            plugin->set_plugin_status(E_PLUGIN_STOP);
+            return plugin->plugin_exit();
+        }
+
+        return true;
+    }
+
+    virtual void plugin_detach(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+
+        if (plugin) {
+            plugin->plugin_detach();
+        }
+    }
+
+    virtual bool notice(const PluginDataT &msg) override {
+        IPlugin<T> *plugin = load();
+        return plugin && plugin->notice(msg);
+    }
+
+    virtual bool message(const PluginMessage<T> &request,
+                         PluginMessage<T> &response) override {
+        IPlugin<T> *plugin = load();
+        return plugin && plugin->message(request, response);
+    }
+
+    virtual bool stream(std::shared_ptr<IPluginStream<T>> stream) override {
+        IPlugin<T> *plugin = load();
+        return plugin && plugin->stream(stream);
+    }
+
+    virtual bool plugin_stream_reactor(void) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return plugin ? plugin->plugin_stream_reactor()
+                      : IPlugin<T>::plugin_stream_reactor();
+    }
+
+    virtual bool stream_ready(
+        std::shared_ptr<IPluginStream<T>> stream) override {
+        IPlugin<T> *plugin = plugin_.load();
+        return plugin ? plugin->stream_ready(stream)
+                      : IPlugin<T>::stream_ready(stream);
+    }
+
+private:
+    // 加载动态库并创建、初始化和启动插件，只尝试一次，失败返回空
+    IPlugin<T> *load(void) {
+        IPlugin<T> *plugin = plugin_.load(std::memory_order_acquire);
+
+        if (plugin) {
+            return plugin;
+        }
+
+        std::lock_guard<std::mutex> lck(mutex_);
+
+        plugin = plugin_.load(std::memory_order_relaxed);
+        if (plugin || failed_) {
+            return plugin;
+        }
+
+        plugin = create();
+
+        if (!plugin) {
+            failed_ = true;
+            return nullptr;
+        }
+
+        plugin->set_micro_kernel_srv(this->get_micro_kernel_service());
+
+        if (!plugin->plugin_init() || !plugin->plugin_start()) {
+            error("init failed");
+            destroy_(plugin);
+            failed_ = true;
+            return nullptr;
+        }
+
+        plugin->set_plugin_status(E_PLUGIN_RUNING);
+        plugin_.store(plugin, std::memory_order_release);
+
+        // 插件需要周期调度时加入定时器
+        if (E_PLUGIN_TASK_ON_READY != plugin->plugin_task_period() &&
+            this->get_micro_kernel_service()) {
+            this->get_micro_kernel_service()->plugin_reschedule(
+                this->plugin_key().key);
+        }
+
+        return plugin;
+    }
+
+    // 映射动态库，解析工厂符号并创建插件，插件信息与清单不一致时销毁
+    IPlugin<T> *create(void) {
+        typedef IPlugin<T> *(*create_fn)(void);
+
+        if (!handle_) {
+            handle_ = dlopen(item_.library.c_str(), RTLD_LAZY | RTLD_LOCAL);
+        }
+
+        if (!handle_) {
+            error(dlerror());
+            return nullptr;
+        }
+
+        create_fn create = (create_fn)dlsym(handle_, MICRO_PLUGIN_CREATE);
+        destroy_ = (destroy_fn)dlsym(handle_, MICRO_PLUGIN_DESTROY);
+
+        if (!create || !destroy_) {
+            error("plugin factory not found");
+            return nullptr;
+        }
+
+        IPlugin<T> *plugin = create();
+
+        if (!plugin) {
+            error("plugin factory failed");
+            return nullptr;
+        }
+
+        const PluginKey<T> &key = plugin->plugin_key();
+
+        if (!(key == item_.key) || key.name != item_.key.name ||
+            key.version != item_.key.version) {
+            error("plugin key mismatch with manifest");
+            destroy_(plugin);
+            return nullptr;
+        }
+
+        return plugin;
+    }
+
+    void error(const char *reason) {
+        IMicroKernelServices<T> *srv = this->get_micro_kernel_service();
+
+        if (srv) {
+            srv->log(E_LOG_ERROR,
+                     "plugin : [name = %s] [version = %s] load %s : %s",
+                     item_.key.name.c_str(), item_.key.version.c_str(),
+                     item_.library.c_str(), reason ? reason : "");
+        }
+    }
+
+private:
+    typedef void (*destroy_fn)(IPlugin<T> *);
+
+    PluginManifestItem<T> item_;        ///< 清单项
+    void *handle_;                      ///< 动态库句柄
+    destroy_fn destroy_;                ///< 插件销毁接口
+    std::atomic<IPlugin<T> *> plugin_;  ///< 已加载的插件
+    bool failed_;                       ///< 加载失败，不再重试
+    std::mutex mutex_;                  ///< 加载锁
+};
+
+/**
+ * @brief 动态库插件加载器
+ * @details 扫描插件目录，按清单为每个动态库注册代理插件，启动时只读取清单，
+ * 动态库在首次使用时才加载；清单中没有的动态库和清单中不存在的动态库都会被跳过。
+ * 插件动态库通过MICRO_PLUGIN_EXPORT导出工厂，可执行文件需使用-rdynamic链接，
+ * 使插件与微内核共享同一份缓冲区池和日志
+ *
+ * @tparam T 插件Key的类型，需能由整数转换
+ */
+template <typename T>
+class MicroPluginLoader {
+public:
+    MicroPluginLoader(MicroKernel<T> &micro_kernel)
+        : micro_kernel_(micro_kernel) {}
+
+    // 加载插件目录，返回注册成功的插件数量
+    size_t load_dir(const std::string &dir) {
+        std::map<std::string, PluginManifestItem<T>> manifest;
+        std::vector<std::shared_ptr<IPlugin<T>>> plugins;
+
+        if (!read_manifest(dir + "/" MICRO_PLUGIN_MANIFEST, manifest)) {
+            return 0;
+        }
+
+        DIR *d = opendir(dir.c_str());
+
+        if (!d) {
+            micro_kernel_.log(E_LOG_WARN, "plugin dir %s open failed",
+                              dir.c_str());
+            return 0;
+        }
+
+        while (struct dirent *entry = readdir(d)) {
+            std::string file = entry->d_name;
+
+            if (file.size() <= 3 ||
+                file.compare(file.size() - 3, 3, ".so") != 0) {
+                continue;
+            }
+
+            auto item = manifest.find(file);
+
+            if (item == manifest.end()) {
+                micro_kernel_.log(E_LOG_WARN, "plugin %s/%s not in manifest",
+                                  dir.c_str(), file.c_str());
+                continue;
+            }
+
+            item->second.library = dir + "/" + file;
+            plugins.push_back(std::make_shared<MicroPluginProxy<T>>(
+                item->second));
+            manifest.erase(item);
+        }
+
+        closedir(d);
+
+        for (auto &item : manifest) {
+            micro_kernel_.log(E_LOG_WARN, "plugin %s/%s not found",
+                              dir.c_str(), item.first.c_str());
+        }
+
+        return micro_kernel_.plugin_register(plugins);
+    }
+
+    // 注销插件，代理释放后卸载动态库
+    bool unload(const T &key) { return micro_kernel_.plugin_unregister(key); }
+
+private:
+    // 读取清单，按动态库文件名索引
+    bool read_manifest(const std::string &path,
+                       std::map<std::string, PluginManifestItem<T>> &manifest) {
+        std::ifstream in(path);
+        std::string line;
+        int lineno = 0;
+
+        if (!in) {
+            micro_kernel_.log(E_LOG_WARN, "plugin manifest %s open failed",
+                              path.c_str());
+            return false;
+        }
+
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            PluginManifestItem<T> item;
+            std::string key;
+            std::string mode;
+
+            lineno++;
+
+            if (!(fields >> key) || '#' == key[0]) {
+                continue;
+            }
+
+            char *end = nullptr;
+            long long value = strtoll(key.c_str(), &end, 0);
+
+            if (*end || !(fields >> item.key.name >> item.key.version >>
+                          item.library)) {
+                micro_kernel_.log(E_LOG_WARN, "plugin manifest %s:%d invalid",
+                                  path.c_str(), lineno);
+                continue;
+            }
+
+            fields >> mode;
+            item.key.key = static_cast<T>(value);
+            item.eager = "eager" == mode;
+            manifest[item.library] = item;
+        }
+
+        return true;
+    }
+
+private:
+    MicroKernel<T> &micro_kernel_;  ///< 微内核
+};
+
+}
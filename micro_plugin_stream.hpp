@@ -0,0 +1,388 @@
+/**
+ * @file micro_plugin_stream.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 微内核提供的进程内插件流
+ * @date 2021-01-23
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "micro_event_count.hpp"
+#include "plugin.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 进程内插件流端点
+ * @details 一对端点共享两个单生产者单消费者环形队列，每个方向一个，
+ * 本端的发送队列是对端的接收队列；队列满或空时先自旋再休眠，
+ * 任一端关闭或析构后两端都进入关闭状态，接收方仍可取完剩余数据。
+ * 每个端点在首次取就绪事件描述符时才创建eventfd，之后写入和读出时
+ * 只在事件未触发时写一次描述符
+ *
+ * @tparam T 插件Key的类型
+ */
+template <typename T>
+class MicroPluginStream : public IPluginStream<T> {
+public:
+    // 创建一对端点，返回本端，对端通过remote取出
+    static std::shared_ptr<MicroPluginStream<T>> create(
+        const PluginKey<T> &from, const PluginKey<T> &to,
+        size_t capacity = 64) {
+        std::shared_ptr<Channel> channel(new Channel(capacity));
+        std::shared_ptr<MicroPluginStream<T>> local(
+            new MicroPluginStream<T>(from, to, channel, true));
+
+        local->remote_.reset(
+            new MicroPluginStream<T>(to, from, channel, false));
+
+        return local;
+    }
+
+    virtual ~MicroPluginStream() { close(); }
+
+    // 关闭流式通信连接，唤醒两端所有等待者
+    virtual void close() override {
+        if (channel_->closed.exchange(true)) {
+            return;
+        }
+
+        for (Ring *ring : {&channel_->ring0, &channel_->ring1}) {
+            ring->readable.notify_all();
+            ring->writable.notify_all();
+        }
+
+        channel_->event0.signal();
+        channel_->event1.signal();
+    }
+
+    // 检查连接是否关闭
+    virtual bool is_closed(void) override { return channel_->closed; }
+
+    // 发送数据
+    virtual int send(const PluginDataT &data,
+                     const int64_t wait = -1) override {
+        return send(&data, 1, wait);
+    }
+
+    // 接收数据
+    virtual int recv(PluginDataT &data, const int64_t wait = -1) override {
+        return recv(&data, 1, wait);
+    }
+
+    // 批量发送，队列空间不足时等待，直到全部发送、超时或连接关闭
+    virtual int send(const PluginDataT *data, int cnt,
+                     const int64_t wait = -1) override {
+        clock::time_point deadline = deadline_of(wait);
+        int done = 0;
+
+        if (cnt <= 0) {
+            return 0;
+        }
+
+        for (;;) {
+            if (channel_->closed) {
+                return done ? done : -1;
+            }
+
+            done += tx_.push(data + done, cnt - done);
+
+            if (done == cnt) {
+                return done;
+            }
+
+            // 不等待的发送在对端取出数据后通过就绪事件通知
+            if (!wait) {
+                tx_.want_space = true;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (tx_.space()) {
+                    continue;
+                }
+                return done;
+            }
+
+            if (!wait_until(tx_.writable, wait, deadline, [this] {
+                    return channel_->closed || tx_.space();
+                })) {
+                return done;
+            }
+        }
+    }
+
+    // 批量接收，有数据时取走最多cnt个立即返回，关闭后先取完剩余数据
+    virtual int recv(PluginDataT *data, int cnt,
+                     const int64_t wait = -1) override {
+        clock::time_point deadline = deadline_of(wait);
+
+        if (cnt <= 0) {
+            return 0;
+        }
+
+        for (;;) {
+            bool closed = channel_->closed;
+            int n = (int)rx_.pop(data, cnt);
+
+            if (n) {
+                return n;
+            }
+
+            // 关闭前写入的数据已在上面取完
+            if (closed) {
+                return -1;
+            }
+
+            if (!wait_until(rx_.readable, wait, deadline, [this] {
+                    return channel_->closed || rx_.size();
+                })) {
+                return 0;
+            }
+        }
+    }
+
+    // 取出对端，只有create返回的本端有对端，且只能取出一次
+    virtual std::shared_ptr<IPluginStream<T>> remote(void) override {
+        std::shared_ptr<IPluginStream<T>> remote;
+        remote.swap(remote_);
+        return remote;
+    }
+
+    // 本端的就绪事件描述符，首次调用时创建
+    virtual int event_fd(void) override { return event_.open(); }
+
+    // 清除本端的就绪事件
+    virtual void event_clear(void) override { event_.clear(); }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    /**
+     * @brief 端点的就绪事件
+     *
+     */
+    struct Event {
+        Event() : fd(-1), pending(false) {}
+
+        ~Event() {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+
+        // 创建描述符并触发一次，报告创建前已有的数据
+        int open(void) {
+            std::lock_guard<std::mutex> lck(mutex);
+
+            if (fd < 0) {
+                fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                signal();
+            }
+
+            return fd;
+        }
+
+        // 未创建描述符或已触发未清除时不写描述符
+        void signal(void) {
+            int efd = fd.load();
+
+            if (efd >= 0 && !pending.exchange(true)) {
+                eventfd_write(efd, 1);
+            }
+        }
+
+        // 先读空描述符再清除标记，清除后的处理能看到之前写入的数据
+        void clear(void) {
+            eventfd_t value;
+            int efd = fd.load();
+
+            if (efd >= 0) {
+                eventfd_read(efd, &value);
+                pending = false;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        std::atomic<int> fd;       ///< eventfd，未创建时为-1
+        std::atomic_bool pending;  ///< 已触发未清除
+        std::mutex mutex;          ///< 创建锁
+    };
+
+    /**
+     * @brief 单生产者单消费者环形队列，读写位置按缓存行隔开
+     *
+     */
+    struct Ring {
+        Ring(size_t capacity, Event &reader, Event &writer)
+            : head(0),
+              tail(0),
+              want_space(false),
+              reader(reader),
+              writer(writer) {
+            size_t size = 1;
+
+            while (size < capacity) {
+                size <<= 1;
+            }
+
+            cells.resize(size);
+            mask = size - 1;
+        }
+
+        // 已缓存的个数
+        size_t size(void) const {
+            return tail.load(std::memory_order_acquire) -
+                   head.load(std::memory_order_acquire);
+        }
+
+        // 剩余空间
+        size_t space(void) const { return cells.size() - size(); }
+
+        // 生产者写入最多n个，返回写入的个数
+        size_t push(const PluginDataT *data, size_t n) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t free =
+                cells.size() - (t - head.load(std::memory_order_acquire));
+
+            if (n > free) {
+                n = free;
+            }
+
+            if (!n) {
+                return 0;
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                cells[(t + i) & mask] = data[i];
+            }
+
+            tail.store(t + n, std::memory_order_release);
+            readable.notify_one();
+            reader.signal();
+
+            return n;
+        }
+
+        // 消费者取出最多n个，返回取出的个数
+        size_t pop(PluginDataT *data, size_t n) {
+            size_t h = head.load(std::memory_order_relaxed);
+            size_t used = tail.load(std::memory_order_acquire) - h;
+
+            if (n > used) {
+                n = used;
+            }
+
+            if (!n) {
+                return 0;
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                PluginDataT &cell = cells[(h + i) & mask];
+                data[i] = cell;
+                cell = PluginDataT{};  // 释放缓冲区引用
+            }
+
+            head.store(h + n, std::memory_order_release);
+            writable.notify_one();
+            if (want_space.load(std::memory_order_relaxed) &&
+                want_space.exchange(false)) {
+                writer.signal();
+            }
+
+            return n;
+        }
+
+        std::vector<PluginDataT> cells;  ///< 数据槽，个数为2的幂
+        size_t mask;                     ///< 下标掩码
+        std::atomic<size_t> head;        ///< 消费者读位置
+        char pad0[64];                   ///< 缓存行填充
+        std::atomic<size_t> tail;        ///< 生产者写位置
+        char pad1[64];                   ///< 缓存行填充
+        MicroEventCount readable;        ///< 消费者等待数据
+        MicroEventCount writable;        ///< 生产者等待空间
+        std::atomic_bool want_space;     ///< 生产者不等待的发送未发完
+        Event &reader;                   ///< 消费者端点的就绪事件
+        Event &writer;                   ///< 生产者端点的就绪事件
+    };
+
+    /**
+     * @brief 两端共享的通道
+     *
+     */
+    struct Channel {
+        Channel(size_t capacity)
+            : ring0(capacity, event1, event0),
+              ring1(capacity, event0, event1),
+              closed(false) {}
+
+        Event event0;             ///< 本端就绪事件
+        Event event1;             ///< 对端就绪事件
+        Ring ring0;               ///< 本端发送方向
+        Ring ring1;               ///< 对端发送方向
+        std::atomic_bool closed;  ///< 关闭标记
+    };
+
+    MicroPluginStream(const PluginKey<T> &from, const PluginKey<T> &to,
+                      const std::shared_ptr<Channel> &channel, bool local)
+        : IPluginStream<T>(from, to),
+          channel_(channel),
+          tx_(local ? channel->ring0 : channel->ring1),
+          rx_(local ? channel->ring1 : channel->ring0),
+          event_(local ? channel->event0 : channel->event1) {}
+
+    // 等待时间换算为截止时间
+    static clock::time_point deadline_of(int64_t wait) {
+        return wait > 0 ? clock::now() + std::chrono::microseconds(wait)
+                        : clock::time_point::max();
+    }
+
+    // 先自旋再休眠等待条件满足，超时返回false
+    template <typename Pred>
+    static bool wait_until(MicroEventCount &event, int64_t wait,
+                           clock::time_point deadline, Pred pred) {
+        if (!wait) {
+            return false;
+        }
+
+        for (int i = 0; i < kSpinCount; i++) {
+            if (pred()) {
+                return true;
+            }
+            std::this_thread::yield();
+        }
+
+        if (wait < 0) {
+            event.wait(pred);
+            return true;
+        }
+
+        clock::time_point now = clock::now();
+
+        if (now >= deadline) {
+            return pred();
+        }
+
+        return event.wait_for(pred, deadline - now);
+    }
+
+private:
+    static const int kSpinCount = 16;  ///< 休眠前的自旋次数
+
+    std::shared_ptr<Channel> channel_;          ///< 共享通道
+    Ring &tx_;                                  ///< 发送队列
+    Ring &rx_;                                  ///< 接收队列
+    Event &event_;                              ///< 本端就绪事件
+    std::shared_ptr<IPluginStream<T>> remote_;  ///< 尚未取出的对端
+};
+
+}
@@ -0,0 +1,305 @@
+/**
+ * @file micro_priority_task_queue.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 按优先级类别和截止时间排序的任务队列
+ * @date 2021-01-28
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "sync_queue.hpp"
+#include "thread_pool.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 优先级任务队列
+ * @details 每个优先级类别一个按截止时间排序的小顶堆，出队时取最高类别中
+ * 截止时间最早的任务(EDF)，没有截止时间的任务排在同类别有截止时间的任务之后，
+ * 相互之间保持入队顺序；容量为所有类别共享，腾出空间时丢弃最低类别中
+ * 最早入队的任务
+ *
+ * @tparam T 队列对象类型
+ */
+template <typename T>
+class MicroPriorityTaskQueue : public ISyncQueue<T> {
+public:
+    MicroPriorityTaskQueue(size_t size)
+        : max_size_(size), count_(0), seq_(0), waiting_(0), stop_(false) {}
+    virtual ~MicroPriorityTaskQueue() { stop(); }
+
+    // 按默认类别入队
+    virtual bool push(T &&obj) override {
+        return push(std::forward<T>(obj), ThreadTaskAttr(), -1);
+    }
+
+    // 按默认类别限时入队
+    virtual bool push(T &&obj, int64_t wait) override {
+        return push(std::forward<T>(obj), ThreadTaskAttr(), wait);
+    }
+
+    // 按类别和截止时间入队，wait同限时入队
+    bool push(T &&obj, const ThreadTaskAttr &attr, int64_t wait = -1) {
+        std::unique_lock<std::mutex> lck(mutex_);
+        auto ready = [this] { return stop_ || count_ < max_size_; };
+
+        // 等待队列非满才能入队
+        if (wait < 0) {
+            not_full_.wait(lck, ready);
+        } else if (!not_full_.wait_for(lck, std::chrono::microseconds(wait),
+                                       ready)) {
+            return false;
+        }
+
+        if (stop_) {
+            return false;
+        }
+
+        put(std::forward<T>(obj), attr);
+        not_empty_.notify_one();
+
+        return true;
+    }
+
+    // 按默认类别批量入队
+    virtual size_t push_bulk(T *objs, size_t cnt, int64_t wait) override {
+        return push_bulk(objs, nullptr, cnt, wait);
+    }
+
+    // 按各自的类别和截止时间批量入队，attrs为空时按默认类别，
+    // 一次加锁放入尽量多的对象，wait为整批的等待时间
+    size_t push_bulk(T *objs, const ThreadTaskAttr *attrs, size_t cnt,
+                     int64_t wait) {
+        std::unique_lock<std::mutex> lck(mutex_);
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::microseconds(wait < 0 ? 0 : wait);
+        auto ready = [this] { return stop_ || count_ < max_size_; };
+        size_t n = 0;
+
+        while (n < cnt) {
+            if (wait < 0) {
+                not_full_.wait(lck, ready);
+            } else if (!not_full_.wait_until(lck, deadline, ready)) {
+                break;
+            }
+
+            if (stop_) {
+                break;
+            }
+
+            size_t begin = n;
+
+            while (n < cnt && count_ < max_size_) {
+                put(std::move(objs[n]), attrs ? attrs[n] : ThreadTaskAttr());
+                n++;
+            }
+
+            notify(not_empty_, n - begin);
+        }
+
+        return n;
+    }
+
+    // 出队
+    virtual bool pop(T &t) override {
+        ThreadTaskAttr attr;
+        return pop(t, attr);
+    }
+
+    // 出队，同时返回任务的类别和截止时间
+    bool pop(T &t, ThreadTaskAttr &attr) {
+        std::unique_lock<std::mutex> lck(mutex_);
+        // 等待队列非空才能出队
+        waiting_++;
+        not_empty_.wait(lck, [this] { return stop_ || count_; });
+        waiting_--;
+
+        if (stop_) {
+            return false;
+        }
+
+        take(t, attr);
+        not_full_.notify_one();
+
+        return true;
+    }
+
+    // 批量出队
+    virtual size_t pop_bulk(T *objs, size_t max) override {
+        return pop_bulk(objs, nullptr, max);
+    }
+
+    // 按优先顺序批量出队，attrs非空时返回各任务的类别和截止时间；
+    // 还有其他消费者等待时只取平分的份额
+    size_t pop_bulk(T *objs, ThreadTaskAttr *attrs, size_t max) {
+        std::unique_lock<std::mutex> lck(mutex_);
+        ThreadTaskAttr attr;
+
+        waiting_++;
+        not_empty_.wait(lck, [this] { return stop_ || count_; });
+        waiting_--;
+
+        if (stop_) {
+            return 0;
+        }
+
+        size_t n = std::min(max, (count_ + waiting_) / (waiting_ + 1));
+
+        for (size_t i = 0; i < n; i++) {
+            take(objs[i], attrs ? attrs[i] : attr);
+        }
+
+        notify(not_full_, n);
+
+        return n;
+    }
+
+    // 取出最低类别中最早入队的可丢弃任务
+    virtual bool shed(T &t) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        if (stop_) {
+            return false;
+        }
+
+        for (int prio = E_TASK_PRIO_CNT - 1; prio >= 0; prio--) {
+            std::vector<Item> &heap = heaps_[prio];
+            auto oldest = heap.end();
+
+            for (auto it = heap.begin(); it != heap.end(); ++it) {
+                if (!it->keep &&
+                    (oldest == heap.end() || it->seq < oldest->seq)) {
+                    oldest = it;
+                }
+            }
+
+            if (oldest == heap.end()) {
+                continue;
+            }
+
+            t = std::move(oldest->obj);
+            *oldest = std::move(heap.back());
+            heap.pop_back();
+            std::make_heap(heap.begin(), heap.end(), std::greater<Item>());
+            count_--;
+            not_full_.notify_one();
+
+            return true;
+        }
+
+        return false;
+    }
+
+    // 队列内容数，可在其他线程统计时调用
+    virtual size_t count(void) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+        return count_;
+    }
+
+    // 某个类别的队列内容数
+    size_t count(thread_task_prio prio) {
+        std::unique_lock<std::mutex> lck(mutex_);
+        return prio < E_TASK_PRIO_CNT ? heaps_[prio].size() : 0;
+    }
+
+    virtual bool empty(void) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+        return !count_;
+    }
+
+    virtual bool full(void) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+        return count_ >= max_size_;
+    }
+
+    // 停止队列
+    virtual void stop(void) override {
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            stop_ = true;
+        }
+
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    // 按类别放入对应的堆，持锁调用
+    void put(T &&obj, const ThreadTaskAttr &attr) {
+        uint32_t prio = attr.prio < E_TASK_PRIO_CNT ? attr.prio
+                                                    : E_TASK_PRIO_NORMAL;
+        std::vector<Item> &heap = heaps_[prio];
+
+        heap.push_back(
+            Item{attr.deadline, seq_++, attr.keep, std::forward<T>(obj)});
+        std::push_heap(heap.begin(), heap.end(), std::greater<Item>());
+        count_++;
+    }
+
+    // 取出最高类别中截止时间最早的任务，队列非空时持锁调用
+    void take(T &t, ThreadTaskAttr &attr) {
+        for (uint32_t prio = 0; prio < E_TASK_PRIO_CNT; prio++) {
+            std::vector<Item> &heap = heaps_[prio];
+
+            if (heap.empty()) {
+                continue;
+            }
+
+            std::pop_heap(heap.begin(), heap.end(), std::greater<Item>());
+            t = std::move(heap.back().obj);
+            attr.prio = (thread_task_prio)prio;
+            attr.deadline = heap.back().deadline;
+            heap.pop_back();
+            break;
+        }
+
+        count_--;
+    }
+
+    // 放入或取出n个对象后唤醒等待方
+    static void notify(std::condition_variable &cond, size_t n) {
+        if (n > 1) {
+            cond.notify_all();
+        } else if (n) {
+            cond.notify_one();
+        }
+    }
+
+    /**
+     * @brief 队列项，按截止时间和入队序号排序
+     *
+     */
+    struct Item {
+        ThreadTaskAttr::clock::time_point deadline;  ///< 截止时间
+        uint64_t seq;                                ///< 入队序号
+        bool keep;                                   ///< 不可丢弃
+        T obj;                                       ///< 任务
+
+        bool operator>(const Item &item) const {
+            return deadline > item.deadline ||
+                   (deadline == item.deadline && seq > item.seq);
+        }
+    };
+
+private:
+    std::vector<Item> heaps_[E_TASK_PRIO_CNT];  ///< 各类别的任务堆
+    std::mutex mutex_;                          ///< 队列锁
+    std::condition_variable not_empty_;         ///< 非空条件变量
+    std::condition_variable not_full_;          ///< 非满条件变量
+    size_t max_size_;                           ///< 任务队列限制
+    size_t count_;                              ///< 所有类别的任务数
+    uint64_t seq_;                              ///< 入队序号
+    size_t waiting_;                            ///< 等待出队的消费者数
+    bool stop_;                                 ///< 退出条件
+};
+
+}
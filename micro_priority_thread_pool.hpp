@@ -0,0 +1,214 @@
+/**
+ * @file micro_priority_thread_pool.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 微内核优先级线程池
+ * @date 2021-01-28
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "micro_metrics.hpp"
+#include "micro_priority_task_queue.hpp"
+#include "micro_task_overflow.hpp"
+#include "thread_pool.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 微内核优先级线程池
+ * @details 任务按优先级类别执行，同类别内截止时间最早的先执行，
+ * 不带属性添加的任务属于默认类别且没有截止时间；
+ * 统计各类别的排队数和超过截止时间才完成的任务数
+ *
+ */
+class MicroKernelPriorityThreadPool : public IThreadPool {
+public:
+    MicroKernelPriorityThreadPool(
+        size_t task_limit = 100,
+        int thread_cnt = std::thread::hardware_concurrency())
+        : queue_(task_limit),
+          thread_cnt_(thread_cnt > 0 ? thread_cnt : 0),
+          drain_(1),
+          running_(false) {
+        for (auto &missed : missed_) {
+            missed.store(0, std::memory_order_relaxed);
+        }
+
+        running_ = true;
+        for (int i = 0; i < thread_cnt; i++) {
+            threads_.push_back(
+                std::make_shared<std::thread>([this] { run(); }));
+        }
+    }
+
+    virtual ~MicroKernelPriorityThreadPool() { stop(); }
+
+    // 每次唤醒按优先顺序最多取出drain_个依次执行
+    virtual void run() override {
+        thread_task_t batch[kDrainBatch];
+        ThreadTaskAttr attrs[kDrainBatch];
+
+        current() = this;
+
+        while (running_) {
+            size_t n = queue_.pop_bulk(batch, attrs, drain_);
+
+            if (!n) {
+                break;
+            }
+
+            for (size_t i = 0; i < n && running_; i++) {
+                if (!batch[i]) {
+                    continue;
+                }
+
+                MicroMetricsTimer timer;
+                batch[i]();
+                metrics_.record(timer);
+
+                if (attrs[i].has_deadline() &&
+                    ThreadTaskAttr::clock::now() > attrs[i].deadline) {
+                    missed_[attrs[i].prio].fetch_add(
+                        1, std::memory_order_relaxed);
+                }
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                batch[i] = nullptr;
+            }
+        }
+
+        current() = nullptr;
+    }
+
+    virtual void stop() override {
+        std::call_once(flag_, [this] { _stop(); });  // 多线程只调用一次
+    }
+
+    // 按默认类别添加任务
+    virtual void add_task(thread_task_t &&task) override {
+        add_task_for(std::move(task), overflow_.default_wait());
+    }
+
+    // 按类别和截止时间添加任务
+    virtual void add_task(thread_task_t &&task,
+                          const ThreadTaskAttr &attr) override {
+        add_task_for(std::move(task), overflow_.default_wait(), attr);
+    }
+
+    // 限时添加，队列满超过wait(us)后按溢出策略处理，
+    // 丢弃时丢弃最低类别中最早排队的任务
+    virtual thread_task_add_status add_task_for(
+        thread_task_t &&task, int64_t wait,
+        const ThreadTaskAttr &attr = ThreadTaskAttr()) override {
+        return overflow_.add(
+            wait,
+            [&](int64_t us) { return queue_.push(std::move(task), attr, us); },
+            [this] { return running_.load(); },
+            [this] {
+                thread_task_t t;
+                return queue_.shed(t);
+            },
+            [&task] { task(); });
+    }
+
+    // 批量添加，一次加锁按各自的类别和截止时间入队，
+    // 未能整批入队的任务逐个按溢出策略处理
+    virtual size_t add_tasks(thread_task_t *tasks, size_t cnt, int64_t wait,
+                             const ThreadTaskAttr *attrs = nullptr) override {
+        size_t done = 0;
+
+        while (done < cnt) {
+            done += queue_.push_bulk(
+                &tasks[done], attrs ? &attrs[done] : nullptr, cnt - done, wait);
+            if (done == cnt) {
+                break;
+            }
+
+            ThreadTaskAttr attr = attrs ? attrs[done] : ThreadTaskAttr();
+
+            if (!accepted(add_task_for(std::move(tasks[done]), 0, attr))) {
+                return done;
+            }
+            done++;
+        }
+
+        return cnt;
+    }
+
+    virtual bool set_overflow_policy(thread_overflow_policy policy) override {
+        overflow_.set_policy(policy);
+        return true;
+    }
+
+    // 每次唤醒最多取出的任务数，限制在1到kDrainBatch之间
+    virtual bool set_drain_batch(uint32_t n) override {
+        uint32_t max = kDrainBatch;
+
+        drain_ = std::min(std::max<uint32_t>(n, 1), max);
+        return true;
+    }
+
+    virtual thread_overflow_policy overflow_policy(void) override {
+        return overflow_.policy();
+    }
+
+    // 运行统计，包括各类别的排队数和错过截止时间的任务数
+    virtual bool stat(ThreadPoolStat &stat) override {
+        metrics_.stat(stat, thread_cnt_, queue_.count());
+        overflow_.stat(stat);
+
+        for (uint32_t i = 0; i < E_TASK_PRIO_CNT; i++) {
+            stat.class_queued[i] = queue_.count((thread_task_prio)i);
+            stat.class_missed[i] = missed_[i].load(std::memory_order_relaxed);
+        }
+
+        return true;
+    }
+
+    virtual bool in_worker(void) override { return current() == this; }
+
+private:
+    // 当前线程执行任务的线程池
+    static MicroKernelPriorityThreadPool *&current(void) {
+        static thread_local MicroKernelPriorityThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    void _stop(void) {
+        queue_.stop();
+        running_ = false;
+
+        for (auto thread : threads_) {
+            if (thread) {
+                thread->join();
+            }
+        }
+
+        threads_.clear();
+    }
+
+private:
+    // 取出的任务在本线程依次执行，批次小一些以免高类别任务等待过久
+    static const size_t kDrainBatch = 4;  ///< 每次唤醒最多取出的任务上限
+
+    std::list<std::shared_ptr<std::thread>> threads_;  ///< 线程队列
+    MicroPriorityTaskQueue<thread_task_t> queue_;      ///< 线程任务队列
+    uint32_t thread_cnt_;                              ///< 工作线程数
+    std::atomic<uint32_t> drain_;                      ///< 每次唤醒最多取出的任务数
+    MicroPoolMetrics metrics_;                         ///< 运行指标
+    MicroTaskOverflow overflow_;                       ///< 溢出处理
+    std::atomic<uint64_t> missed_[E_TASK_PRIO_CNT];    ///< 各类别错过截止时间数
+    std::atomic_bool running_;                         ///< 线程池运行状态
+    std::once_flag flag_;                              ///< 标记
+};
+
+}
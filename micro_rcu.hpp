@@ -0,0 +1,171 @@
+/**
+ * @file micro_rcu.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 读多写少数据的无锁发布
+ * @date 2021-01-21
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+namespace Asty {
+
+/**
+ * @brief 基于纪元的RCU读者登记域
+ * @details 每个读线程占用一个登记槽，进入读区间时记录当前纪元，离开时清零；
+ * 写者替换指针后推进纪元，等待所有仍停留在旧纪元的读者离开后再释放旧对象
+ *
+ */
+class MicroRcuDomain {
+public:
+    /**
+     * @brief 读者登记槽，按缓存行隔开
+     *
+     */
+    struct Reader {
+        Reader() : epoch(0), used(true), next(nullptr) {}
+
+        std::atomic<uint64_t> epoch;  ///< 读者所处纪元，0表示不在读区间
+        std::atomic_bool used;        ///< 槽位是否被线程占用
+        Reader *next;                 ///< 下一个槽位
+        char pad[64];                 ///< 缓存行填充
+    };
+
+    // 进程唯一的登记域，不释放，避免线程局部对象析构时访问已释放的域
+    static MicroRcuDomain &instance(void) {
+        static MicroRcuDomain *domain = new MicroRcuDomain();
+        return *domain;
+    }
+
+    // 占用一个登记槽，优先复用已退出线程的槽位
+    Reader *acquire(void) {
+        for (Reader *r = head_.load(); r; r = r->next) {
+            bool used = false;
+            if (!r->used && r->used.compare_exchange_strong(used, true)) {
+                return r;
+            }
+        }
+
+        Reader *r = new Reader();
+        Reader *head = head_.load();
+
+        do {
+            r->next = head;
+        } while (!head_.compare_exchange_weak(head, r));
+
+        return r;
+    }
+
+    // 归还登记槽
+    void release(Reader *r) {
+        r->epoch = 0;
+        r->used = false;
+    }
+
+    // 当前纪元
+    uint64_t epoch(void) const { return epoch_.load(); }
+
+    // 推进纪元并等待旧纪元的读者全部离开，不得在读区间内调用
+    void synchronize(void) {
+        uint64_t target = epoch_.fetch_add(1) + 1;
+
+        for (Reader *r = head_.load(); r; r = r->next) {
+            for (;;) {
+                uint64_t e = r->epoch.load();
+
+                if (!e || e >= target) {
+                    break;
+                }
+
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    MicroRcuDomain() : head_(nullptr), epoch_(1) {}
+
+private:
+    std::atomic<Reader *> head_;   ///< 登记槽链表
+    std::atomic<uint64_t> epoch_;  ///< 全局纪元
+};
+
+/**
+ * @brief RCU读区间，可嵌套，读区间内不得调用MicroRcuPtr::update
+ *
+ */
+class MicroRcuReadGuard {
+public:
+    MicroRcuReadGuard() : local_(local()) {
+        if (!local_.depth++) {
+            local_.reader->epoch.store(MicroRcuDomain::instance().epoch());
+        }
+    }
+
+    ~MicroRcuReadGuard() {
+        if (!--local_.depth) {
+            local_.reader->epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    MicroRcuReadGuard(const MicroRcuReadGuard &) = delete;
+    MicroRcuReadGuard &operator=(const MicroRcuReadGuard &) = delete;
+
+private:
+    /**
+     * @brief 线程局部的读者状态，线程退出时归还登记槽
+     *
+     */
+    struct Local {
+        Local() : reader(MicroRcuDomain::instance().acquire()), depth(0) {}
+        ~Local() { MicroRcuDomain::instance().release(reader); }
+
+        MicroRcuDomain::Reader *reader;  ///< 登记槽
+        uint32_t depth;                  ///< 嵌套深度
+    };
+
+    static Local &local(void) {
+        static thread_local Local l;
+        return l;
+    }
+
+private:
+    Local &local_;  ///< 线程局部的读者状态
+};
+
+/**
+ * @brief RCU发布的指针，读者无等待，写者复制修改后整体替换
+ *
+ * @tparam P 被发布的对象类型
+ */
+template <typename P>
+class MicroRcuPtr {
+public:
+    explicit MicroRcuPtr(P *ptr = nullptr) : ptr_(ptr) {}
+    ~MicroRcuPtr() { delete ptr_.load(); }
+
+    MicroRcuPtr(const MicroRcuPtr &) = delete;
+    MicroRcuPtr &operator=(const MicroRcuPtr &) = delete;
+
+    // 读取当前对象，需在MicroRcuReadGuard内或持有写者锁时使用
+    P *load(void) const { return ptr_.load(); }
+
+    // 发布新对象，等待读者离开后释放旧对象，写者之间需自行互斥
+    void update(P *ptr) {
+        P *old = ptr_.exchange(ptr);
+
+        MicroRcuDomain::instance().synchronize();
+
+        delete old;
+    }
+
+private:
+    std::atomic<P *> ptr_;  ///< 当前对象
+};
+
+}
@@ -0,0 +1,208 @@
+/**
+ * @file micro_reactor.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 基于epoll的就绪事件反应器
+ * @date 2021-02-04
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Asty {
+
+/**
+ * @brief 反应器回调，参数为监视标识，可用于取消监视
+ *
+ */
+typedef std::function<void(uint64_t id)> reactor_cb_t;
+
+/**
+ * @brief 就绪事件反应器
+ * @details 一个线程通过epoll边沿触发监视任意数量的描述符，描述符每次被写入
+ * 后在反应器线程中执行一次对应的回调，回调只做提交等非阻塞的工作；
+ * 首次添加监视时才创建epoll和线程
+ *
+ */
+class MicroReactor {
+public:
+    MicroReactor() : epfd_(-1), wake_fd_(-1), next_(0), stop_(false) {}
+
+    ~MicroReactor() { stop(); }
+
+    MicroReactor(const MicroReactor &) = delete;
+    MicroReactor &operator=(const MicroReactor &) = delete;
+
+    // 监视描述符可读，返回监视标识，失败或已停止返回0；
+    // 描述符在取消监视前需保持打开
+    uint64_t add(int fd, const reactor_cb_t &cb) {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        if (stop_ || !start()) {
+            return 0;
+        }
+
+        uint64_t id = ++next_;
+        struct epoll_event ev = {};
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = id;
+
+        if (0 != epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev)) {
+            return 0;
+        }
+
+        watches_[id] = std::make_shared<Watch>(fd, cb);
+
+        return id;
+    }
+
+    // 取消监视，可在回调中调用，正在执行的回调会执行完
+    void remove(uint64_t id) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        auto it = watches_.find(id);
+
+        if (it == watches_.end()) {
+            return;
+        }
+
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, it->second->fd, nullptr);
+        watches_.erase(it);
+    }
+
+    // 监视中的描述符数量
+    size_t size(void) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return watches_.size();
+    }
+
+    // 停止反应器线程并取消全部监视，不能在回调中调用
+    void stop(void) {
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+
+            if (stop_) {
+                return;
+            }
+
+            stop_ = true;
+            if (wake_fd_ >= 0) {
+                eventfd_write(wake_fd_, 1);
+            }
+        }
+
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        watches_.clear();
+
+        if (epfd_ >= 0) {
+            ::close(epfd_);
+            ::close(wake_fd_);
+            epfd_ = -1;
+            wake_fd_ = -1;
+        }
+    }
+
+private:
+    static const int kMaxEvents = 64;  ///< 每次取出的事件数
+
+    /**
+     * @brief 监视项
+     *
+     */
+    struct Watch {
+        Watch(int fd, const reactor_cb_t &cb) : fd(fd), cb(cb) {}
+
+        int fd;           ///< 描述符
+        reactor_cb_t cb;  ///< 回调
+    };
+
+    // 创建epoll和反应器线程，已创建时直接返回
+    bool start(void) {
+        if (epfd_ >= 0) {
+            return true;
+        }
+
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        struct epoll_event ev = {};
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0;
+
+        if (epfd_ < 0 || wake_fd_ < 0 ||
+            0 != epoll_ctl(epfd_, EPOLL_CTL_ADD, wake_fd_, &ev)) {
+            if (epfd_ >= 0) {
+                ::close(epfd_);
+            }
+            if (wake_fd_ >= 0) {
+                ::close(wake_fd_);
+            }
+            epfd_ = -1;
+            wake_fd_ = -1;
+            return false;
+        }
+
+        thread_ = std::thread(&MicroReactor::loop, this);
+
+        return true;
+    }
+
+    // 标识0为停止通知
+    void loop(void) {
+        struct epoll_event events[kMaxEvents];
+
+        for (;;) {
+            int n = epoll_wait(epfd_, events, kMaxEvents, -1);
+
+            for (int i = 0; i < n; i++) {
+                uint64_t id = events[i].data.u64;
+
+                if (!id) {
+                    return;
+                }
+
+                std::shared_ptr<Watch> watch;
+
+                {
+                    std::lock_guard<std::mutex> lck(mtx_);
+                    auto it = watches_.find(id);
+
+                    if (it != watches_.end()) {
+                        watch = it->second;
+                    }
+                }
+
+                if (watch) {
+                    watch->cb(id);
+                }
+            }
+        }
+    }
+
+private:
+    int epfd_;                                            ///< epoll描述符
+    int wake_fd_;                                         ///< 停止通知
+    uint64_t next_;                                       ///< 最近分配的标识
+    bool stop_;                                           ///< 已停止
+    std::map<uint64_t, std::shared_ptr<Watch>> watches_;  ///< 监视项
+    std::mutex mtx_;                                      ///< 监视表锁
+    std::thread thread_;                                  ///< 反应器线程
+};
+
+}
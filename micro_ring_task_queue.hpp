@@ -0,0 +1,306 @@
+/**
+ * @file micro_ring_task_queue.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 无锁有界多生产者多消费者环形队列
+ * @date 2021-01-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include "micro_event_count.hpp"
+#include "sync_queue.hpp"
+
+namespace Asty {
+
+#define MICRO_CACHE_LINE_SIZE 64
+
+/**
+ * @brief 微内核无锁任务队列
+ * @details 基于每个槽位序号的有界环形队列(Vyukov)，容量向上取整为2的幂，
+ * 入队出队只竞争各自的位置计数，队列满或空时先自旋再休眠
+ *
+ * @tparam T 队列类型
+ */
+template <typename T>
+class MicroRingTaskQueue : public ISyncQueue<T> {
+public:
+    MicroRingTaskQueue(size_t size)
+        : cells_(nullptr), mask_(capacity(size) - 1), stop_(false) {
+        void *mem = nullptr;
+
+        if (posix_memalign(&mem, MICRO_CACHE_LINE_SIZE,
+                           sizeof(Cell) * (mask_ + 1))) {
+            throw std::bad_alloc();
+        }
+
+        cells_ = static_cast<Cell *>(mem);
+        for (size_t i = 0; i <= mask_; i++) {
+            new (&cells_[i]) Cell();
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    virtual ~MicroRingTaskQueue() {
+        stop();
+
+        for (size_t i = 0; i <= mask_; i++) {
+            cells_[i].~Cell();
+        }
+        free(cells_);
+    }
+
+    // 入队
+    virtual bool push(T &&obj) override {
+        return push(std::forward<T>(obj), -1);
+    }
+
+    // 限时入队，不等待时只尝试一次
+    virtual bool push(T &&obj, int64_t wait) override {
+        bool pushed = false;
+
+        if (0 == wait) {
+            if (stop_ || !try_push(std::forward<T>(obj))) {
+                return false;
+            }
+
+            not_empty_.notify_one();
+            return true;
+        }
+
+        for (int i = 0; i < kSpinCount; i++) {
+            if (stop_) {
+                return false;
+            }
+
+            if (try_push(std::forward<T>(obj))) {
+                not_empty_.notify_one();
+                return true;
+            }
+
+            std::this_thread::yield();
+        }
+
+        auto ready = [&] {
+            return stop_ || (pushed = try_push(std::forward<T>(obj)));
+        };
+
+        // 等待队列非满才能入队
+        if (wait < 0) {
+            not_full_.wait(ready);
+        } else {
+            not_full_.wait_for(ready, std::chrono::microseconds(wait));
+        }
+
+        if (!pushed) {
+            return false;
+        }
+
+        not_empty_.notify_one();
+
+        return true;
+    }
+
+    // 批量入队，先不等待地连续入队，队列满时按wait等待一个位置后继续
+    virtual size_t push_bulk(T *objs, size_t cnt, int64_t wait) override {
+        size_t n = 0;
+
+        while (n < cnt && !stop_) {
+            size_t begin = n;
+
+            while (n < cnt && try_push(std::move(objs[n]))) {
+                n++;
+            }
+
+            notify(not_empty_, n - begin);
+
+            if (n == cnt || 0 == wait || !push(std::move(objs[n]), wait)) {
+                break;
+            }
+            n++;
+        }
+
+        return n;
+    }
+
+    // 出队
+    virtual bool pop(T &t) override {
+        bool popped = false;
+
+        for (int i = 0; i < kSpinCount; i++) {
+            if (stop_) {
+                return false;
+            }
+
+            if (try_pop(t)) {
+                return true;
+            }
+
+            std::this_thread::yield();
+        }
+
+        // 等待队列非空才能出队
+        not_empty_.wait([&] { return stop_ || (popped = try_pop(t)); });
+
+        return popped;
+    }
+
+    // 批量出队，取到第一个后不等待地继续取，还有其他消费者等待时
+    // 只取平分的份额
+    virtual size_t pop_bulk(T *objs, size_t max) override {
+        if (!max || !pop(objs[0])) {
+            return 0;
+        }
+
+        size_t waiters = not_empty_.waiters();
+        size_t share = (count() + waiters) / (waiters + 1);
+        size_t n = 1;
+
+        while (n < max && n <= share && try_pop(objs[n])) {
+            n++;
+        }
+
+        return n;
+    }
+
+    // 取出最早入队的对象
+    virtual bool shed(T &t) override {
+        return try_pop(t);
+    }
+
+    // 队列内容数，并发时为近似值
+    virtual size_t count(void) override {
+        size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+
+        return tail > head ? tail - head : 0;
+    }
+
+    virtual bool empty(void) override { return count() == 0; }
+
+    virtual bool full(void) override { return count() > mask_; }
+
+    // 停止队列
+    virtual void stop(void) override {
+        stop_ = true;
+
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+    // 非阻塞入队，队列满返回false，失败时不会移走obj
+    bool try_push(T &&obj) {
+        Cell *cell = nullptr;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+            if (dif == 0) {
+                if (enqueue_pos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = std::forward<T>(obj);
+        cell->seq.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // 非阻塞出队，队列空返回false，取出后唤醒一个等待入队的线程
+    bool try_pop(T &t) {
+        Cell *cell = nullptr;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (dif == 0) {
+                if (dequeue_pos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        t = std::move(cell->data);
+        cell->data = T();  // 及时释放对象持有的资源
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        not_full_.notify_one();
+
+        return true;
+    }
+
+private:
+    static const int kSpinCount = 16;  ///< 休眠前的自旋次数
+
+    // 放入或取出n个对象后唤醒等待方
+    static void notify(MicroEventCount &event, size_t n) {
+        if (n > 1) {
+            event.notify_all();
+        } else if (n) {
+            event.notify_one();
+        }
+    }
+
+    // 容量向上取整为2的幂
+    static size_t capacity(size_t size) {
+        size_t cap = 2;
+
+        while (cap < size) {
+            cap <<= 1;
+        }
+
+        return cap;
+    }
+
+    /**
+     * @brief 队列槽位，按缓存行对齐避免伪共享
+     *
+     */
+    struct alignas(MICRO_CACHE_LINE_SIZE) Cell {
+        std::atomic<size_t> seq;  ///< 槽位序号
+        T data;                   ///< 槽位数据
+    };
+
+private:
+    // 用填充隔开生产者和消费者的计数，对象本身不要求超过默认的对齐
+    Cell *cells_;                       ///< 槽位数组
+    size_t mask_;                       ///< 容量掩码
+    char pad0_[MICRO_CACHE_LINE_SIZE];  ///< 缓存行填充
+    std::atomic<size_t> enqueue_pos_;   ///< 入队位置
+    char pad1_[MICRO_CACHE_LINE_SIZE];  ///< 缓存行填充
+    std::atomic<size_t> dequeue_pos_;   ///< 出队位置
+    char pad2_[MICRO_CACHE_LINE_SIZE];  ///< 缓存行填充
+    std::atomic_bool stop_;             ///< 退出条件
+    MicroEventCount not_empty_;         ///< 非空等待
+    MicroEventCount not_full_;          ///< 非满等待
+};
+
+}
@@ -0,0 +1,233 @@
+/**
+ * @file micro_scheduler.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 微内核插件任务调度器
+ * @date 2021-01-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <vector>
+#include "plugin.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 微内核调度器
+ * @details 周期插件和延后的唤醒放在按到期时间排序的小顶堆中，就绪插件放在
+ * 就绪队列中，微内核循环在没有到期或就绪项时休眠，直到最近的插件到期或有
+ * 插件被唤醒
+ *
+ * @tparam T 插件Key的类型
+ */
+template <typename T>
+class MicroKernelScheduler {
+public:
+    typedef std::shared_ptr<IPlugin<T>> plugin_ptr;
+    typedef std::chrono::steady_clock clock;
+
+    MicroKernelScheduler(uint32_t default_period)
+        : default_period_(default_period ? default_period : 1),
+          seq_(0),
+          stop_(false) {}
+
+    // 重置调度器，清除所有调度项
+    void reset(void) {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        while (!timers_.empty()) {
+            if (!timers_.top().retry) {
+                timers_.top().plugin->task_armed_ = false;
+            }
+            timers_.pop();
+        }
+        for (auto &plugin : ready_) {
+            plugin->task_ready_ = false;
+        }
+        ready_.clear();
+        stop_ = false;
+    }
+
+    // 添加插件调度，周期插件在一个周期后首次调度，已有定时器的插件不重复添加
+    void add(const plugin_ptr &plugin) {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        if (plugin->task_armed_ || !arm(plugin, clock::now())) {
+            return;
+        }
+
+        // 新的定时器可能早于当前休眠的到期时间
+        if (timers_.top().plugin == plugin) {
+            cond_.notify_one();
+        }
+    }
+
+    // delay(ms)后唤醒插件，用于线程池拒绝唤醒任务后重试
+    void retry(const plugin_ptr &plugin, uint32_t delay) {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        timers_.push(TimerItem{clock::now() + std::chrono::milliseconds(delay),
+                               seq_++, plugin, true});
+
+        // 新的定时器可能早于当前休眠的到期时间
+        if (timers_.top().seq == seq_ - 1) {
+            cond_.notify_one();
+        }
+    }
+
+    // 唤醒插件，已在就绪队列中的插件不会重复加入
+    void wakeup(const plugin_ptr &plugin) {
+        if (plugin->task_ready_.exchange(true)) {
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            ready_.push_back(plugin);
+        }
+
+        cond_.notify_one();
+    }
+
+    // 等待到期的周期插件(due)或被唤醒的插件(ready)，调度器停止时返回false
+    bool wait(std::vector<plugin_ptr> &due, std::vector<plugin_ptr> &ready) {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        while (!stop_) {
+            auto now = clock::now();
+
+            // 到期的周期插件，重新计算下一次到期时间
+            while (!timers_.empty() && timers_.top().deadline <= now) {
+                TimerItem item = timers_.top();
+                timers_.pop();
+
+                // 延后的唤醒按就绪处理，不影响周期调度
+                if (item.retry) {
+                    if (E_PLUGIN_RUNING == item.plugin->plugin_status()) {
+                        ready.push_back(item.plugin);
+                    }
+                    continue;
+                }
+
+                if (E_PLUGIN_RUNING != item.plugin->plugin_status()) {
+                    item.plugin->task_armed_ = false;
+                    continue;
+                }
+
+                due.push_back(item.plugin);
+                arm(item.plugin, item.deadline < now - max_lag()
+                                     ? now
+                                     : item.deadline);
+            }
+
+            // 就绪插件
+            for (auto &plugin : ready_) {
+                plugin->task_ready_ = false;
+                ready.push_back(plugin);
+            }
+            ready_.clear();
+
+            if (!due.empty() || !ready.empty()) {
+                return true;
+            }
+
+            if (timers_.empty()) {
+                cond_.wait(lck);
+            } else {
+                // 等待期间堆可能被修改，不能引用堆顶元素
+                clock::time_point deadline = timers_.top().deadline;
+                cond_.wait_until(lck, deadline);
+            }
+        }
+
+        return false;
+    }
+
+    // 停止调度器，唤醒等待的微内核循环
+    void stop(void) {
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            stop_ = true;
+        }
+
+        cond_.notify_all();
+    }
+
+    // 插件的调度周期(ms)，仅就绪调度的插件返回0
+    uint32_t period(const plugin_ptr &plugin) const {
+        uint32_t period = plugin->plugin_task_period();
+
+        if (E_PLUGIN_TASK_ON_READY == period) {
+            return 0;
+        }
+
+        return E_PLUGIN_TASK_PERIOD_DEFAULT == period ? default_period_
+                                                      : period;
+    }
+
+    // 调度项数量
+    size_t count(void) {
+        std::unique_lock<std::mutex> lck(mutex_);
+        return timers_.size() + ready_.size();
+    }
+
+private:
+    struct TimerItem {
+        clock::time_point deadline;  ///< 到期时间
+        uint64_t seq;                ///< 插入序号，到期时间相同时保持先后顺序
+        plugin_ptr plugin;           ///< 插件
+        bool retry;                  ///< 延后的唤醒，到期后按就绪处理
+
+        bool operator>(const TimerItem &item) const {
+            return deadline > item.deadline ||
+                   (deadline == item.deadline && seq > item.seq);
+        }
+    };
+
+    typedef std::priority_queue<TimerItem, std::vector<TimerItem>,
+                                std::greater<TimerItem>>
+        timer_queue;
+
+    // 落后超过该时间则从当前时间重新计算，避免积压后集中补调
+    clock::duration max_lag(void) const {
+        return std::chrono::milliseconds(default_period_);
+    }
+
+    // 按插件周期设置下一次到期时间，仅就绪调度的插件不加入定时器
+    bool arm(const plugin_ptr &plugin, clock::time_point base) {
+        uint32_t period = plugin->plugin_task_period();
+
+        if (E_PLUGIN_TASK_ON_READY == period) {
+            plugin->task_armed_ = false;
+            return false;
+        }
+
+        if (E_PLUGIN_TASK_PERIOD_DEFAULT == period) {
+            period = default_period_;
+        }
+
+        timers_.push(TimerItem{base + std::chrono::milliseconds(period),
+                               seq_++, plugin, false});
+        plugin->task_armed_ = true;
+
+        return true;
+    }
+
+private:
+    uint32_t default_period_;        ///< 默认调度周期(ms)
+    uint64_t seq_;                   ///< 定时器序号
+    timer_queue timers_;             ///< 周期插件的定时器
+    std::vector<plugin_ptr> ready_;  ///< 就绪插件
+    std::mutex mutex_;               ///< 调度器锁
+    std::condition_variable cond_;   ///< 调度条件变量
+    bool stop_;                      ///< 停止标记
+};
+
+}
@@ -0,0 +1,492 @@
+/**
+ * @file micro_shm_channel.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 跨进程的共享内存通道
+ * @date 2021-02-03
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+
+namespace Asty {
+
+/**
+ * @brief 通道帧头，负载紧跟在帧头之后
+ *
+ */
+struct MicroShmFrame {
+    uint32_t size;   ///< 帧头加负载的长度
+    uint32_t op;     ///< 操作码，由通道使用方定义
+    uint64_t seq;    ///< 请求序号，应答与请求相同，单向帧为0
+    int64_t key;     ///< 对端插件key
+    int64_t arg;     ///< 操作参数
+    int32_t type;    ///< 负载的数据类型
+    int32_t status;  ///< 应答结果
+};
+
+/**
+ * @brief 共享内存通道
+ * @details 创建方和打开方映射同一块POSIX共享内存，每个方向一个单生产者
+ * 单消费者的字节环，帧头和负载直接写入环中，不做序列化；同一进程内的
+ * 多个发送线程按锁串行，接收只能在一个线程中进行。等待通过共享内存上的
+ * futex完成，等待时按固定间隔检查通道是否关闭以及对端进程是否仍在运行，
+ * 对端崩溃后两端的等待都会返回失败
+ *
+ */
+class MicroShmChannel {
+public:
+    static const size_t kDefaultCapacity = 1 << 20;  ///< 每个方向的默认字节数
+
+    // 创建通道，同名的残留共享内存先删除，capacity为每个方向的字节数，
+    // 向上取整为2的幂，失败返回空
+    static std::shared_ptr<MicroShmChannel> create(
+        const std::string &name, size_t capacity = kDefaultCapacity) {
+        size_t cap = kMinCapacity;
+
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+
+        shm_unlink(name.c_str());
+
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        size_t size = sizeof(Header) + 2 * cap;
+        void *addr = MAP_FAILED;
+
+        if (0 == ftruncate(fd, size)) {
+            addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                        0);
+        }
+
+        ::close(fd);
+
+        if (MAP_FAILED == addr) {
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+
+        Header *header = new (addr) Header();
+
+        header->capacity = cap;
+        header->pid[0] = getpid();
+        header->magic.store(kMagic, std::memory_order_release);
+
+        return std::shared_ptr<MicroShmChannel>(
+            new MicroShmChannel(name, header, size, 0));
+    }
+
+    // 打开对端创建的通道，wait为等待对端创建的时间(us)，-1一直等待，
+    // 超时或通道格式不符返回空
+    static std::shared_ptr<MicroShmChannel> open(const std::string &name,
+                                                 int64_t wait = 0) {
+        clock::time_point deadline =
+            clock::now() + std::chrono::microseconds(wait > 0 ? wait : 0);
+
+        for (;;) {
+            std::shared_ptr<MicroShmChannel> channel = attach(name);
+
+            if (channel || !wait ||
+                (wait > 0 && clock::now() >= deadline)) {
+                return channel;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    ~MicroShmChannel() {
+        close();
+        munmap(header_, size_);
+
+        if (0 == side_) {
+            shm_unlink(name_.c_str());
+        }
+    }
+
+    MicroShmChannel(const MicroShmChannel &) = delete;
+    MicroShmChannel &operator=(const MicroShmChannel &) = delete;
+
+    // 通道名称
+    const std::string &name(void) const { return name_; }
+
+    // 单帧负载的最大长度
+    size_t max_payload(void) const {
+        return header_->capacity / 2 - sizeof(MicroShmFrame);
+    }
+
+    /**
+     * @brief 发送一帧，帧头和负载直接写入发送环
+     *
+     * @param frame 帧头，size由通道填写
+     * @param data 负载
+     * @param len 负载长度，超过max_payload时失败
+     * @param wait 发送环满时的等待时间(us)，-1一直等待
+     * @return true 已发送
+     * @return false 超时、通道关闭或对端退出
+     */
+    bool send(const MicroShmFrame &frame, const void *data, size_t len,
+              int64_t wait = -1) {
+        size_t need = align(sizeof(MicroShmFrame) + len);
+        size_t cap = header_->capacity;
+
+        if (len > max_payload()) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lck(tx_mutex_);
+
+        uint64_t tail = tx_->tail.load(std::memory_order_relaxed);
+        size_t room = cap - (tail & (cap - 1));
+        // 环尾放不下整帧时跳过到环首
+        size_t skip = room < need ? room : 0;
+
+        if (!wait_for(tx_->writable, tx_->writers, wait, [&] {
+                return cap - (tail - tx_->head.load()) >= skip + need;
+            })) {
+            return false;
+        }
+
+        // 跳过的空间能放下帧头时写入填充帧，否则由接收方自行跳过
+        if (skip >= sizeof(MicroShmFrame)) {
+            MicroShmFrame *pad = at(tx_data_, tail);
+
+            memset(pad, 0, sizeof(MicroShmFrame));
+            pad->size = skip;
+            pad->op = kPad;
+        }
+
+        MicroShmFrame *out = at(tx_data_, tail + skip);
+
+        *out = frame;
+        out->size = sizeof(MicroShmFrame) + len;
+        if (len) {
+            memcpy(out + 1, data, len);
+        }
+
+        tx_->tail.store(tail + skip + need);
+        signal(tx_->readable, tx_->readers);
+
+        return true;
+    }
+
+    /**
+     * @brief 接收一帧，只能在一个线程中调用
+     *
+     * @param wait 接收环空时的等待时间(us)，-1一直等待
+     * @return const MicroShmFrame* 帧在release前有效，负载紧跟帧头；
+     * 超时、通道关闭或对端退出返回空，关闭前已写入的帧仍可取出
+     */
+    const MicroShmFrame *recv(int64_t wait = -1) {
+        size_t cap = header_->capacity;
+
+        for (;;) {
+            uint64_t head = rx_->head.load(std::memory_order_relaxed);
+
+            if (!wait_for(rx_->readable, rx_->readers, wait,
+                          [&] { return rx_->tail.load() != head; })) {
+                return nullptr;
+            }
+
+            size_t room = cap - (head & (cap - 1));
+            MicroShmFrame *frame = at(rx_data_, head);
+
+            if (room < sizeof(MicroShmFrame) || kPad == frame->op) {
+                advance(head + room);
+                continue;
+            }
+
+            return frame;
+        }
+    }
+
+    // 释放recv取出的帧，腾出发送方的空间
+    void release(const MicroShmFrame *frame) {
+        advance(rx_->head.load(std::memory_order_relaxed) +
+                align(frame->size));
+    }
+
+    // 关闭通道，唤醒两端所有等待者
+    void close(void) {
+        if (header_->closed.exchange(1)) {
+            return;
+        }
+
+        for (Ring &ring : header_->ring) {
+            ring.readable++;
+            ring.writable++;
+            futex_wake(ring.readable, INT_MAX);
+            futex_wake(ring.writable, INT_MAX);
+        }
+    }
+
+    // 任一端是否已关闭通道
+    bool closed(void) const { return 0 != header_->closed.load(); }
+
+    // 对端是否已打开通道
+    bool connected(void) const { return 0 != header_->pid[1 - side_].load(); }
+
+    // 对端进程是否仍在运行，对端尚未打开通道时视为运行
+    bool peer_alive(void) const {
+        pid_t pid = header_->pid[1 - side_].load();
+
+        if (!pid) {
+            return true;
+        }
+
+        if (0 != kill(pid, 0) && ESRCH == errno) {
+            return false;
+        }
+
+        return !zombie(pid);
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    static const uint32_t kMagic = 0x4d534843;  ///< 通道标识
+    static const uint32_t kPad = UINT32_MAX;    ///< 填充帧操作码
+    static const size_t kMinCapacity = 4096;    ///< 每个方向的最小字节数
+    static const int kSpinCount = 64;           ///< 休眠前的自旋次数
+    static const int64_t kLiveCheckUs = 50000;  ///< 检查对端存活的间隔(us)
+
+    /**
+     * @brief 单方向的字节环，读写位置单调递增，按缓存行隔开
+     *
+     */
+    struct Ring {
+        Ring()
+            : head(0),
+              tail(0),
+              readable(0),
+              readers(0),
+              writable(0),
+              writers(0) {}
+
+        alignas(64) std::atomic<uint64_t> head;      ///< 消费者读位置
+        alignas(64) std::atomic<uint64_t> tail;      ///< 生产者写位置
+        alignas(64) std::atomic<uint32_t> readable;  ///< 每次写入后加一
+        std::atomic<uint32_t> readers;               ///< 等待读的线程数
+        std::atomic<uint32_t> writable;              ///< 每次释放后加一
+        std::atomic<uint32_t> writers;               ///< 等待写的线程数
+    };
+
+    /**
+     * @brief 共享内存头部，两个方向的环数据紧随其后
+     *
+     */
+    struct Header {
+        Header() : magic(0), capacity(0), closed(0) {
+            pid[0] = 0;
+            pid[1] = 0;
+        }
+
+        std::atomic<uint32_t> magic;   ///< 初始化完成后写入通道标识
+        uint64_t capacity;             ///< 每个方向的字节数
+        std::atomic<pid_t> pid[2];     ///< 创建方和打开方的进程号
+        std::atomic<uint32_t> closed;  ///< 关闭标记
+        Ring ring[2];                  ///< 0为创建方发送方向
+    };
+
+    MicroShmChannel(const std::string &name, Header *header, size_t size,
+                    int side)
+        : name_(name),
+          header_(header),
+          size_(size),
+          side_(side),
+          tx_(&header->ring[side]),
+          rx_(&header->ring[1 - side]) {
+        char *data = reinterpret_cast<char *>(header + 1);
+
+        tx_data_ = data + side * header->capacity;
+        rx_data_ = data + (1 - side) * header->capacity;
+    }
+
+    // 映射已创建完成的通道并登记为打开方
+    static std::shared_ptr<MicroShmChannel> attach(const std::string &name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        struct stat st;
+
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        void *addr = MAP_FAILED;
+        size_t size = 0;
+
+        if (0 == fstat(fd, &st) && (size_t)st.st_size > sizeof(Header)) {
+            size = st.st_size;
+            addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                        0);
+        }
+
+        ::close(fd);
+
+        if (MAP_FAILED == addr) {
+            return nullptr;
+        }
+
+        Header *header = static_cast<Header *>(addr);
+
+        if (kMagic != header->magic.load(std::memory_order_acquire) ||
+            size != sizeof(Header) + 2 * header->capacity) {
+            munmap(addr, size);
+            return nullptr;
+        }
+
+        header->pid[1] = getpid();
+
+        return std::shared_ptr<MicroShmChannel>(
+            new MicroShmChannel(name, header, size, 1));
+    }
+
+    static size_t align(size_t size) { return (size + 7) & ~(size_t)7; }
+
+    MicroShmFrame *at(char *data, uint64_t pos) const {
+        return reinterpret_cast<MicroShmFrame *>(
+            data + (pos & (header_->capacity - 1)));
+    }
+
+    // 移动读位置并唤醒等待空间的发送方
+    void advance(uint64_t head) {
+        rx_->head.store(head);
+        signal(rx_->writable, rx_->writers);
+    }
+
+    // 条件变化后增加事件计数，有等待者时唤醒
+    static void signal(std::atomic<uint32_t> &word,
+                       std::atomic<uint32_t> &waiters) {
+        word++;
+        if (waiters.load()) {
+            futex_wake(word, INT_MAX);
+        }
+    }
+
+    // 先自旋再按检查间隔休眠等待条件满足，超时、关闭或对端退出返回false
+    template <typename Pred>
+    bool wait_for(std::atomic<uint32_t> &word, std::atomic<uint32_t> &waiters,
+                  int64_t wait, Pred pred) {
+        clock::time_point deadline =
+            clock::now() + std::chrono::microseconds(wait > 0 ? wait : 0);
+
+        for (int i = 0; i < kSpinCount; i++) {
+            if (pred()) {
+                return true;
+            }
+            if (!wait) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+
+        for (;;) {
+            uint32_t seq = word.load();
+
+            if (pred()) {
+                return true;
+            }
+
+            if (closed() || !peer_alive()) {
+                return false;
+            }
+
+            int64_t slice = kLiveCheckUs;
+
+            if (wait > 0) {
+                int64_t left = std::chrono::duration_cast<
+                                   std::chrono::microseconds>(deadline -
+                                                              clock::now())
+                                   .count();
+
+                if (left <= 0) {
+                    return false;
+                }
+                slice = std::min(slice, left);
+            }
+
+            waiters++;
+            futex_wait(word, seq, slice);
+            waiters--;
+        }
+    }
+
+    // 共享内存上的futex不能使用进程私有标记
+    static void futex_wait(std::atomic<uint32_t> &word, uint32_t seq,
+                           int64_t us) {
+        struct timespec ts;
+
+        ts.tv_sec = us / 1000000;
+        ts.tv_nsec = (us % 1000000) * 1000;
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT,
+                seq, &ts, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<uint32_t> &word, int cnt) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE,
+                cnt, nullptr, nullptr, 0);
+    }
+
+    // 已退出但未被回收的进程仍能收到信号0，需按进程状态判断
+    static bool zombie(pid_t pid) {
+        char path[64];
+        char stat[256];
+
+        snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+        FILE *fp = fopen(path, "r");
+
+        if (!fp) {
+            return false;
+        }
+
+        size_t n = fread(stat, 1, sizeof(stat) - 1, fp);
+
+        fclose(fp);
+        stat[n] = '\0';
+
+        const char *state = strrchr(stat, ')');
+
+        return state && ' ' == state[1] && 'Z' == state[2];
+    }
+
+private:
+    std::string name_;     ///< 共享内存名称
+    Header *header_;       ///< 映射的共享内存
+    size_t size_;          ///< 映射长度
+    int side_;             ///< 0为创建方，1为打开方
+    Ring *tx_;             ///< 发送环
+    Ring *rx_;             ///< 接收环
+    char *tx_data_;        ///< 发送环数据
+    char *rx_data_;        ///< 接收环数据
+    std::mutex tx_mutex_;  ///< 发送锁，串行本进程内的发送线程
+};
+
+}
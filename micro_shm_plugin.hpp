@@ -0,0 +1,915 @@
+/**
+ * @file micro_shm_plugin.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 在独立进程中运行的插件，通过共享内存通道与微内核通信
+ * @date 2021-02-03
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "micro_kernel.hpp"
+#include "micro_plugin_stream.hpp"
+#include "micro_reactor.hpp"
+#include "micro_shm_channel.hpp"
+#include "micro_timer_wheel.hpp"
+#include "plugin.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 共享内存通道上的操作码
+ *
+ */
+typedef enum : uint32_t {
+    E_SHM_OP_REPLY = 0,          ///< 应答，seq与请求相同
+    E_SHM_OP_INIT = 1,           ///< 初始化
+    E_SHM_OP_START = 2,          ///< 启动，应答type为是否使能任务，arg为周期
+    E_SHM_OP_TASK = 3,           ///< 插件任务
+    E_SHM_OP_STOP = 4,           ///< 停止
+    E_SHM_OP_EXIT = 5,           ///< 退出
+    E_SHM_OP_NOTICE = 6,         ///< 通知，单向
+    E_SHM_OP_MESSAGE = 7,        ///< 消息，key为源插件
+    E_SHM_OP_STREAM_OPEN = 8,    ///< 打开流，key为源插件，arg为流标识
+    E_SHM_OP_STREAM_DATA = 9,    ///< 流数据，单向，arg为流标识
+    E_SHM_OP_STREAM_CLOSE = 10,  ///< 关闭流，单向，arg为流标识
+    E_SHM_OP_DISPATCH = 11,      ///< 宿主进程分发消息，key为目的插件
+    E_SHM_OP_WAKEUP = 12,        ///< 宿主进程唤醒插件任务，单向
+    E_SHM_OP_SUBSCRIBE = 13,     ///< 宿主进程订阅主题，单向，arg为主题
+    E_SHM_OP_UNSUBSCRIBE = 14,   ///< 宿主进程取消订阅，单向，arg为主题
+    E_SHM_OP_LOG = 15,           ///< 宿主进程日志，单向，arg为级别
+} micro_shm_op;
+
+/**
+ * @brief 共享内存通道的一端
+ * @details 负责请求与应答的配对和流的桥接，接收线程把每帧的负载复制到
+ * 引用计数缓冲区后立即释放通道空间，应答交给等待的调用方，流数据写入
+ * 本端的流，其余帧交给handle处理。支持就绪事件的本端流由一个反应器线程
+ * 统一转发给对端，其他流各用一个线程转发。流的本端写满时接收线程会等待，
+ * 期间不处理其他帧
+ *
+ * @tparam T 插件Key的类型，需能与整数相互转换
+ */
+template <typename T>
+class MicroShmPeer {
+protected:
+    // timeout为调用等待应答的时间(ms)，0表示一直等到对端应答或退出
+    MicroShmPeer(const std::shared_ptr<MicroShmChannel> &channel,
+                 uint32_t timeout)
+        : channel_(channel),
+          timeout_(timeout),
+          seq_(0),
+          dead_(false),
+          stopping_(false),
+          bridge_id_(0) {}
+
+    virtual ~MicroShmPeer() {
+        stopping_ = true;
+        channel_->close();
+        reactor_.stop();
+
+        std::map<uint32_t, std::shared_ptr<Bridge>> bridges;
+
+        {
+            std::lock_guard<std::mutex> lck(bridge_mtx_);
+            bridges.swap(bridges_);
+        }
+
+        for (auto &item : bridges) {
+            item.second->stream->close();
+            if (item.second->pump.joinable()) {
+                item.second->pump.join();
+            }
+        }
+    }
+
+    // 处理应答和流数据以外的帧，在接收线程中执行，不得阻塞
+    virtual void handle(const MicroShmFrame &frame,
+                        const PluginDataT &data) = 0;
+
+    // 接收并处理帧，直到通道关闭或对端退出，之后所有调用立即失败
+    void serve(void) {
+        while (!channel_->closed() && channel_->peer_alive()) {
+            poll(kPollUs);
+        }
+
+        // 关闭前已写入的帧仍需处理
+        while (poll(0)) {
+        }
+
+        std::lock_guard<std::mutex> lck(call_mtx_);
+
+        dead_ = true;
+        for (auto &item : pending_) {
+            item.second->cond.notify_one();
+        }
+    }
+
+    // 关闭通道，serve随后返回
+    void shutdown(void) { channel_->close(); }
+
+    // 对端是否已关闭或退出
+    bool dead(void) const { return dead_; }
+
+    // 发送单向帧
+    bool post(micro_shm_op op, int64_t key, int64_t arg,
+              const PluginDataT *data) {
+        MicroShmFrame frame{};
+
+        frame.op = op;
+        frame.key = key;
+        frame.arg = arg;
+
+        return send(frame, data);
+    }
+
+    /**
+     * @brief 发送请求并等待应答
+     *
+     * @param frame 请求帧头，返回时为应答帧头
+     * @param data 请求数据，可为空
+     * @param response 应答数据，可为空
+     * @return true 收到应答
+     * @return false 发送失败、超时或对端退出
+     */
+    bool call(MicroShmFrame &frame, const PluginDataT *data,
+              PluginDataT *response) {
+        Pending pending;
+
+        return request(frame, data, pending) &&
+               finish(frame, pending, response);
+    }
+
+    /**
+     * @brief 等待应答的调用
+     *
+     */
+    struct Pending {
+        Pending() : done(false) {}
+
+        bool done;                     ///< 已收到应答
+        uint64_t seq;                  ///< 请求序号
+        MicroShmFrame frame;           ///< 应答帧头
+        PluginDataT data;              ///< 应答数据
+        std::condition_variable cond;  ///< 应答条件变量
+    };
+
+    // 登记并发送请求，发送失败时撤销登记；成功后需调用finish
+    bool request(MicroShmFrame &frame, const PluginDataT *data,
+                 Pending &pending) {
+        {
+            std::lock_guard<std::mutex> lck(call_mtx_);
+
+            if (dead_) {
+                return false;
+            }
+
+            frame.seq = ++seq_;
+            pending.seq = frame.seq;
+            pending_[frame.seq] = &pending;
+        }
+
+        if (!send(frame, data)) {
+            std::lock_guard<std::mutex> lck(call_mtx_);
+            pending_.erase(frame.seq);
+            return false;
+        }
+
+        return true;
+    }
+
+    // 等待应答，frame返回应答帧头
+    bool finish(MicroShmFrame &frame, Pending &pending,
+                PluginDataT *response) {
+        std::unique_lock<std::mutex> lck(call_mtx_);
+        auto done = [&] { return pending.done || dead_; };
+
+        if (timeout_) {
+            pending.cond.wait_for(lck, std::chrono::milliseconds(timeout_),
+                                  done);
+        } else {
+            pending.cond.wait(lck, done);
+        }
+
+        pending_.erase(pending.seq);
+
+        if (!pending.done) {
+            return false;
+        }
+
+        frame = pending.frame;
+        if (response) {
+            *response = pending.data;
+        }
+
+        return true;
+    }
+
+    // 应答请求，data的type随应答返回
+    bool reply(const MicroShmFrame &request, int32_t status, int64_t arg,
+               const PluginDataT *data) {
+        MicroShmFrame frame{};
+
+        frame.op = E_SHM_OP_REPLY;
+        frame.seq = request.seq;
+        frame.arg = arg;
+        frame.status = status;
+
+        return send(frame, data);
+    }
+
+    // 桥接本端的流，id为0时分配新的标识，返回流标识；start为false时
+    // 只登记，由bridge_start开始向对端转发
+    uint32_t bridge_open(const std::shared_ptr<IPluginStream<T>> &stream,
+                         uint32_t id = 0, bool start = true) {
+        std::shared_ptr<Bridge> bridge(new Bridge(stream));
+        std::vector<std::shared_ptr<Bridge>> finished;
+
+        {
+            std::lock_guard<std::mutex> lck(bridge_mtx_);
+
+            // 回收已结束的桥接
+            for (auto it = bridges_.begin(); it != bridges_.end();) {
+                if (it->second->done) {
+                    finished.push_back(it->second);
+                    it = bridges_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            if (!id) {
+                id = ++bridge_id_;
+            }
+
+            bridges_[id] = bridge;
+            if (start) {
+                forward(id, bridge);
+            }
+        }
+
+        for (auto &item : finished) {
+            if (item->pump.joinable()) {
+                item->pump.join();
+            }
+        }
+
+        return id;
+    }
+
+    // 开始向对端转发登记的流
+    void bridge_start(uint32_t id) {
+        std::lock_guard<std::mutex> lck(bridge_mtx_);
+        auto it = bridges_.find(id);
+
+        if (it != bridges_.end() && !it->second->started) {
+            forward(id, it->second);
+        }
+    }
+
+    // 关闭桥接的流，桥接线程随后通知对端并结束
+    void bridge_close(uint32_t id) {
+        std::shared_ptr<Bridge> bridge = find_bridge(id);
+
+        if (bridge) {
+            bridge->stream->close();
+        }
+    }
+
+    static int64_t to_key(const T &key) { return static_cast<int64_t>(key); }
+
+    static T from_key(int64_t key) { return static_cast<T>(key); }
+
+private:
+    static const int64_t kPollUs = 50000;  ///< 接收和流读取的检查间隔(us)
+    static const int kStreamBatch = 16;    ///< 流每次读取的数据个数
+
+    /**
+     * @brief 桥接的流
+     *
+     */
+    struct Bridge {
+        Bridge(const std::shared_ptr<IPluginStream<T>> &stream)
+            : stream(stream), started(false), done(false) {}
+
+        std::shared_ptr<IPluginStream<T>> stream;  ///< 本端的流
+        bool started;                              ///< 已开始转发
+        std::thread pump;                          ///< 不支持就绪事件时的转发线程
+        std::atomic_bool done;                     ///< 转发已结束
+    };
+
+    bool send(const MicroShmFrame &frame, const PluginDataT *data) {
+        MicroShmFrame out = frame;
+
+        if (!data) {
+            return channel_->send(out, nullptr, 0);
+        }
+
+        out.type = data->type;
+        return channel_->send(out, data->data, data->len > 0 ? data->len : 0);
+    }
+
+    // 接收一帧并处理，没有帧返回false
+    bool poll(int64_t wait) {
+        const MicroShmFrame *in = channel_->recv(wait);
+
+        if (!in) {
+            return false;
+        }
+
+        MicroShmFrame frame = *in;
+        PluginDataT data{};
+        int len = (int)(frame.size - sizeof(MicroShmFrame));
+
+        // 负载复制到缓冲区后立即释放通道空间，处理方可以持有数据
+        if (len > 0) {
+            data.set_buffer(MicroBufferPool::instance().alloc(len), len);
+            memcpy(data.data, in + 1, len);
+        }
+        data.type = frame.type;
+        channel_->release(in);
+
+        switch (frame.op) {
+            case E_SHM_OP_REPLY:
+                complete(frame, data);
+                break;
+            case E_SHM_OP_STREAM_DATA:
+                if (std::shared_ptr<Bridge> bridge = find_bridge(frame.arg)) {
+                    bridge->stream->send(data);
+                }
+                break;
+            case E_SHM_OP_STREAM_CLOSE:
+                bridge_close(frame.arg);
+                break;
+            default:
+                handle(frame, data);
+                break;
+        }
+
+        return true;
+    }
+
+    // 应答交给等待的调用，调用已超时放弃时丢弃
+    void complete(const MicroShmFrame &frame, const PluginDataT &data) {
+        std::lock_guard<std::mutex> lck(call_mtx_);
+        auto it = pending_.find(frame.seq);
+
+        if (it == pending_.end()) {
+            return;
+        }
+
+        it->second->frame = frame;
+        it->second->data = data;
+        it->second->done = true;
+        it->second->cond.notify_one();
+    }
+
+    std::shared_ptr<Bridge> find_bridge(int64_t id) {
+        std::lock_guard<std::mutex> lck(bridge_mtx_);
+        auto it = bridges_.find((uint32_t)id);
+
+        return it == bridges_.end() ? nullptr : it->second;
+    }
+
+    // 开始转发本端的流，持有桥接表锁时调用
+    void forward(uint32_t id, const std::shared_ptr<Bridge> &bridge) {
+        int fd = bridge->stream->event_fd();
+
+        bridge->started = true;
+
+        if (fd < 0 || !reactor_.add(fd, [this, id, bridge](uint64_t watch) {
+                drain(id, bridge, watch);
+            })) {
+            bridge->pump = std::thread(&MicroShmPeer::pump, this, id, bridge);
+        }
+    }
+
+    // 就绪时在反应器线程中取完本端的流发往对端，本端关闭后通知对端关闭
+    void drain(uint32_t id, const std::shared_ptr<Bridge> &bridge,
+               uint64_t watch) {
+        PluginDataT batch[kStreamBatch];
+
+        bridge->stream->event_clear();
+
+        for (;;) {
+            int n = bridge->stream->recv(batch, kStreamBatch, 0);
+
+            if (n < 0) {
+                reactor_.remove(watch);
+                post(E_SHM_OP_STREAM_CLOSE, 0, id, nullptr);
+                bridge->done = true;
+                return;
+            }
+
+            if (!n) {
+                return;
+            }
+
+            for (int i = 0; i < n; i++) {
+                if (!post(E_SHM_OP_STREAM_DATA, 0, id, &batch[i])) {
+                    bridge->stream->close();
+                }
+                batch[i] = PluginDataT{};
+            }
+        }
+    }
+
+    // 转发线程，按检查间隔等待本端的流，本端关闭后通知对端关闭
+    void pump(uint32_t id, std::shared_ptr<Bridge> bridge) {
+        PluginDataT batch[kStreamBatch];
+
+        while (!stopping_) {
+            int n = bridge->stream->recv(batch, kStreamBatch, kPollUs);
+
+            if (n < 0) {
+                break;
+            }
+
+            for (int i = 0; i < n; i++) {
+                if (!post(E_SHM_OP_STREAM_DATA, 0, id, &batch[i])) {
+                    bridge->stream->close();
+                }
+                batch[i] = PluginDataT{};
+            }
+        }
+
+        post(E_SHM_OP_STREAM_CLOSE, 0, id, nullptr);
+        bridge->done = true;
+    }
+
+private:
+    std::shared_ptr<MicroShmChannel> channel_;  ///< 共享内存通道
+    uint32_t timeout_;                          ///< 调用等待应答的时间(ms)
+    uint64_t seq_;                              ///< 请求序号
+    std::map<uint64_t, Pending *> pending_;     ///< 等待应答的调用
+    std::mutex call_mtx_;                       ///< 调用表锁
+    std::atomic_bool dead_;                     ///< 对端已关闭或退出
+    std::atomic_bool stopping_;                 ///< 本端正在析构
+    uint32_t bridge_id_;                        ///< 最近分配的流标识
+    std::map<uint32_t, std::shared_ptr<Bridge>> bridges_;  ///< 桥接的流
+    std::mutex bridge_mtx_;                                ///< 桥接表锁
+    MicroReactor reactor_;  ///< 转发支持就绪事件的流，先于桥接表析构
+};
+
+/**
+ * @brief 共享内存插件代理，注册到微内核
+ * @details 插件的初始化、启动、任务、停止、退出、消息和流打开都转发到宿主
+ * 进程并等待应答，通知单向发送；插件任务是否使能和调度周期在启动应答中
+ * 取回后缓存，优先级、放置和依赖等注册时读取的属性由代理自身决定，
+ * 需要时可继承代理重写。宿主进程退出后代理进入异常状态，之后的调用
+ * 立即失败，微内核不再调度该插件
+ *
+ * @tparam T 插件Key的类型，需能与整数相互转换
+ */
+template <typename T>
+class MicroShmPluginProxy : public IPlugin<T>, private MicroShmPeer<T> {
+public:
+    MicroShmPluginProxy(const PluginKey<T> &key,
+                        const std::shared_ptr<MicroShmChannel> &channel,
+                        uint32_t timeout = 0)
+        : IPlugin<T>(key),
+          MicroShmPeer<T>(channel, timeout),
+          task_en_(false),
+          task_period_(E_PLUGIN_TASK_ON_READY),
+          closing_(false) {
+        receiver_ = std::thread(&MicroShmPluginProxy::receive, this);
+    }
+
+    // 接收线程要调用本类的handle，先于基类结束
+    virtual ~MicroShmPluginProxy() {
+        closing_ = true;
+        this->shutdown();
+        receiver_.join();
+    }
+
+    virtual bool plugin_init(void) override { return invoke(E_SHM_OP_INIT); }
+
+    virtual bool plugin_start(void) override {
+        MicroShmFrame frame{};
+        PluginDataT info{};
+
+        frame.op = E_SHM_OP_START;
+        if (!this->call(frame, nullptr, &info) || !frame.status) {
+            return false;
+        }
+
+        task_period_ = (uint32_t)frame.arg;
+        task_en_ = 0 != info.type;
+
+        return true;
+    }
+
+    virtual bool plugin_task(void) override { return invoke(E_SHM_OP_TASK); }
+
+    virtual bool plugin_task_en(void) override { return task_en_; }
+
+    virtual uint32_t plugin_task_period(void) override {
+        return task_period_;
+    }
+
+    virtual bool plugin_stop(void) override { return invoke(E_SHM_OP_STOP); }
+
+    virtual bool plugin_exit(void) override { return invoke(E_SHM_OP_EXIT); }
+
+    virtual bool notice(const PluginDataT &msg) override {
+        return this->post(E_SHM_OP_NOTICE, 0, 0, &msg);
+    }
+
+    virtual bool message(const PluginMessage<T> &request,
+                         PluginMessage<T> &response) override {
+        MicroShmFrame frame{};
+
+        frame.op = E_SHM_OP_MESSAGE;
+        frame.key = this->to_key(request.from.key);
+
+        return this->call(frame, &request.data, &response.data) &&
+               frame.status;
+    }
+
+    // 流在宿主进程中由一对进程内流的一端交给插件，两个进程各有一个线程
+    // 在本端的流和通道之间转发数据
+    virtual bool stream(std::shared_ptr<IPluginStream<T>> stream) override {
+        MicroShmFrame frame{};
+
+        if (!stream) {
+            return false;
+        }
+
+        typename MicroShmPeer<T>::Pending pending;
+        uint32_t id = this->bridge_open(stream, 0, false);
+
+        frame.op = E_SHM_OP_STREAM_OPEN;
+        frame.key = this->to_key(stream->from_.key);
+        frame.arg = id;
+
+        // 打开请求先于流数据进入通道，宿主进程按顺序登记后才收到数据；
+        // 插件处理流时可能等待数据，转发在等待应答前开始
+        bool sent = this->request(frame, nullptr, pending);
+
+        this->bridge_start(id);
+
+        if (!sent || !this->finish(frame, pending, nullptr) ||
+            !frame.status) {
+            this->bridge_close(id);
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    // 无数据的请求，返回宿主进程中插件接口的结果
+    bool invoke(micro_shm_op op) {
+        MicroShmFrame frame{};
+
+        frame.op = op;
+
+        return this->call(frame, nullptr, nullptr) && frame.status;
+    }
+
+    // 处理宿主进程发起的服务调用，分发消息在线程池中执行
+    virtual void handle(const MicroShmFrame &frame,
+                        const PluginDataT &data) override {
+        IMicroKernelServices<T> *srv = this->get_micro_kernel_service();
+
+        if (!srv) {
+            return;
+        }
+
+        switch (frame.op) {
+            case E_SHM_OP_DISPATCH:
+                // 异步分发，完成时应答，请求数据由回调持有到完成
+                srv->message_dispatch_async(
+                    this->plugin_key(), this->from_key(frame.key), data,
+                    [this, frame, data](plugin_call_status st,
+                                        const PluginDataT &response) {
+                        this->reply(frame, E_PLUGIN_CALL_DONE == st, 0,
+                                    &response);
+                    });
+                break;
+            case E_SHM_OP_WAKEUP:
+                srv->plugin_wakeup(this->plugin_key().key);
+                break;
+            case E_SHM_OP_SUBSCRIBE:
+                srv->subscribe(this->plugin_key().key, (uint32_t)frame.arg);
+                break;
+            case E_SHM_OP_UNSUBSCRIBE:
+                srv->unsubscribe(this->plugin_key().key, (uint32_t)frame.arg);
+                break;
+            case E_SHM_OP_LOG:
+                srv->log((micro_log_level)frame.arg, "%.*s", data.len,
+                         (const char *)data.data);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // 接收线程，宿主进程退出后插件进入异常状态
+    void receive(void) {
+        this->serve();
+
+        if (closing_) {
+            return;
+        }
+
+        this->set_plugin_status(E_PLUGIN_BAD);
+
+        IMicroKernelServices<T> *srv = this->get_micro_kernel_service();
+
+        if (srv) {
+            srv->log(E_LOG_ERROR,
+                     "plugin : [name = %s] [version = %s] host exited",
+                     this->plugin_key().name.c_str(),
+                     this->plugin_key().version.c_str());
+        }
+    }
+
+private:
+    std::atomic_bool task_en_;           ///< 启动应答中的任务使能
+    std::atomic<uint32_t> task_period_;  ///< 启动应答中的调度周期
+    std::atomic_bool closing_;           ///< 代理正在析构
+    std::thread receiver_;               ///< 接收线程
+};
+
+/**
+ * @brief 共享内存插件宿主，在插件进程中运行
+ * @details 宿主接收代理转发的调用，在线程池中执行插件接口并应答，同时作为
+ * 插件的微内核服务：消息分发、唤醒、订阅和日志转发给微内核，缓冲区和
+ * 任务和定时器使用本进程的缓冲区池、线程池和时间轮；宿主进程中没有
+ * 其他插件，异步分发、流分发、发布和指标查询不可用
+ *
+ * @tparam T 插件Key的类型，需能与整数相互转换
+ */
+template <typename T>
+class MicroShmPluginHost : public IMicroKernelServices<T>,
+                           private MicroShmPeer<T> {
+public:
+    MicroShmPluginHost(const std::shared_ptr<MicroShmChannel> &channel,
+                       const std::shared_ptr<IPlugin<T>> &plugin,
+                       const std::shared_ptr<IThreadPool> &thread_pool,
+                       uint32_t timeout = 0)
+        : MicroShmPeer<T>(channel, timeout),
+          plugin_(plugin),
+          thread_pool_(thread_pool),
+          timers_(thread_pool) {
+        plugin_->set_micro_kernel_srv(this);
+    }
+
+    // 处理代理转发的调用，直到通道关闭或微内核进程退出，之后定时器不再执行；
+    // 返回后线程池中可能仍有执行中的插件接口，析构宿主前需先停止线程池
+    void run(void) {
+        this->serve();
+        timers_.stop();
+    }
+
+    virtual std::string micro_kernel_version(void) override {
+        return MICRO_KERNEL_VERSION;
+    }
+
+    // 宿主进程中只有一个插件
+    virtual uint32_t plugin_cnt(void) override { return 1; }
+
+    virtual bool plugin_key(const T &key, PluginKey<T> &item_key) override {
+        if (!(key == plugin_->plugin_key().key)) {
+            return false;
+        }
+
+        item_key = plugin_->plugin_key();
+        return true;
+    }
+
+    // 转发给微内核分发，应答数据复制到本进程的缓冲区
+    virtual bool message_dispatch(const PluginKey<T> &from, const T &to_key,
+                                  const PluginDataT &request,
+                                  PluginDataT &response) override {
+        MicroShmFrame frame{};
+
+        frame.op = E_SHM_OP_DISPATCH;
+        frame.key = this->to_key(to_key);
+
+        return this->call(frame, &request, &response) && frame.status;
+    }
+
+    virtual std::shared_ptr<PluginCall> message_dispatch_async(
+        const PluginKey<T> &from, const T &to_key, const PluginDataT &request,
+        const plugin_call_cb_t &cb = nullptr, uint32_t timeout = 0) override {
+        return nullptr;
+    }
+
+    virtual bool stream_dispatch(
+        std::shared_ptr<IPluginStream<T>> stream) override {
+        return false;
+    }
+
+    virtual std::shared_ptr<IPluginStream<T>> stream_open(
+        const PluginKey<T> &from, const T &to_key,
+        size_t capacity = 64) override {
+        return nullptr;
+    }
+
+    virtual bool plugin_wakeup(const T &key) override {
+        return key == plugin_->plugin_key().key &&
+               this->post(E_SHM_OP_WAKEUP, 0, 0, nullptr);
+    }
+
+    virtual bool plugin_reschedule(const T &key) override { return false; }
+
+    virtual bool plugin_task_stat(const T &key,
+                                  PluginTaskStat &stat) override {
+        return false;
+    }
+
+    virtual void task_post(const std::function<void(void)> &task) override {
+        thread_pool_->add_task_for(thread_task_t(task), -1);
+    }
+
+    virtual void task_post_at(std::chrono::steady_clock::time_point when,
+                              const std::function<void(void)> &task) override {
+        timers_.add_at(when, 0, task);
+    }
+
+    virtual uint64_t timer_add(uint32_t delay, uint32_t period,
+                               const std::function<void(void)> &cb) override {
+        return timers_.add(delay, period, cb);
+    }
+
+    virtual bool timer_cancel(uint64_t id) override {
+        return timers_.cancel(id);
+    }
+
+    virtual uint64_t fd_watch(int fd,
+                              const std::function<void(void)> &cb) override {
+        return 0;
+    }
+
+    virtual void fd_unwatch(uint64_t id) override {}
+
+    virtual bool subscribe(const T &key, uint32_t topic) override {
+        return key == plugin_->plugin_key().key &&
+               this->post(E_SHM_OP_SUBSCRIBE, 0, topic, nullptr);
+    }
+
+    virtual bool unsubscribe(const T &key, uint32_t topic) override {
+        return key == plugin_->plugin_key().key &&
+               this->post(E_SHM_OP_UNSUBSCRIBE, 0, topic, nullptr);
+    }
+
+    virtual int publish(uint32_t topic, const PluginDataT &msg) override {
+        return 0;
+    }
+
+    virtual bool plugin_metrics(const T &key,
+                                PluginMetricsStat &stat) override {
+        return false;
+    }
+
+    virtual bool thread_pool_stat(ThreadPoolStat &stat) override {
+        return thread_pool_->stat(stat);
+    }
+
+    virtual std::string metrics_dump(bool json = false) override {
+        return std::string();
+    }
+
+    virtual PluginBuffer buffer_alloc(size_t size) override {
+        return MicroBufferPool::instance().alloc(size);
+    }
+
+    virtual void buffer_stat(std::vector<PluginBufferStat> &stat) override {
+        MicroBufferPool::instance().stat(stat);
+    }
+
+    virtual void log(const std::string &message) override {
+        log(E_LOG_INFO, "%s", message.c_str());
+    }
+
+    // 格式化后转发给微内核的日志
+    virtual void log(micro_log_level level, const char *fmt, ...) override
+        __attribute__((format(printf, 3, 4))) {
+        char buf[kLogSize];
+        PluginDataT data{};
+        va_list ap;
+
+        va_start(ap, fmt);
+        int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+
+        if (len < 0) {
+            return;
+        }
+
+        data.data = buf;
+        data.len = len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1;
+        this->post(E_SHM_OP_LOG, 0, level, &data);
+    }
+
+private:
+    static const size_t kLogSize = 256;  ///< 单条日志的最大长度
+
+    // 插件接口在线程池中执行，流打开时先在接收线程中登记桥接，
+    // 保证随后到达的流数据能找到本端的流
+    virtual void handle(const MicroShmFrame &frame,
+                        const PluginDataT &data) override {
+        std::shared_ptr<IPluginStream<T>> remote;
+
+        if (E_SHM_OP_STREAM_OPEN == frame.op) {
+            PluginKey<T> from;
+
+            from.key = this->from_key(frame.key);
+
+            auto local = MicroPluginStream<T>::create(from,
+                                                      plugin_->plugin_key());
+
+            remote = local->remote();
+            this->bridge_open(local, (uint32_t)frame.arg);
+        }
+
+        thread_pool_->add_task_for(
+            thread_task_t([this, frame, data, remote] {
+                execute(frame, data, remote);
+            }),
+            -1);
+    }
+
+    // 执行插件接口并应答，通知不应答
+    void execute(const MicroShmFrame &frame, const PluginDataT &data,
+                 const std::shared_ptr<IPluginStream<T>> &remote) {
+        PluginDataT info{};
+        int64_t arg = 0;
+        bool ok = false;
+
+        switch (frame.op) {
+            case E_SHM_OP_INIT:
+                ok = plugin_->plugin_init();
+                break;
+            case E_SHM_OP_START:
+                ok = plugin_->plugin_start();
+                if (ok) {
+                    plugin_->set_plugin_status(E_PLUGIN_RUNING);
+                    info.type = plugin_->plugin_task_en();
+                    arg = plugin_->plugin_task_period();
+                }
+                break;
+            case E_SHM_OP_TASK:
+                ok = plugin_->plugin_task();
+                break;
+            case E_SHM_OP_STOP:
+                ok = plugin_->plugin_stop();
+                break;
+            case E_SHM_OP_EXIT:
+                plugin_->set_plugin_status(E_PLUGIN_STOP);
+                ok = plugin_->plugin_exit();
+                plugin_->plugin_detach();
+                break;
+            case E_SHM_OP_NOTICE:
+                plugin_->notice(data);
+                return;
+            case E_SHM_OP_MESSAGE: {
+                PluginMessage<T> request{};
+                PluginMessage<T> response{};
+
+                request.from.key = this->from_key(frame.key);
+                request.to = plugin_->plugin_key();
+                request.data = data;
+                response.from = request.to;
+                response.to = request.from;
+
+                ok = plugin_->message(request, response);
+                this->reply(frame, ok, 0, &response.data);
+                return;
+            }
+            case E_SHM_OP_STREAM_OPEN:
+                ok = plugin_->stream(remote);
+                if (!ok) {
+                    this->bridge_close((uint32_t)frame.arg);
+                }
+                break;
+            default:
+                return;
+        }
+
+        this->reply(frame, ok, arg, &info);
+    }
+
+private:
+    std::shared_ptr<IPlugin<T>> plugin_;        ///< 插件
+    std::shared_ptr<IThreadPool> thread_pool_;  ///< 执行插件接口的线程池
+    MicroTimerWheel timers_;                    ///< 本进程的定时器
+};
+
+}
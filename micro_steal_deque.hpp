@@ -0,0 +1,161 @@
+/**
+ * @file micro_steal_deque.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 工作窃取双端队列
+ * @date 2021-01-20
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace Asty {
+
+/**
+ * @brief Chase-Lev工作窃取队列
+ * @details 只有所属线程可以push/pop(后进先出)，其他线程通过steal从另一端
+ * 窃取(先进先出)，容量不足时自动扩容，旧数组在队列析构时释放
+ *
+ * @tparam T 元素类型，需为指针等可原子读写的平凡类型
+ */
+template <typename T>
+class MicroStealDeque {
+public:
+    MicroStealDeque(size_t size = 64) : top_(0), bottom_(0) {
+        size_t cap = 2;
+
+        while (cap < size) {
+            cap <<= 1;
+        }
+
+        array_.store(new Array(cap), std::memory_order_relaxed);
+    }
+
+    ~MicroStealDeque() {
+        delete array_.load(std::memory_order_relaxed);
+
+        for (auto array : garbage_) {
+            delete array;
+        }
+    }
+
+    MicroStealDeque(const MicroStealDeque &) = delete;
+    MicroStealDeque &operator=(const MicroStealDeque &) = delete;
+
+    // 入队，仅所属线程调用
+    void push(T obj) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array *a = array_.load(std::memory_order_relaxed);
+
+        if (b - t > (int64_t)a->mask) {
+            a = grow(a, t, b);
+        }
+
+        a->put(b, obj);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // 出队，仅所属线程调用
+    bool pop(T &obj) {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array *a = array_.load(std::memory_order_relaxed);
+
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        obj = a->get(b);
+
+        // 最后一个元素，与窃取者竞争
+        if (t == b) {
+            bool ret = top_.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return ret;
+        }
+
+        return true;
+    }
+
+    // 窃取，任意线程调用
+    bool steal(T &obj) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+
+        if (t >= b) {
+            return false;
+        }
+
+        Array *a = array_.load(std::memory_order_acquire);
+        obj = a->get(t);
+
+        return top_.compare_exchange_strong(
+            t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    // 元素数量，并发时为近似值
+    size_t count(void) const {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        return b > t ? (size_t)(b - t) : 0;
+    }
+
+    bool empty(void) const { return count() == 0; }
+
+private:
+    /**
+     * @brief 环形数组
+     *
+     */
+    struct Array {
+        Array(size_t cap) : mask(cap - 1), buf(new std::atomic<T>[cap]) {}
+        ~Array() { delete[] buf; }
+
+        T get(int64_t i) const {
+            return buf[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T obj) {
+            buf[i & mask].store(obj, std::memory_order_relaxed);
+        }
+
+        size_t mask;          ///< 容量掩码
+        std::atomic<T> *buf;  ///< 元素数组
+    };
+
+    // 扩容为两倍，窃取者可能仍在读旧数组，因此延迟到析构时释放
+    Array *grow(Array *a, int64_t t, int64_t b) {
+        Array *na = new Array((a->mask + 1) << 1);
+
+        for (int64_t i = t; i < b; i++) {
+            na->put(i, a->get(i));
+        }
+
+        garbage_.push_back(a);
+        array_.store(na, std::memory_order_release);
+
+        return na;
+    }
+
+private:
+    std::atomic<int64_t> top_;      ///< 窃取端位置
+    char pad_[64];                  ///< 缓存行填充，隔开窃取端和所属线程端
+    std::atomic<int64_t> bottom_;   ///< 所属线程端位置
+    std::atomic<Array *> array_;    ///< 当前数组
+    std::vector<Array *> garbage_;  ///< 扩容后待释放的数组
+};
+
+}
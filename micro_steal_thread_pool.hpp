@@ -0,0 +1,281 @@
+/**
+ * @file micro_steal_thread_pool.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 微内核工作窃取线程池
+ * @date 2021-01-20
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "micro_event_count.hpp"
+#include "micro_metrics.hpp"
+#include "micro_ring_task_queue.hpp"
+#include "micro_steal_deque.hpp"
+#include "micro_task_overflow.hpp"
+#include "thread_pool.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 微内核工作窃取线程池
+ * @details 每个工作线程拥有自己的Chase-Lev队列，工作线程内添加的任务进入本地队列，
+ * 外部线程添加的任务进入全局注入队列，空闲线程依次从本地队列、注入队列和
+ * 其他线程的队列获取任务，都没有任务时休眠
+ *
+ */
+class MicroKernelStealThreadPool : public IThreadPool {
+public:
+    // task_limit为注入队列的容量，工作线程内添加的任务不受此限制
+    MicroKernelStealThreadPool(
+        size_t task_limit = 100,
+        int thread_cnt = std::thread::hardware_concurrency())
+        : inject_(task_limit), steal_seed_(0), running_(true) {
+        if (thread_cnt <= 0) {
+            thread_cnt = 1;
+        }
+
+        for (int i = 0; i < thread_cnt; i++) {
+            workers_.push_back(std::unique_ptr<Worker>(new Worker(i)));
+        }
+
+        for (auto &worker : workers_) {
+            Worker *w = worker.get();
+            w->thread = std::thread([this, w] { work(w); });
+        }
+    }
+
+    virtual ~MicroKernelStealThreadPool() { stop(); }
+
+    // 外部线程调用时作为辅助线程参与执行注入队列和窃取的任务，直到线程池退出
+    virtual void run() override { work(nullptr); }
+
+    virtual void stop() override {
+        std::call_once(flag_, [this] { _stop(); });  // 多线程只调用一次
+    }
+
+    using IThreadPool::add_task;
+
+    virtual void add_task(thread_task_t &&task) override {
+        add_task_for(std::move(task), overflow_.default_wait());
+    }
+
+    // 限时添加，工作线程内添加的任务不受限制，
+    // 外部添加时注入队列满超过wait(us)后按溢出策略处理
+    virtual thread_task_add_status add_task_for(
+        thread_task_t &&task, int64_t wait,
+        const ThreadTaskAttr &attr = ThreadTaskAttr()) override {
+        // 双端队列只能存放指针，每个任务分配一个节点，任务本身只移动
+        thread_task_t *t = new thread_task_t(std::move(task));
+        Worker *w = current_worker();
+
+        t->set_keep(attr.keep);
+
+        if (w) {
+            // 工作线程内提交的任务留在本地队列
+            w->deque.push(t);
+        } else {
+            thread_task_add_status status = overflow_.add(
+                wait,
+                [&](int64_t us) {
+                    thread_task_t *p = t;
+                    return inject_.push(std::move(p), us);
+                },
+                [this] { return running_.load(); },
+                [this] {
+                    thread_task_t *old = nullptr;
+
+                    if (!inject_.shed(old)) {
+                        return false;
+                    }
+
+                    bool shed = overflow_.spare(
+                        old->keep(),
+                        [&] {
+                            thread_task_t *p = old;
+
+                            if (!inject_.push(std::move(p), 0)) {
+                                return false;
+                            }
+                            old = nullptr;
+                            return true;
+                        },
+                        [&old] { (*old)(); });
+
+                    delete old;
+                    return shed;
+                },
+                [t] { (*t)(); });
+
+            if (E_TASK_ADD_OK != status) {
+                // 未被接收时移回任务
+                if (!accepted(status)) {
+                    task = std::move(*t);
+                }
+                delete t;
+                return status;
+            }
+        }
+
+        idle_.notify_one();
+
+        return E_TASK_ADD_OK;
+    }
+
+    virtual bool set_overflow_policy(thread_overflow_policy policy) override {
+        overflow_.set_policy(policy);
+        return true;
+    }
+
+    virtual thread_overflow_policy overflow_policy(void) override {
+        return overflow_.policy();
+    }
+
+    virtual bool in_worker(void) override { return tls_pool() == this; }
+
+    // 工作线程数量
+    size_t thread_cnt(void) const { return workers_.size(); }
+
+    // 运行统计，排队任务数包括注入队列和各工作线程的本地队列
+    virtual bool stat(ThreadPoolStat &stat) override {
+        uint64_t queued = inject_.count();
+
+        for (auto &worker : workers_) {
+            queued += worker->deque.count();
+        }
+
+        metrics_.stat(stat, workers_.size(), queued);
+        overflow_.stat(stat);
+        return true;
+    }
+
+private:
+    /**
+     * @brief 工作线程
+     *
+     */
+    struct Worker {
+        Worker(size_t index) : index(index) {}
+
+        size_t index;                            ///< 线程序号
+        MicroStealDeque<thread_task_t *> deque;  ///< 本地任务队列
+        std::thread thread;                      ///< 线程
+    };
+
+    // 当前线程所属的工作线程，非本线程池的线程返回空
+    Worker *current_worker(void) {
+        return tls_pool() == this ? tls_worker() : nullptr;
+    }
+
+    static MicroKernelStealThreadPool *&tls_pool(void) {
+        static thread_local MicroKernelStealThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    static Worker *&tls_worker(void) {
+        static thread_local Worker *worker = nullptr;
+        return worker;
+    }
+
+    // 获取任务：本地队列 -> 注入队列 -> 窃取其他线程
+    thread_task_t *find_task(Worker *w) {
+        thread_task_t *t = nullptr;
+
+        if (w && w->deque.pop(t)) {
+            return t;
+        }
+
+        if (inject_.try_pop(t)) {
+            return t;
+        }
+
+        size_t n = workers_.size();
+        size_t start = w ? w->index + 1 : steal_seed_++;
+
+        for (size_t i = 0; i < n; i++) {
+            Worker *victim = workers_[(start + i) % n].get();
+
+            if (victim != w && victim->deque.steal(t)) {
+                return t;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void work(Worker *w) {
+        tls_pool() = this;
+        tls_worker() = w;
+
+        while (running_) {
+            thread_task_t *t = nullptr;
+
+            for (int i = 0; i < kSpinCount && !t && running_; i++) {
+                t = find_task(w);
+                if (!t) {
+                    std::this_thread::yield();
+                }
+            }
+
+            if (!t) {
+                idle_.wait([&] { return !running_ || (t = find_task(w)); });
+            }
+
+            if (!t) {
+                continue;
+            }
+
+            MicroMetricsTimer timer;
+            (*t)();
+            metrics_.record(timer);
+            delete t;
+        }
+
+        tls_pool() = nullptr;
+        tls_worker() = nullptr;
+    }
+
+    void _stop(void) {
+        running_ = false;
+        inject_.stop();
+        idle_.notify_all();
+
+        for (auto &worker : workers_) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+
+        // 释放未执行的任务
+        thread_task_t *t = nullptr;
+        for (auto &worker : workers_) {
+            while (worker->deque.pop(t)) {
+                delete t;
+            }
+        }
+
+        while (inject_.try_pop(t)) {
+            delete t;
+        }
+    }
+
+private:
+    static const int kSpinCount = 16;  ///< 休眠前的自旋次数
+
+    std::vector<std::unique_ptr<Worker>> workers_;  ///< 工作线程
+    MicroRingTaskQueue<thread_task_t *> inject_;    ///< 外部任务注入队列
+    std::atomic<size_t> steal_seed_;                ///< 辅助线程窃取起点
+    std::atomic_bool running_;                      ///< 线程池运行状态
+    MicroEventCount idle_;                          ///< 空闲线程等待
+    MicroPoolMetrics metrics_;                      ///< 运行指标
+    MicroTaskOverflow overflow_;                    ///< 溢出处理
+    std::once_flag flag_;                           ///< 标记
+};
+
+}
@@ -10,64 +10,160 @@
 #pragma once
 
 #include <stddef.h>
-#include <list>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
 #include "sync_queue.hpp"
 
 namespace Asty {
 
 /**
  * @brief 微内核任务队列
+ * @details 对象存放在按需加倍的环形缓冲区中，容量达到后入队出队不再
+ * 分配内存，出队时移出对象
  * 
  * @tparam T 队列类型
  */
 template <typename T>
 class MicroSyncTaskQueue : public ISyncQueue<T> {
 public:
-    MicroSyncTaskQueue(size_t size) : max_size_(size) {}
+    MicroSyncTaskQueue(size_t size)
+        : head_(0), size_(0), waiting_(0), max_size_(size), stop_(false) {}
     virtual ~MicroSyncTaskQueue() { stop(); }
 
     // 入队
     virtual bool push(T&& obj) override {
+        return push(std::forward<T>(obj), -1);
+    }
+
+    // 限时入队
+    virtual bool push(T&& obj, int64_t wait) override {
         std::unique_lock<std::mutex> lck(mutex_);
+        auto ready = [this] { return stop_ || (size_ < max_size_); };
+
         // 等待队列非满才能入队
-        not_full_.wait(lck, [this] { return stop_ || (count() < max_size_); });
+        if (wait < 0) {
+            not_full_.wait(lck, ready);
+        } else if (!not_full_.wait_for(lck, std::chrono::microseconds(wait),
+                                       ready)) {
+            return false;
+        }
 
         if (stop_) {
             return false;
         }
 
-        queue_.push_back(std::forward<T>(obj));
+        put(std::forward<T>(obj));
         not_empty_.notify_one();
 
         return true;
     }
 
+    // 批量入队，一次加锁放入尽量多的对象，wait为整批的等待时间
+    virtual size_t push_bulk(T* objs, size_t cnt, int64_t wait) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::microseconds(wait < 0 ? 0 : wait);
+        auto ready = [this] { return stop_ || (size_ < max_size_); };
+        size_t n = 0;
+
+        while (n < cnt) {
+            if (wait < 0) {
+                not_full_.wait(lck, ready);
+            } else if (!not_full_.wait_until(lck, deadline, ready)) {
+                break;
+            }
+
+            if (stop_) {
+                break;
+            }
+
+            size_t begin = n;
+
+            while (n < cnt && size_ < max_size_) {
+                put(std::move(objs[n++]));
+            }
+
+            notify(not_empty_, n - begin);
+        }
+
+        return n;
+    }
+
     // 出队
     virtual bool pop(T& t) override {
         std::unique_lock<std::mutex> lck(mutex_);
         // 等待队列非空才能出队
-        not_empty_.wait(lck, [this] { return stop_ || !queue_.empty(); });
+        waiting_++;
+        not_empty_.wait(lck, [this] { return stop_ || size_ > 0; });
+        waiting_--;
 
         if (stop_) {
             return false;
         }
 
-        t = queue_.front();
-        queue_.pop_front();
+        take(t);
         not_full_.notify_one();
 
         return true;
     }
 
-    // 队列内容数
-    virtual size_t count(void) override { return queue_.size(); }
+    // 批量出队，还有其他消费者等待时只取平分的份额，避免一个消费者取走全部
+    virtual size_t pop_bulk(T* objs, size_t max) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        waiting_++;
+        not_empty_.wait(lck, [this] { return stop_ || size_ > 0; });
+        waiting_--;
+
+        if (stop_) {
+            return 0;
+        }
+
+        size_t n = std::min(max, (size_ + waiting_) / (waiting_ + 1));
 
-    virtual bool empty(void) override { return queue_.empty(); }
+        for (size_t i = 0; i < n; i++) {
+            take(objs[i]);
+        }
 
-    virtual bool full(void) override { return queue_.size() >= max_size_; }
+        notify(not_full_, n);
+
+        return n;
+    }
+
+    // 取出最早入队的对象
+    virtual bool shed(T& t) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        if (stop_ || 0 == size_) {
+            return false;
+        }
+
+        take(t);
+        not_full_.notify_one();
+
+        return true;
+    }
+
+    // 队列内容数，可在其他线程统计时调用
+    virtual size_t count(void) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+        return size_;
+    }
+
+    virtual bool empty(void) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+        return 0 == size_;
+    }
+
+    virtual bool full(void) override {
+        std::unique_lock<std::mutex> lck(mutex_);
+        return size_ >= max_size_;
+    }
 
     // 停止队列
     virtual void stop(void) override {
@@ -81,11 +177,58 @@ public:
     }
 
 private:
-    std::list<T> queue_;                 ///< 任务队列
+    // 放入队尾，缓冲区满时扩容，持锁调用
+    void put(T&& obj) {
+        if (size_ == ring_.size()) {
+            grow();
+        }
+
+        ring_[(head_ + size_) % ring_.size()] = std::forward<T>(obj);
+        size_++;
+    }
+
+    // 移出队首对象，持锁调用
+    void take(T &t) {
+        t = std::move(ring_[head_]);
+        ring_[head_] = T();
+        head_ = (head_ + 1) % ring_.size();
+        size_--;
+    }
+
+    // 缓冲区已满时加倍，不超过队列限制，持锁调用
+    void grow(void) {
+        size_t min = kMinCapacity;
+        std::vector<T> ring(
+            std::min(std::max(min, ring_.size() * 2), max_size_));
+
+        for (size_t i = 0; i < size_; i++) {
+            ring[i] = std::move(ring_[(head_ + i) % ring_.size()]);
+        }
+
+        ring_.swap(ring);
+        head_ = 0;
+    }
+
+    // 放入或取出n个对象后唤醒等待方
+    static void notify(std::condition_variable& cond, size_t n) {
+        if (n > 1) {
+            cond.notify_all();
+        } else if (n) {
+            cond.notify_one();
+        }
+    }
+
+private:
+    static const size_t kMinCapacity = 16;  ///< 缓冲区初始容量
+
+    std::vector<T> ring_;                ///< 任务环形缓冲区
+    size_t head_;                        ///< 队首位置
+    size_t size_;                        ///< 任务数
+    size_t waiting_;                     ///< 等待出队的消费者数
     std::mutex mutex_;                   ///< 队列锁
     std::condition_variable not_empty_;  ///< 非空条件变量
     std::condition_variable not_full_;   ///< 非满条件变量
-    size_t max_size_;                       ///< 任务队列限制
+    size_t max_size_;                    ///< 任务队列限制
     bool stop_;                          ///< 退出条件
 };
 
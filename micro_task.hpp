@@ -0,0 +1,196 @@
+/**
+ * @file micro_task.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 只能移动的任务类型，小捕获内联存储
+ * @date 2021-02-02
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Asty {
+
+/**
+ * @brief 线程池任务
+ * @details 只能移动，不能复制。不超过kInlineSize且移动不抛异常的可调用
+ * 对象存放在对象内部，构造、入队、出队和执行都不分配内存；更大的可调用
+ * 对象在堆上分配一次，之后只移动指针
+ *
+ */
+class MicroTask {
+public:
+    static const size_t kInlineSize = 48;  ///< 内联存储大小
+
+    MicroTask() noexcept : ops_(nullptr), keep_(false) {}
+
+    MicroTask(std::nullptr_t) noexcept : ops_(nullptr), keep_(false) {}
+
+    // 空的函数指针或std::function构造出空任务
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<
+                  typename std::decay<F>::type, MicroTask>::value>::type>
+    MicroTask(F &&f) : ops_(nullptr), keep_(false) {
+        typedef typename std::decay<F>::type Fn;
+
+        if (is_null(f)) {
+            return;
+        }
+
+        store<Fn>(std::forward<F>(f),
+                  std::integral_constant<bool, fits<Fn>()>());
+    }
+
+    MicroTask(MicroTask &&task) noexcept
+        : ops_(task.ops_), keep_(task.keep_) {
+        if (ops_) {
+            ops_->move(storage_, task.storage_);
+            task.ops_ = nullptr;
+        }
+    }
+
+    MicroTask(const MicroTask &) = delete;
+    MicroTask &operator=(const MicroTask &) = delete;
+
+    MicroTask &operator=(MicroTask &&task) noexcept {
+        if (this != &task) {
+            reset();
+            ops_ = task.ops_;
+            keep_ = task.keep_;
+            if (ops_) {
+                ops_->move(storage_, task.storage_);
+                task.ops_ = nullptr;
+            }
+        }
+
+        return *this;
+    }
+
+    MicroTask &operator=(std::nullptr_t) noexcept {
+        reset();
+        keep_ = false;
+        return *this;
+    }
+
+    ~MicroTask() { reset(); }
+
+    // 执行任务，空任务不能执行
+    void operator()(void) { ops_->invoke(storage_); }
+
+    explicit operator bool(void) const noexcept { return ops_ != nullptr; }
+
+    // 设置不可丢弃，丢弃最早任务的溢出策略会跳过该任务
+    void set_keep(bool keep) noexcept { keep_ = keep; }
+
+    // 是否不可丢弃
+    bool keep(void) const noexcept { return keep_; }
+
+    // 可调用对象类型F是否内联存储
+    template <typename F>
+    static constexpr bool fits(void) {
+        return sizeof(F) <= kInlineSize &&
+               alignof(F) <= alignof(max_align_t) &&
+               std::is_nothrow_move_constructible<F>::value;
+    }
+
+private:
+    /**
+     * @brief 可调用对象的操作表
+     *
+     */
+    struct Ops {
+        void (*invoke)(void *);        ///< 执行
+        void (*move)(void *, void *);  ///< 移动到新的存储并析构原对象
+        void (*destroy)(void *);       ///< 析构
+    };
+
+    // 内联存储的可调用对象
+    template <typename Fn>
+    struct Inline {
+        static void invoke(void *p) { (*static_cast<Fn *>(p))(); }
+
+        static void move(void *dst, void *src) {
+            Fn *f = static_cast<Fn *>(src);
+
+            new (dst) Fn(std::move(*f));
+            f->~Fn();
+        }
+
+        static void destroy(void *p) { static_cast<Fn *>(p)->~Fn(); }
+
+        static const Ops ops;
+    };
+
+    // 堆上存储的可调用对象，内联存储中只保存指针
+    template <typename Fn>
+    struct Heap {
+        static Fn *&get(void *p) { return *static_cast<Fn **>(p); }
+
+        static void invoke(void *p) { (*get(p))(); }
+
+        static void move(void *dst, void *src) { new (dst) Fn *(get(src)); }
+
+        static void destroy(void *p) { delete get(p); }
+
+        static const Ops ops;
+    };
+
+    template <typename F>
+    static bool is_null(const F &) {
+        return false;
+    }
+
+    template <typename R>
+    static bool is_null(R (*f)(void)) {
+        return !f;
+    }
+
+    template <typename S>
+    static bool is_null(const std::function<S> &f) {
+        return !f;
+    }
+
+    // 内联存储
+    template <typename Fn, typename F>
+    void store(F &&f, std::true_type) {
+        new (storage_) Fn(std::forward<F>(f));
+        ops_ = &Inline<Fn>::ops;
+    }
+
+    // 堆上存储
+    template <typename Fn, typename F>
+    void store(F &&f, std::false_type) {
+        new (storage_) Fn *(new Fn(std::forward<F>(f)));
+        ops_ = &Heap<Fn>::ops;
+    }
+
+    void reset(void) noexcept {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    alignas(max_align_t) unsigned char storage_[kInlineSize];  ///< 存储
+    const Ops *ops_;                                           ///< 操作表
+    bool keep_;                                                ///< 不可丢弃
+};
+
+template <typename Fn>
+const MicroTask::Ops MicroTask::Inline<Fn>::ops = {
+    &MicroTask::Inline<Fn>::invoke, &MicroTask::Inline<Fn>::move,
+    &MicroTask::Inline<Fn>::destroy};
+
+template <typename Fn>
+const MicroTask::Ops MicroTask::Heap<Fn>::ops = {
+    &MicroTask::Heap<Fn>::invoke, &MicroTask::Heap<Fn>::move,
+    &MicroTask::Heap<Fn>::destroy};
+
+}
@@ -0,0 +1,121 @@
+/**
+ * @file micro_task_overflow.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 线程池任务队列满时的溢出处理
+ * @date 2021-02-01
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "thread_pool.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 任务溢出处理
+ * @details 线程池添加任务时先按等待时间入队，队列仍满时按策略拒绝、
+ * 丢弃最早排队的任务后重试或在调用线程执行，并统计每个被拒绝、
+ * 丢弃和在调用线程执行的任务；取出的不可丢弃任务放回队列，
+ * 放不回时在调用线程执行
+ *
+ */
+class MicroTaskOverflow {
+public:
+    MicroTaskOverflow()
+        : policy_(E_TASK_OVERFLOW_BLOCK),
+          rejected_(0),
+          shed_(0),
+          caller_runs_(0) {}
+
+    void set_policy(thread_overflow_policy policy) { policy_ = policy; }
+
+    thread_overflow_policy policy(void) const { return policy_; }
+
+    // 不指定等待时间时的等待时间，阻塞策略一直等待，其他策略不等待
+    int64_t default_wait(void) const {
+        return E_TASK_OVERFLOW_BLOCK == policy_ ? -1 : 0;
+    }
+
+    /**
+     * @brief 按等待时间和溢出策略添加任务
+     *
+     * @param wait 队列满时的等待时间(us)，-1一直等待
+     * @param push 入队，参数为等待时间，失败时不能移走任务
+     * @param running 线程池是否仍在运行
+     * @param drop 丢弃一个排队的任务，队列空返回false
+     * @param run 在调用线程执行新任务
+     * @return thread_task_add_status 添加结果
+     */
+    template <typename Push, typename Running, typename Drop, typename Run>
+    thread_task_add_status add(int64_t wait, Push push, Running running,
+                               Drop drop, Run run) {
+        if (push(wait)) {
+            return E_TASK_ADD_OK;
+        }
+
+        if (!running()) {
+            return E_TASK_ADD_STOPPED;
+        }
+
+        switch (policy_.load(std::memory_order_relaxed)) {
+            case E_TASK_OVERFLOW_DROP_OLDEST:
+                // 其他生产者可能抢先占用腾出的位置，有限次重试后拒绝
+                for (int i = 0; i < kShedRetry; i++) {
+                    if (drop()) {
+                        shed_.fetch_add(1, std::memory_order_relaxed);
+                    }
+
+                    if (push(0)) {
+                        return E_TASK_ADD_OK;
+                    }
+                }
+                break;
+            case E_TASK_OVERFLOW_CALLER_RUNS:
+                caller_runs_.fetch_add(1, std::memory_order_relaxed);
+                run();
+                return E_TASK_ADD_CALLER_RAN;
+            default:
+                break;
+        }
+
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return E_TASK_ADD_FULL;
+    }
+
+    // 丢弃时取出的任务不可丢弃时放回队列，放不回时在调用线程执行，
+    // 返回任务是否被丢弃
+    template <typename Push, typename Run>
+    bool spare(bool keep, Push push, Run run) {
+        if (!keep) {
+            return true;
+        }
+
+        if (!push()) {
+            caller_runs_.fetch_add(1, std::memory_order_relaxed);
+            run();
+        }
+
+        return false;
+    }
+
+    // 填充线程池统计中的溢出计数
+    void stat(ThreadPoolStat &stat) const {
+        stat.rejected = rejected_.load(std::memory_order_relaxed);
+        stat.shed = shed_.load(std::memory_order_relaxed);
+        stat.caller_runs = caller_runs_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const int kShedRetry = 4;  ///< 丢弃后重新入队的次数
+
+    std::atomic<thread_overflow_policy> policy_;  ///< 溢出策略
+    std::atomic<uint64_t> rejected_;              ///< 被拒绝的任务数
+    std::atomic<uint64_t> shed_;                  ///< 被丢弃的任务数
+    std::atomic<uint64_t> caller_runs_;           ///< 在调用线程执行的任务数
+};
+
+}
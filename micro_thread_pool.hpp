@@ -9,74 +9,596 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
 #include <future>
+#include <list>
+#include <map>
 #include <memory>
+#include <vector>
+#include "micro_cpu_topology.hpp"
+#include "micro_logger.hpp"
+#include "micro_metrics.hpp"
+#include "micro_ring_task_queue.hpp"
 #include "micro_sync_task_queue.hpp"
+#include "micro_task_overflow.hpp"
 #include "thread_pool.hpp"
 
 namespace Asty {
 
 /**
  * @brief 微内核线程池
- * 
+ * @details 按放置策略把工作线程分组，每组一个任务队列：不绑核或绑定到cpuset时
+ * 只有一组，按NUMA节点放置时每个节点一组，节点的队列在该节点上分配；
+ * 指定了节点或CPU的任务进入对应节点的队列，工作线程内添加的其他任务留在本组，
+ * 外部添加的其他任务轮流分配到各组；
+ * 配置了自适应大小时由监控线程按各组的积压和空闲情况增减工作线程
+ *
+ * @tparam Queue 任务队列类型，需实现ISyncQueue<thread_task_t>
  */
-class MicroKernelThreadPool : public IThreadPool {
+template <typename Queue>
+class BasicMicroKernelThreadPool : public IThreadPool {
 public:
-    MicroKernelThreadPool(size_t task_limit = 100,
-                          int thread_cnt = std::thread::hardware_concurrency())
-        : queue_(task_limit), running_(false) {
+    BasicMicroKernelThreadPool(
+        size_t task_limit = 100,
+        int thread_cnt = std::thread::hardware_concurrency(),
+        const ThreadPlacement &placement = ThreadPlacement(),
+        const ThreadPoolSizing &sizing = ThreadPoolSizing())
+        : mode_(placement.mode),
+          sizing_(sizing),
+          size_(0),
+          next_(0),
+          drain_(1),
+          grown_(0),
+          shrunk_(0),
+          running_(false),
+          monitor_stop_(false) {
+        uint32_t cnt = thread_cnt > 0 ? thread_cnt : 0;
+
+        plan(placement);
+        loads_.reset(new Load[groups_.size()]);
+
+        for (auto &group : groups_) {
+            queues_.push_back(alloc_queue(group, task_limit));
+        }
+
+        // 自适应时每组至少一个线程，初始线程数限制在上下限之间
+        if (sizing_.adaptive()) {
+            sizing_.min_threads = std::max<uint32_t>(sizing_.min_threads,
+                                                     groups_.size());
+            sizing_.max_threads =
+                std::max(sizing_.max_threads, sizing_.min_threads);
+            cnt = std::min(std::max(cnt, sizing_.min_threads),
+                           sizing_.max_threads);
+        }
+
         running_ = true;
-        for (int i = 0; i < thread_cnt; i++) {
-            threads_.push_back(
-                std::make_shared<std::thread>([this] { run(); }));
+        for (uint32_t i = 0; i < cnt; i++) {
+            spawn(i % groups_.size());
+        }
+
+        if (sizing_.adaptive()) {
+            monitor_ = std::thread([this] { monitor(); });
+        }
+    }
+
+    virtual ~BasicMicroKernelThreadPool() { stop(); }
+
+    // 外部线程调用时作为第一组的工作线程执行任务，直到线程池退出
+    virtual void run() override { work(0, nullptr); }
+
+    virtual void stop() override {
+        std::call_once(flag_, [this] { _stop(); });  // 多线程只调用一次
+    }
+
+    using IThreadPool::add_task;
+
+    // XXX:这里不做不定参数的接口，外部传入时可以自行绑定
+    virtual void add_task(thread_task_t &&task) override {
+        add_task_for(std::move(task), overflow_.default_wait());
+    }
+
+    // 按任务的节点或CPU亲和性添加，不区分优先级
+    virtual void add_task(thread_task_t &&task,
+                          const ThreadTaskAttr &attr) override {
+        add_task_for(std::move(task), overflow_.default_wait(), attr);
+    }
+
+    // 限时添加，队列满超过wait(us)后按溢出策略处理，
+    // 任务直接移入队列，入队失败时不会移走
+    virtual thread_task_add_status add_task_for(
+        thread_task_t &&task, int64_t wait,
+        const ThreadTaskAttr &attr = ThreadTaskAttr()) override {
+        Queue &queue = *queues_[route(task_node(attr))];
+
+        task.set_keep(attr.keep);
+
+        return overflow_.add(
+            wait,
+            [&](int64_t us) { return queue.push(std::move(task), us); },
+            [this] { return running_.load(); },
+            [&] {
+                thread_task_t t;
+
+                return queue.shed(t) &&
+                       overflow_.spare(
+                           t.keep(),
+                           [&] { return queue.push(std::move(t), 0); },
+                           [&t] { t(); });
+            },
+            [&task] { task(); });
+    }
+
+    // 批量添加，同一节点的连续任务整批入队，不限节点的任务平均分到各分组；
+    // 未能整批入队的任务逐个按溢出策略处理
+    virtual size_t add_tasks(thread_task_t *tasks, size_t cnt, int64_t wait,
+                             const ThreadTaskAttr *attrs = nullptr) override {
+        ThreadTaskAttr none;
+        size_t done = 0;
+
+        for (size_t i = 0; attrs && i < cnt; i++) {
+            tasks[i].set_keep(attrs[i].keep);
+        }
+
+        while (done < cnt) {
+            int node = task_node(attrs ? attrs[done] : none);
+            size_t end = done + 1;
+
+            while (end < cnt && task_node(attrs ? attrs[end] : none) == node) {
+                end++;
+            }
+
+            size_t chunk = end - done;
+
+            if (node < 0) {
+                chunk = (chunk + groups_.size() - 1) / groups_.size();
+            }
+
+            while (done < end) {
+                size_t n = std::min(chunk, end - done);
+                size_t pushed =
+                    queues_[route(node)]->push_bulk(&tasks[done], n, wait);
+
+                done += pushed;
+                if (pushed == n) {
+                    continue;
+                }
+
+                if (!accepted(add_task_for(std::move(tasks[done]), 0,
+                                           attrs ? attrs[done] : none))) {
+                    return done;
+                }
+                done++;
+            }
+        }
+
+        return cnt;
+    }
+
+    virtual bool set_overflow_policy(thread_overflow_policy policy) override {
+        overflow_.set_policy(policy);
+        return true;
+    }
+
+    // 每次唤醒最多取出的任务数，限制在1到kDrainBatch之间
+    virtual bool set_drain_batch(uint32_t n) override {
+        uint32_t max = kDrainBatch;
+
+        drain_ = std::min(std::max<uint32_t>(n, 1), max);
+        return true;
+    }
+
+    virtual thread_overflow_policy overflow_policy(void) override {
+        return overflow_.policy();
+    }
+
+    virtual bool in_worker(void) override { return local().pool == this; }
+
+    // 工作线程分组数，按NUMA节点放置时为节点数
+    size_t group_cnt(void) const { return groups_.size(); }
+
+    // 当前工作线程数，不含已决定减少但尚未退出的线程
+    uint32_t size(void) const { return size_; }
+
+    // 运行统计，包括当前线程数、上下限和增减次数
+    virtual bool stat(ThreadPoolStat &stat) override {
+        uint64_t queued = 0;
+
+        for (auto &queue : queues_) {
+            queued += queue->count();
+        }
+
+        metrics_.stat(stat, size_, queued);
+        overflow_.stat(stat);
+
+        if (sizing_.adaptive()) {
+            stat.min_threads = sizing_.min_threads;
+            stat.max_threads = sizing_.max_threads;
+            stat.grown = grown_;
+            stat.shrunk = shrunk_;
+        }
+
+        return true;
+    }
+
+private:
+    /**
+     * @brief 工作线程分组
+     *
+     */
+    struct Group {
+        int node;               ///< NUMA节点，不按节点分组时为-1
+        std::vector<int> cpus;  ///< 组内可用CPU，为空时不绑核
+    };
+
+    /**
+     * @brief 线程所属的线程池和分组
+     *
+     */
+    struct Local {
+        const void *pool;  ///< 线程池
+        size_t group;      ///< 分组
+    };
+
+    /**
+     * @brief 分组负载，工作线程计数，监控线程采样
+     *
+     */
+    struct Load {
+        Load()
+            : threads(0),
+              busy(0),
+              retire(0),
+              held(0),
+              spawned(0),
+              backlog_ms(0),
+              idle_ms(0),
+              peak_busy(0) {}
+
+        std::atomic<uint32_t> threads;  ///< 工作线程数，不含待退出的
+        std::atomic<uint32_t> busy;     ///< 正在执行任务的线程数
+        std::atomic<uint32_t> retire;   ///< 待退出的线程数
+        std::atomic<uint32_t> held;     ///< 已取出尚未执行的任务数
+        uint32_t spawned;               ///< 已创建的线程数，用于选择CPU
+        uint32_t backlog_ms;            ///< 持续积压的时间
+        uint32_t idle_ms;               ///< 当前空闲观察窗口的时间
+        uint32_t peak_busy;             ///< 观察窗口内的最多忙碌线程数
+    };
+
+    /**
+     * @brief 工作线程
+     *
+     */
+    struct Worker {
+        Worker() : exited(false) {}
+
+        std::thread thread;       ///< 线程
+        std::atomic_bool exited;  ///< 已退出，等待回收
+    };
+
+    static Local &local(void) {
+        static thread_local Local l{nullptr, 0};
+        return l;
+    }
+
+    // 按放置策略划分分组
+    void plan(const ThreadPlacement &placement) {
+        const MicroCpuTopology &topology = MicroCpuTopology::instance();
+        std::vector<int> allowed;
+
+        for (int cpu : placement.cpus) {
+            if (topology.cpu_node(cpu) >= 0) {
+                allowed.push_back(cpu);
+            }
+        }
+
+        // 配置的cpuset不可用时使用进程允许的所有CPU
+        if (allowed.empty()) {
+            allowed = topology.cpus();
+        }
+
+        if (E_THREAD_PLACE_NODE == placement.mode ||
+            E_THREAD_PLACE_CORE == placement.mode) {
+            for (int node : topology.nodes()) {
+                Group group{node, std::vector<int>()};
+
+                for (int cpu : topology.node_cpus(node)) {
+                    if (std::find(allowed.begin(), allowed.end(), cpu) !=
+                        allowed.end()) {
+                        group.cpus.push_back(cpu);
+                    }
+                }
+
+                if (!group.cpus.empty()) {
+                    node_group_[node] = groups_.size();
+                    groups_.push_back(group);
+                }
+            }
+        }
+
+        // 单节点机器上按节点放置也只有一组
+        if (groups_.size() <= 1) {
+            node_group_.clear();
+            groups_.clear();
+            groups_.push_back(Group{
+                -1, E_THREAD_PLACE_NONE == placement.mode ? std::vector<int>()
+                                                          : allowed});
+        }
+    }
+
+    // 在分组中创建一个工作线程，按核放置时依次绑定组内的CPU
+    void spawn(size_t group) {
+        Load &load = loads_[group];
+        const std::vector<int> &all = groups_[group].cpus;
+        std::vector<int> cpus = all;
+        std::shared_ptr<Worker> worker = std::make_shared<Worker>();
+        Worker *self = worker.get();
+
+        if (E_THREAD_PLACE_CORE == mode_ && !all.empty()) {
+            cpus = std::vector<int>{all[load.spawned % all.size()]};
+        }
+
+        load.spawned++;
+        load.threads++;
+        size_++;
+
+        worker->thread = std::thread([this, cpus, group, self] {
+            MicroCpuTopology::pin(cpus);
+            work(group, self);
+        });
+        threads_.push_back(worker);
+    }
+
+    // 分配分组的队列，按节点分组时在绑定到该节点的线程中分配，
+    // 使队列内存按首次访问分配在本节点
+    std::unique_ptr<Queue> alloc_queue(const Group &group, size_t task_limit) {
+        std::unique_ptr<Queue> queue;
+
+        if (group.node < 0) {
+            queue.reset(new Queue(task_limit));
+            return queue;
+        }
+
+        std::thread([&] {
+            MicroCpuTopology::pin(group.cpus);
+            queue.reset(new Queue(task_limit));
+        }).join();
+
+        return queue;
+    }
+
+    // 任务指定的节点，只指定CPU时为CPU所在节点，不限时为-1
+    static int task_node(const ThreadTaskAttr &attr) {
+        if (attr.node < 0 && attr.cpu >= 0) {
+            return MicroCpuTopology::instance().cpu_node(attr.cpu);
+        }
+
+        return attr.node;
+    }
+
+    // 选择任务进入的分组
+    size_t route(int node) {
+        if (1 == groups_.size()) {
+            return 0;
+        }
+
+        if (node >= 0) {
+            auto item = node_group_.find(node);
+            if (item != node_group_.end()) {
+                return item->second;
+            }
         }
+
+        // 工作线程内添加的任务留在本组
+        if (local().pool == this) {
+            return local().group;
+        }
+
+        return next_.fetch_add(1, std::memory_order_relaxed) % groups_.size();
     }
 
-    virtual ~MicroKernelThreadPool() { stop(); }
+    // 执行分组的任务，每次唤醒最多取出drain_个依次执行，
+    // self为空时是外部线程，不参与缩减
+    void work(size_t group, Worker *self) {
+        Queue &queue = *queues_[group];
+        Load &load = loads_[group];
+        thread_task_t batch[kDrainBatch];
+
+        local().pool = this;
+        local().group = group;
 
-    virtual void run() override {
         while (running_) {
-            thread_task_t t = nullptr;
-            auto ret = queue_.pop(t);
+            size_t n = queue.pop_bulk(batch, drain_);
+
+            if (!n) {
+                break;
+            }
+
+            // 取出的任务对监控线程而言仍是积压
+            load.held += n;
+
+            size_t i = 0;
+
+            for (; i < n && running_; i++) {
+                load.held--;
+                if (!batch[i]) {
+                    continue;
+                }
+
+                MicroMetricsTimer timer;
+                load.busy++;
+                batch[i]();
+                load.busy--;
+                metrics_.record(timer);
+            }
+
+            load.held -= n - i;
+
+            // 及时释放任务持有的资源，退出时丢弃未执行的任务
+            for (i = 0; i < n; i++) {
+                batch[i] = nullptr;
+            }
+
+            // 缩减时由先执行完任务的线程退出
+            if (self && take_retire(load)) {
+                break;
+            }
+        }
+
+        if (self) {
+            self->exited = true;
+        }
+    }
+
+    static bool take_retire(Load &load) {
+        uint32_t n = load.retire.load(std::memory_order_relaxed);
+
+        while (n && !load.retire.compare_exchange_weak(n, n - 1)) {
+        }
+
+        return n > 0;
+    }
+
+    // 按采样间隔调整线程数，直到线程池退出
+    void monitor(void) {
+        std::unique_lock<std::mutex> lck(mutex_);
+        uint32_t ms = sizing_.sample_ms ? sizing_.sample_ms : 1;
+
+        while (!monitor_cond_.wait_for(lck, std::chrono::milliseconds(ms),
+                                       [this] { return monitor_stop_; })) {
+            reap();
+
+            for (size_t group = 0; group < groups_.size(); group++) {
+                resize(group, ms);
+            }
+        }
+    }
+
+    // 工作线程全忙且队列有积压持续grow_ms时增加一个线程，
+    // 持续idle_ms的采样中都有空闲线程时减少一个线程
+    void resize(size_t group, uint32_t ms) {
+        Load &load = loads_[group];
+        uint32_t threads = load.threads;
+        uint32_t busy = load.busy;
+        bool backlog =
+            busy >= threads && (queues_[group]->count() || load.held);
+
+        load.backlog_ms = backlog ? load.backlog_ms + ms : 0;
+        load.peak_busy = std::max(load.peak_busy, busy);
+        load.idle_ms += ms;
+
+        if (load.backlog_ms >= sizing_.grow_ms) {
+            load.backlog_ms = 0;
+
+            if (size_ < sizing_.max_threads) {
+                spawn(group);
+                grown_++;
+                resized(threads, threads + 1, group);
+            }
+
+            // 增加后重新观察空闲，避免立即缩减
+            load.idle_ms = 0;
+            load.peak_busy = 0;
+            return;
+        }
+
+        if (load.idle_ms < sizing_.idle_ms) {
+            return;
+        }
 
-            if (!ret || !t || !running_) {
+        if (load.peak_busy < threads && threads > 1 &&
+            size_ > sizing_.min_threads) {
+            load.retire++;
+
+            // 唤醒一个等待任务的线程执行退出，持有锁时不等待队列空位；
+            // 入队失败且退出尚未被领取时撤回，保留空闲时间下次采样再缩减
+            if (!queues_[group]->push([] {}, 0) && take_retire(load)) {
                 return;
             }
 
-            t();
+            load.threads--;
+            size_--;
+            shrunk_++;
+            resized(threads, threads - 1, group);
         }
+
+        load.idle_ms = 0;
+        load.peak_busy = 0;
     }
 
-    virtual void stop() override {
-        std::call_once(flag_, [this] { _stop(); });  // 多线程只调用一次
+    void resized(uint32_t from, uint32_t to, size_t group) {
+        MicroLogger::instance().write(
+            E_LOG_INFO,
+            "thread pool resize : [group = %u] [threads = %u -> %u] "
+            "[total = %u]",
+            (uint32_t)group, from, to, size_.load());
     }
 
-    // XXX:这里不做不定参数的接口，外部传入时可以自行绑定
-    virtual void add_task(const thread_task_t &task) override {
-        queue_.push([task]() { task(); });
+    // 回收已退出的工作线程
+    void reap(void) {
+        for (auto it = threads_.begin(); it != threads_.end();) {
+            if ((*it)->exited) {
+                (*it)->thread.join();
+                it = threads_.erase(it);
+            } else {
+                ++it;
+            }
+        }
     }
 
-private:
     void _stop(void) {
-        queue_.stop();
+        if (monitor_.joinable()) {
+            {
+                std::unique_lock<std::mutex> lck(mutex_);
+                monitor_stop_ = true;
+            }
+            monitor_cond_.notify_one();
+            monitor_.join();
+        }
+
+        for (auto &queue : queues_) {
+            queue->stop();
+        }
         running_ = false;
 
-        for (auto thread : threads_) {
-            if (thread) {
-                thread->join();
-            }
+        for (auto &worker : threads_) {
+            worker->thread.join();
         }
 
         threads_.clear();
     }
 
 private:
-    std::list<std::shared_ptr<std::thread>> threads_;  ///< 线程队列
-    MicroSyncTaskQueue<thread_task_t> queue_;          ///< 线程任务队列
-    std::atomic_bool running_;  ///< 线程池运行状态
-    std::once_flag flag_;       ///< 标记
-    std::mutex mutex_;          ///< 线程池锁
+    static const size_t kDrainBatch = 16;  ///< 每次唤醒最多取出的任务上限
+
+    std::list<std::shared_ptr<Worker>> threads_;   ///< 工作线程
+    std::vector<Group> groups_;                    ///< 工作线程分组
+    std::vector<std::unique_ptr<Queue>> queues_;   ///< 各分组的任务队列
+    std::unique_ptr<Load[]> loads_;                ///< 各分组的负载
+    std::map<int, size_t> node_group_;             ///< 节点对应的分组
+    thread_placement_mode mode_;                   ///< 放置方式
+    ThreadPoolSizing sizing_;                      ///< 自适应大小配置
+    std::atomic<uint32_t> size_;                   ///< 当前工作线程数
+    std::atomic<uint32_t> next_;                   ///< 轮流分配的分组
+    std::atomic<uint32_t> drain_;                  ///< 每次唤醒最多取出的任务数
+    std::atomic<uint64_t> grown_;                  ///< 增加线程的次数
+    std::atomic<uint64_t> shrunk_;                 ///< 减少线程的次数
+    MicroPoolMetrics metrics_;                     ///< 运行指标
+    MicroTaskOverflow overflow_;                   ///< 溢出处理
+    std::atomic_bool running_;                     ///< 线程池运行状态
+    std::once_flag flag_;                          ///< 标记
+    std::thread monitor_;                          ///< 自适应大小监控线程
+    bool monitor_stop_;                            ///< 监控线程退出条件
+    std::condition_variable monitor_cond_;         ///< 监控线程等待
+    std::mutex mutex_;                             ///< 线程池锁
 };
 
+// 互斥锁队列线程池
+typedef BasicMicroKernelThreadPool<MicroSyncTaskQueue<thread_task_t>>
+    MicroKernelThreadPool;
+// 无锁环形队列线程池，适合工作线程较多、队列竞争激烈的场景
+typedef BasicMicroKernelThreadPool<MicroRingTaskQueue<thread_task_t>>
+    MicroKernelRingThreadPool;
+
 }
@@ -0,0 +1,437 @@
+/**
+ * @file micro_timer_wheel.hpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 分层时间轮定时器
+ * @date 2021-02-05
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "thread_pool.hpp"
+
+namespace Asty {
+
+/**
+ * @brief 定时器回调
+ *
+ */
+typedef std::function<void(void)> timer_cb_t;
+
+/**
+ * @brief 分层时间轮定时器
+ * @details 以1ms为一格，第一层256格，其上三层各64格，覆盖约18.6小时，
+ * 更远的定时器先放在最高层，逐层下移时重新计算位置；添加和取消都是O(1)。
+ * 定时器节点放在按下标复用的数组中，槽内用下标组成双向链表，每个定时器
+ * 约64字节；一个线程按最近的非空格休眠，到期回调整批以高优先级提交到
+ * 线程池，队列满时等待，不会被丢弃。首次添加定时器时才创建线程
+ *
+ */
+class MicroTimerWheel {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    MicroTimerWheel(const std::shared_ptr<IThreadPool> &thread_pool)
+        : thread_pool_(thread_pool),
+          base_(clock::now()),
+          now_(0),
+          wake_(UINT64_MAX),
+          count_(0),
+          free_(kNil),
+          stop_(false) {
+        for (auto &head : heads_) {
+            head = kNil;
+        }
+
+        for (auto &bits : bits_) {
+            bits = 0;
+        }
+    }
+
+    ~MicroTimerWheel() { stop(); }
+
+    MicroTimerWheel(const MicroTimerWheel &) = delete;
+    MicroTimerWheel &operator=(const MicroTimerWheel &) = delete;
+
+    // delay(ms)后在线程池中执行cb，period(ms)非0时之后每隔period执行一次，
+    // 返回定时器标识，失败或已停止返回0
+    uint64_t add(uint32_t delay, uint32_t period, const timer_cb_t &cb) {
+        return add_at(clock::now() + std::chrono::milliseconds(delay), period,
+                      cb);
+    }
+
+    // 到达when后执行，其余同add
+    uint64_t add_at(clock::time_point when, uint32_t period,
+                    const timer_cb_t &cb) {
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        if (stop_ || !cb) {
+            return 0;
+        }
+
+        if (!thread_.joinable()) {
+            thread_ = std::thread(&MicroTimerWheel::loop, this);
+        }
+
+        // 时间轮为空时直接跳到当前时间
+        if (!count_) {
+            now_ = tick(clock::now()) + 1;
+        }
+
+        uint32_t idx = alloc();
+        Node &node = nodes_[idx];
+        uint64_t expires = deadline(when);
+
+        node.expires = expires < now_ ? now_ : expires;
+        node.period = period;
+        node.cb = cb;
+        link(idx);
+
+        // 早于线程休眠的到期时间时唤醒重新计算
+        if (node.expires < wake_) {
+            cond_.notify_one();
+        }
+
+        return (uint64_t)node.gen << 32 | (idx + 1);
+    }
+
+    // 取消定时器，已提交到线程池的回调仍会执行；
+    // 定时器不存在或一次性定时器已到期时返回false
+    bool cancel(uint64_t id) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        uint32_t idx = (uint32_t)id - 1;
+
+        if (!id || idx >= nodes_.size() || nodes_[idx].gen != id >> 32 ||
+            kNil == nodes_[idx].slot) {
+            return false;
+        }
+
+        unlink(idx);
+        release(idx);
+
+        return true;
+    }
+
+    // 等待到期的定时器数量
+    size_t size(void) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return count_;
+    }
+
+    // 停止定时器线程并丢弃全部定时器，不能在回调中调用
+    void stop(void) {
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+
+            if (stop_) {
+                return;
+            }
+
+            stop_ = true;
+        }
+
+        cond_.notify_one();
+
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+
+        std::lock_guard<std::mutex> lck(mtx_);
+
+        nodes_.clear();
+        count_ = 0;
+    }
+
+private:
+    static const uint32_t kNil = UINT32_MAX;  ///< 空下标
+    static const uint32_t kRootBits = 8;      ///< 第一层格数位数
+    static const uint32_t kLevelBits = 6;     ///< 上层格数位数
+    static const uint32_t kLevels = 4;        ///< 层数
+    static const uint32_t kRootSlots = 1 << kRootBits;
+    static const uint32_t kLevelSlots = 1 << kLevelBits;
+    static const uint32_t kSlots = kRootSlots + (kLevels - 1) * kLevelSlots;
+    static const uint64_t kRange = 1ull << (kRootBits +
+                                            (kLevels - 1) * kLevelBits);
+
+    /**
+     * @brief 定时器节点
+     *
+     */
+    struct Node {
+        uint64_t expires;  ///< 到期的格
+        uint32_t period;   ///< 周期(ms)，0为一次性
+        uint32_t gen;      ///< 复用次数，使旧标识失效
+        uint32_t prev;     ///< 槽内前一个节点
+        uint32_t next;     ///< 槽内后一个节点，空闲时为空闲链表的下一个
+        uint32_t slot;     ///< 所在的槽，空闲时为kNil
+        timer_cb_t cb;     ///< 回调
+    };
+
+    // 时间点所在的格
+    uint64_t tick(clock::time_point when) const {
+        if (when <= base_) {
+            return 0;
+        }
+
+        return std::chrono::duration_cast<std::chrono::milliseconds>(when -
+                                                                     base_)
+            .count();
+    }
+
+    // 到期的格，向上取整，不会提前到期
+    uint64_t deadline(clock::time_point when) const {
+        uint64_t t = tick(when);
+
+        return base_ + std::chrono::milliseconds(t) < when ? t + 1 : t;
+    }
+
+    uint32_t alloc(void) {
+        uint32_t idx = free_;
+
+        if (kNil == idx) {
+            idx = (uint32_t)nodes_.size();
+            nodes_.emplace_back();
+            nodes_[idx].gen = 1;
+        } else {
+            free_ = nodes_[idx].next;
+        }
+
+        count_++;
+
+        return idx;
+    }
+
+    void release(uint32_t idx) {
+        Node &node = nodes_[idx];
+
+        node.cb = nullptr;
+        node.gen++;
+        node.slot = kNil;
+        node.next = free_;
+        free_ = idx;
+        count_--;
+    }
+
+    // 按到期时间选择层和槽，超出范围的放在最高层最远的槽
+    uint32_t slot_of(uint64_t expires) const {
+        uint64_t delta = expires - now_;
+
+        if (delta < kRootSlots) {
+            return expires & (kRootSlots - 1);
+        }
+
+        if (delta >= kRange) {
+            expires = now_ + kRange - 1;
+            delta = kRange - 1;
+        }
+
+        uint32_t shift = kRootBits;
+        uint32_t level = 0;
+
+        while (delta >= 1ull << (shift + kLevelBits)) {
+            shift += kLevelBits;
+            level++;
+        }
+
+        return kRootSlots + level * kLevelSlots +
+               ((expires >> shift) & (kLevelSlots - 1));
+    }
+
+    void link(uint32_t idx) {
+        Node &node = nodes_[idx];
+        uint32_t slot = slot_of(node.expires);
+
+        node.slot = slot;
+        node.prev = kNil;
+        node.next = heads_[slot];
+
+        if (kNil != node.next) {
+            nodes_[node.next].prev = idx;
+        }
+
+        heads_[slot] = idx;
+        bits_[slot / 64] |= 1ull << (slot % 64);
+    }
+
+    void unlink(uint32_t idx) {
+        Node &node = nodes_[idx];
+
+        if (kNil != node.prev) {
+            nodes_[node.prev].next = node.next;
+        } else {
+            heads_[node.slot] = node.next;
+        }
+
+        if (kNil != node.next) {
+            nodes_[node.next].prev = node.prev;
+        }
+
+        if (kNil == heads_[node.slot]) {
+            bits_[node.slot / 64] &= ~(1ull << (node.slot % 64));
+        }
+
+        node.slot = kNil;
+    }
+
+    // 取下整个槽的链表
+    uint32_t take(uint32_t slot) {
+        uint32_t head = heads_[slot];
+
+        heads_[slot] = kNil;
+        bits_[slot / 64] &= ~(1ull << (slot % 64));
+
+        return head;
+    }
+
+    // 进入第一层新的一轮时，把上层对应槽的定时器重新放到下层
+    void cascade(void) {
+        uint32_t shift = kRootBits;
+
+        for (uint32_t level = 0; level < kLevels - 1; level++) {
+            uint32_t idx = (now_ >> shift) & (kLevelSlots - 1);
+            uint32_t node = take(kRootSlots + level * kLevelSlots + idx);
+
+            while (kNil != node) {
+                uint32_t next = nodes_[node].next;
+                link(node);
+                node = next;
+            }
+
+            if (idx) {
+                break;
+            }
+
+            shift += kLevelBits;
+        }
+    }
+
+    // 第一层从slot开始的第一个非空槽，没有时返回kRootSlots
+    uint32_t next_root(uint32_t slot) const {
+        for (uint32_t w = slot / 64; w < kRootSlots / 64; w++) {
+            uint64_t bits = bits_[w];
+
+            if (w == slot / 64) {
+                bits &= ~0ull << (slot % 64);
+            }
+
+            if (bits) {
+                return w * 64 + __builtin_ctzll(bits);
+            }
+        }
+
+        return kRootSlots;
+    }
+
+    // 推进到target格(含)，到期的回调放入fired，周期定时器落后时跳过错过的周期
+    void advance(uint64_t target, std::vector<thread_task_t> &fired) {
+        while (now_ <= target) {
+            uint32_t idx = now_ & (kRootSlots - 1);
+
+            if (!idx) {
+                cascade();
+            }
+
+            uint32_t slot = next_root(idx);
+
+            // 本轮剩余的格都为空，跳到下一轮
+            if (kRootSlots == slot) {
+                now_ = std::min((now_ | (kRootSlots - 1)) + 1, target + 1);
+                continue;
+            }
+
+            if (now_ + (slot - idx) > target) {
+                now_ = target + 1;
+                break;
+            }
+
+            now_ += slot - idx;
+
+            uint32_t node = take(slot);
+
+            while (kNil != node) {
+                uint32_t next = nodes_[node].next;
+                Node &item = nodes_[node];
+
+                if (!item.period) {
+                    fired.emplace_back(std::move(item.cb));
+                    release(node);
+                } else {
+                    fired.emplace_back(item.cb);
+                    item.expires += item.period;
+                    if (item.expires <= target) {
+                        item.expires = target + item.period;
+                    }
+                    link(node);
+                }
+
+                node = next;
+            }
+
+            now_++;
+        }
+    }
+
+    // 定时器线程，按最近的非空格或下一轮的开始休眠
+    void loop(void) {
+        std::vector<thread_task_t> fired;
+        std::vector<ThreadTaskAttr> attrs;
+        ThreadTaskAttr attr(E_TASK_PRIO_HIGH);
+        std::unique_lock<std::mutex> lck(mtx_);
+
+        // 到期的回调不能丢失
+        attr.keep = true;
+
+        while (!stop_) {
+            advance(tick(clock::now()), fired);
+
+            if (!fired.empty()) {
+                lck.unlock();
+                attrs.resize(fired.size(), attr);
+                thread_pool_->add_tasks(fired.data(), fired.size(), -1,
+                                        attrs.data());
+                fired.clear();
+                lck.lock();
+                continue;
+            }
+
+            if (!count_) {
+                wake_ = UINT64_MAX;
+                cond_.wait(lck);
+                continue;
+            }
+
+            uint32_t idx = now_ & (kRootSlots - 1);
+
+            // 新一轮开始时需先下移上层的定时器
+            wake_ = idx ? now_ + next_root(idx) - idx : now_;
+            cond_.wait_until(lck, base_ + std::chrono::milliseconds(wake_));
+        }
+    }
+
+private:
+    std::shared_ptr<IThreadPool> thread_pool_;  ///< 执行回调的线程池
+    clock::time_point base_;                    ///< 第0格的时间
+    uint64_t now_;                              ///< 下一个处理的格
+    uint64_t wake_;                             ///< 线程休眠到的格
+    size_t count_;                              ///< 等待到期的定时器数
+    uint32_t free_;                             ///< 空闲节点链表
+    std::vector<Node> nodes_;                   ///< 定时器节点
+    uint32_t heads_[kSlots];                    ///< 各槽的链表头
+    uint64_t bits_[kSlots / 64];                ///< 非空槽位图
+    bool stop_;                                 ///< 已停止
+    std::mutex mtx_;                            ///< 时间轮锁
+    std::condition_variable cond_;              ///< 线程休眠条件变量
+    std::thread thread_;                        ///< 定时器线程
+};
+
+}
@@ -10,11 +10,20 @@
 #pragma once
 
 #include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+#include "micro_buffer_pool.hpp"
+#include "micro_logger.hpp"
+#include "micro_mailbox.hpp"
+#include "micro_metrics.hpp"
 
 namespace Asty {
 
@@ -24,6 +33,17 @@ class IPlugin;
 // 微内核类
 template <typename T>
 class MicroKernel;
+// 微内核调度器
+template <typename T>
+class MicroKernelScheduler;
+
+template <typename T>
+class MicroPluginProxy;
+// 共享内存插件代理和宿主
+template <typename T>
+class MicroShmPluginProxy;
+template <typename T>
+class MicroShmPluginHost;
 
 /**
  * @brief 插件key
@@ -55,9 +75,17 @@ struct PluginKey {
  *
  */
 struct PluginDataT {
-    int type;    ///< 数据类型，由插件实现自行定义
-    int len;     ///< 数据长度
-    void *data;  ///< 数据实体
+    int type;          ///< 数据类型，由插件实现自行定义
+    int len;           ///< 数据长度
+    void *data;        ///< 数据实体
+    PluginBuffer buf;  ///< 可选，数据所在的引用计数缓冲区，转发时随数据共享不拷贝
+
+    // 使用引用计数缓冲区作为数据实体
+    void set_buffer(const PluginBuffer &buffer, int length) {
+        buf = buffer;
+        data = buf.data();
+        len = length;
+    }
 };
 
 /**
@@ -72,6 +100,133 @@ struct PluginMessage {
     PluginDataT data;   ///< 通信数据
 };
 
+/**
+ * @brief 异步调用状态
+ *
+ */
+typedef enum {
+    E_PLUGIN_CALL_PENDING = 0,   ///< 排队或执行中
+    E_PLUGIN_CALL_DONE = 1,      ///< 处理成功
+    E_PLUGIN_CALL_FAILED = 2,    ///< 插件未找到或处理失败
+    E_PLUGIN_CALL_TIMEOUT = 3,   ///< 超过截止时间
+    E_PLUGIN_CALL_CANCELED = 4,  ///< 已取消
+} plugin_call_status;
+
+/**
+ * @brief 异步调用完成回调，在完成调用的线程上执行，不得阻塞
+ *
+ */
+typedef std::function<void(plugin_call_status st, const PluginDataT &response)>
+    plugin_call_cb_t;
+
+/**
+ * @brief 异步调用结果，状态只会从PENDING变化一次，回调也只执行一次
+ *
+ */
+class PluginCall {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    // timeout为0表示没有截止时间
+    PluginCall(const plugin_call_cb_t &cb, uint32_t timeout)
+        : status_(E_PLUGIN_CALL_PENDING),
+          cb_(cb),
+          has_deadline_(timeout > 0),
+          deadline_(clock::now() + std::chrono::milliseconds(timeout)),
+          timer_(0) {}
+
+    // 当前状态
+    plugin_call_status status(void) const { return status_; }
+
+    // 应答数据，状态为DONE或FAILED后有效
+    const PluginDataT &response(void) const { return response_; }
+
+    // 是否有截止时间
+    bool has_deadline(void) const { return has_deadline_; }
+
+    // 截止时间
+    clock::time_point deadline(void) const { return deadline_; }
+
+    // 是否已超过截止时间
+    bool expired(void) const {
+        return has_deadline_ && clock::now() >= deadline_;
+    }
+
+    // 等待完成，有截止时间时最多等到截止时间
+    plugin_call_status wait(void) {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        if (!has_deadline_) {
+            cond_.wait(lck,
+                       [this] { return E_PLUGIN_CALL_PENDING != status_; });
+            return status_;
+        }
+
+        if (!cond_.wait_until(lck, deadline_, [this] {
+                return E_PLUGIN_CALL_PENDING != status_;
+            })) {
+            lck.unlock();
+            complete(E_PLUGIN_CALL_TIMEOUT, PluginDataT{});
+        }
+
+        return status_;
+    }
+
+    // 最多等待timeout毫秒，返回当时的状态，不改变调用状态
+    plugin_call_status wait_for(uint32_t timeout) {
+        std::unique_lock<std::mutex> lck(mutex_);
+
+        cond_.wait_for(lck, std::chrono::milliseconds(timeout),
+                       [this] { return E_PLUGIN_CALL_PENDING != status_; });
+
+        return status_;
+    }
+
+    // 取消调用，尚未完成时返回true，正在执行的处理不会被打断，其结果被丢弃
+    bool cancel(void) {
+        return complete(E_PLUGIN_CALL_CANCELED, PluginDataT{});
+    }
+
+private:
+    template <typename U>
+    friend class MicroKernel;
+
+    // 完成调用，只有第一次完成生效
+    bool complete(plugin_call_status st, const PluginDataT &response) {
+        plugin_call_cb_t cb;
+
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+
+            if (E_PLUGIN_CALL_PENDING != status_) {
+                return false;
+            }
+
+            response_ = response;
+            status_ = st;
+            cb.swap(cb_);
+        }
+
+        cond_.notify_all();
+
+        if (cb) {
+            cb(st, response_);
+        }
+
+        return true;
+    }
+
+private:
+    std::atomic<plugin_call_status> status_;  ///< 调用状态
+    PluginDataT response_;                    ///< 应答数据
+    plugin_call_cb_t cb_;                     ///< 完成回调
+    bool has_deadline_;                       ///< 是否有截止时间
+    clock::time_point deadline_;              ///< 截止时间
+    uint64_t timer_;                          ///< 截止时间定时器，0为没有
+    std::mutex mutex_;                        ///< 状态锁
+    std::condition_variable cond_;            ///< 完成条件变量
+};
+
 /**
  * @brief 插件通信消息格式，用于长连接
  *
@@ -89,10 +244,39 @@ public:
     virtual void close() = 0;
     // 检查连接是否关闭
     virtual bool is_closed(void) = 0;
-    // 发送数据
-    virtual int send(const PluginDataT &data, const time_t wait = -1) = 0;
-    // 接收数据
-    virtual int recv(PluginDataT &data, const time_t wait = -1) = 0;
+    // 发送数据，wait为等待时间(us)，-1一直等待，0不等待；
+    // 返回发送的个数，超时返回0，连接关闭返回负数
+    virtual int send(const PluginDataT &data, const int64_t wait = -1) = 0;
+    // 接收数据，wait和返回值同send
+    virtual int recv(PluginDataT &data, const int64_t wait = -1) = 0;
+
+    // 批量发送，返回已发送的个数，一个都未发送时返回0或负数
+    virtual int send(const PluginDataT *data, int cnt,
+                     const int64_t wait = -1) {
+        for (int i = 0; i < cnt; i++) {
+            int ret = send(data[i], wait);
+            if (ret <= 0) {
+                return i ? i : ret;
+            }
+        }
+
+        return cnt;
+    }
+
+    // 批量接收，最多接收cnt个，有数据可读时不再等待凑满
+    virtual int recv(PluginDataT *data, int cnt, const int64_t wait = -1) {
+        return cnt > 0 ? recv(data[0], wait) : 0;
+    }
+
+    // 取出对端，由stream_dispatch交给目的插件，没有对端或已取出时返回空
+    virtual std::shared_ptr<IPluginStream<T>> remote(void) { return nullptr; }
+
+    // 就绪事件描述符，有数据可接收、不等待的发送未发完后有了空间或连接关闭时
+    // 变为可读，供反应器监视，不支持时返回-1
+    virtual int event_fd(void) { return -1; }
+
+    // 清除就绪事件，在处理就绪之前调用，之后的新数据、空间或关闭会再次触发
+    virtual void event_clear(void) {}
 
 public:
     PluginKey<T> from_;  ///< 源插件
@@ -109,6 +293,26 @@ typedef enum {
     E_PLUGIN_BAD = 2,     ///< 异常
 } plugin_run_status;
 
+/**
+ * @brief 插件任务调度周期(ms)的特殊取值
+ *
+ */
+typedef enum : uint32_t {
+    E_PLUGIN_TASK_PERIOD_DEFAULT = 0,     ///< 使用微内核默认周期
+    E_PLUGIN_TASK_ON_READY = UINT32_MAX,  ///< 不周期调度，仅在插件唤醒时调度
+} plugin_task_period;
+
+/**
+ * @brief 插件任务提交统计
+ *
+ */
+struct PluginTaskStat {
+    uint64_t submitted;  ///< 已提交到线程池的任务数
+    uint64_t coalesced;  ///< 因并发数达到上限而被合并的提交数
+    uint64_t rejected;   ///< 线程池队列满被拒绝的提交数
+    uint32_t inflight;   ///< 排队或正在执行的任务数
+};
+
 /**
  * @brief 微内核服务接口类，提供给插件使用
  * @tparam T key类型
@@ -125,15 +329,76 @@ public:
     // 插件信息查询，不允许在init start stop exit插件接口内同步调用，否则会造成微内核死锁
     virtual bool plugin_key(const T &key, PluginKey<T> &item_key) = 0;
 
-    // 消息分发
+    // 消息分发，目的插件为actor模式时等待其邮箱处理完该消息；
+    // 在线程池工作线程内(插件接口内)同步分发给其他actor插件会失败，
+    // 需使用message_dispatch_async
     virtual bool message_dispatch(const PluginKey<T> &from, const T &to_key,
                                   const PluginDataT &request,
                                   PluginDataT &response) = 0;
-    // 消息流分发
+    // 异步消息分发，请求在线程池中处理，完成后执行cb，timeout(ms)为0表示不设截止时间，
+    // 请求数据的data需保持有效直到完成，建议通过PluginDataT::set_buffer携带
+    virtual std::shared_ptr<PluginCall> message_dispatch_async(
+        const PluginKey<T> &from, const T &to_key, const PluginDataT &request,
+        const plugin_call_cb_t &cb = nullptr, uint32_t timeout = 0) = 0;
+    // 消息流分发，stream有对端时目的插件收到的是对端
     virtual bool stream_dispatch(std::shared_ptr<IPluginStream<T>> stream) = 0;
-
-    // 日志
+    // 创建微内核提供的流并分发给目的插件，返回本端，目的插件未找到时返回空，
+    // capacity为每个方向缓存的数据个数
+    virtual std::shared_ptr<IPluginStream<T>> stream_open(
+        const PluginKey<T> &from, const T &to_key, size_t capacity = 64) = 0;
+
+    // 唤醒插件，微内核会尽快调度一次该插件的plugin_task
+    virtual bool plugin_wakeup(const T &key) = 0;
+    // 重新读取插件任务调度周期，用于从仅就绪调度切换为周期调度，
+    // 已在周期调度中的插件不受影响
+    virtual bool plugin_reschedule(const T &key) = 0;
+    // 插件任务提交统计
+    virtual bool plugin_task_stat(const T &key, PluginTaskStat &stat) = 0;
+    // 在线程池中执行任务，用于协程等在等待的事件完成后恢复执行
+    virtual void task_post(const std::function<void(void)> &task) = 0;
+    // 到达when后在线程池中执行任务，微内核停止后不再执行
+    virtual void task_post_at(std::chrono::steady_clock::time_point when,
+                              const std::function<void(void)> &task) = 0;
+    // 添加定时器，delay(ms)后在线程池中执行cb，period(ms)非0时之后每隔period
+    // 执行一次，回调耗时超过周期时可能并发执行；返回定时器标识，失败返回0，
+    // 微内核停止后不再执行
+    virtual uint64_t timer_add(uint32_t delay, uint32_t period,
+                               const std::function<void(void)> &cb) = 0;
+    // 取消定时器，已提交到线程池的回调仍会执行，
+    // 定时器不存在或一次性定时器已到期时返回false
+    virtual bool timer_cancel(uint64_t id) = 0;
+    // 监视描述符，每次变为可读时在线程池中执行cb，执行期间的触发合并为
+    // 结束后的一次补调；返回监视标识，不支持或失败返回0，微内核停止后不再执行
+    virtual uint64_t fd_watch(int fd, const std::function<void(void)> &cb) = 0;
+    // 取消监视，已提交到线程池的回调仍会执行，描述符需在取消后才能关闭
+    virtual void fd_unwatch(uint64_t id) = 0;
+
+    // 订阅主题，插件通过notice接收该主题发布的消息，可在任意插件接口内调用
+    virtual bool subscribe(const T &key, uint32_t topic) = 0;
+    // 取消订阅
+    virtual bool unsubscribe(const T &key, uint32_t topic) = 0;
+    // 发布消息，在线程池中分批并行调用订阅者的notice，
+    // 返回已提交通知的订阅者数量，线程池拒绝的批次不计入；
+    // 未使用引用计数缓冲区的数据会被复制，调用返回后即可释放
+    virtual int publish(uint32_t topic, const PluginDataT &msg) = 0;
+
+    // 插件运行指标快照，各线程分片合并后返回
+    virtual bool plugin_metrics(const T &key, PluginMetricsStat &stat) = 0;
+    // 线程池运行统计，线程池不支持统计时返回false
+    virtual bool thread_pool_stat(ThreadPoolStat &stat) = 0;
+    // 导出线程池和所有有记录插件的指标，json为false时导出文本
+    virtual std::string metrics_dump(bool json = false) = 0;
+
+    // 分配引用计数缓冲区，通过PluginDataT::set_buffer携带，请求数据可零拷贝转发
+    virtual PluginBuffer buffer_alloc(size_t size) = 0;
+    // 缓冲区池各大小级别的统计
+    virtual void buffer_stat(std::vector<PluginBufferStat> &stat) = 0;
+
+    // 日志，INFO级别
     virtual void log(const std::string &message) = 0;
+    // 格式化日志，写入线程本地缓冲后由后台线程异步输出，缓冲满时丢弃
+    virtual void log(micro_log_level level, const char *fmt, ...)
+        __attribute__((format(printf, 3, 4))) = 0;
 };
 
 /**
@@ -147,7 +412,17 @@ public:
     IPlugin(const PluginKey<T> &key)
         : plugin_key_(key),
           plugin_st_(E_PLUGIN_STOP),
-          mic_kernel_srv_(nullptr) {}
+          mic_kernel_srv_(nullptr),
+          task_ready_(false),
+          task_armed_(false),
+          task_inflight_(0),
+          task_rerun_(false),
+          task_submitted_(0),
+          task_coalesced_(0),
+          task_rejected_(0),
+          actor_batch_(0),
+          actor_pending_(0),
+          draining_(false) {}
 
     virtual ~IPlugin() {}
 
@@ -174,6 +449,33 @@ public:
         return true;
     }
 
+    // 唤醒插件任务，就绪驱动的插件在有事可做时调用，多次唤醒会被合并
+    bool wakeup(void) {
+        if (!mic_kernel_srv_) {
+            return false;
+        }
+
+        return mic_kernel_srv_->plugin_wakeup(plugin_key_.key);
+    }
+
+    // 订阅主题
+    bool subscribe(uint32_t topic) {
+        if (!mic_kernel_srv_) {
+            return false;
+        }
+
+        return mic_kernel_srv_->subscribe(plugin_key_.key, topic);
+    }
+
+    // 取消订阅主题
+    bool unsubscribe(uint32_t topic) {
+        if (!mic_kernel_srv_) {
+            return false;
+        }
+
+        return mic_kernel_srv_->unsubscribe(plugin_key_.key, topic);
+    }
+
     // 注册
     bool register_self(IMicroKernelServices<T> *micro_kernel) {
         // TODO
@@ -193,19 +495,49 @@ public:
     // 启动
     virtual bool plugin_start(void) = 0;
 
-    // 微内核cycle调用，每次微内核循环都会添加到线程池任务，因此该接口实现时不得死循环
+    // 微内核调度调用，每次周期到期或插件被唤醒时添加到线程池任务，因此该接口实现时不得死循环
     virtual bool plugin_task(void) = 0;
 
     // 如果插件实现不需要微内核循环去添加插件任务，而是开启自己的插件线程，那么建议该接口返回false，用于避免不必要的任务添加，增强微内核性能
     virtual bool plugin_task_en(void) = 0;
 
+    // 插件任务调度周期(ms)，E_PLUGIN_TASK_PERIOD_DEFAULT使用微内核默认周期，
+    // E_PLUGIN_TASK_ON_READY表示只在wakeup后调度，每次调度后重新读取
+    virtual uint32_t plugin_task_period(void) {
+        return E_PLUGIN_TASK_PERIOD_DEFAULT;
+    }
+
+    // 依赖的插件，依赖的插件先于本插件初始化和启动、后于本插件停止，
+    // 依赖缺失、失败或成环的插件不会启动
+    virtual std::vector<T> plugin_depends(void) { return std::vector<T>(); }
+
+    // 插件任务、消息和流在线程池中的优先级类别，线程池支持优先级时生效
+    virtual thread_task_prio plugin_task_prio(void) {
+        return E_TASK_PRIO_NORMAL;
+    }
+
+    // 插件任务、消息和流执行的NUMA节点，-1不限，线程池按节点放置时生效
+    virtual int32_t plugin_task_node(void) { return -1; }
+
+    // 插件任务、消息和流执行的CPU，线程池按CPU所在节点执行，-1不限
+    virtual int32_t plugin_task_cpu(void) { return -1; }
+
+    // actor模式每次激活最多处理的邮件数，返回0不使用actor模式；
+    // actor模式下plugin_task、notice、message和stream都作为邮件投递到插件邮箱，
+    // 同一时刻只在一个线程中执行，插件实现不需要加锁，注册时读取一次
+    virtual uint32_t plugin_actor_batch(void) { return 0; }
+
+    // 插件任务允许的最大并发数(排队和执行中)，达到上限后周期调度被跳过，
+    // 唤醒被合并为执行结束后的一次补调，插件任务可重入时可返回大于1的值
+    virtual uint32_t plugin_task_concurrency(void) { return 1; }
+
     // 停止
     virtual bool plugin_stop(void) = 0;
 
     // 退出
     virtual bool plugin_exit(void) = 0;
 
-    // 消息通知，来自微内核
+    // 消息通知，来自微内核，订阅主题的消息也通过此接口送达
     virtual bool notice(const PluginDataT &msg) = 0;
 
     // 消息处理
@@ -215,8 +547,27 @@ public:
     // 流式消息处理
     virtual bool stream(std::shared_ptr<IPluginStream<T>> stream) = 0;
 
+    // 流是否由反应器驱动，返回true时stream只用于接受流，不得阻塞，返回true
+    // 后流有数据可接收、有空间可发送或关闭时在线程池中调用stream_ready；
+    // 流不支持就绪事件时仍按原方式只调用stream，每次stream返回后读取
+    virtual bool plugin_stream_reactor(void) { return false; }
+
+    // 流就绪处理，只能以不等待的方式收发，同一个流不会并发调用；
+    // 返回false后不再监视该流，接收返回负数(连接关闭)后应返回false
+    virtual bool stream_ready(std::shared_ptr<IPluginStream<T>> stream) {
+        return false;
+    }
+
+    // 插件被微内核停止或注销时在plugin_exit之后调用，释放仍在等待微内核
+    // 事件的资源，默认不处理
+    virtual void plugin_detach(void) {}
+
 private:
     friend class MicroKernel<T>;
+    friend class MicroKernelScheduler<T>;
+    friend class MicroPluginProxy<T>;
+    friend class MicroShmPluginProxy<T>;
+    friend class MicroShmPluginHost<T>;
     // 设置插件状态
     void set_plugin_status(plugin_run_status st) { plugin_st_ = st; }
 
@@ -226,9 +577,21 @@ private:
     }
 
 private:
-    PluginKey<T> plugin_key_;                  ///< 插件信息
-    plugin_run_status plugin_st_;              ///< 插件状态
-    IMicroKernelServices<T> *mic_kernel_srv_;  ///< 微内核服务
+    PluginKey<T> plugin_key_;                      ///< 插件信息
+    std::atomic<plugin_run_status> plugin_st_;     ///< 插件状态
+    IMicroKernelServices<T> *mic_kernel_srv_;      ///< 微内核服务
+    std::atomic_bool task_ready_;                  ///< 已在就绪队列中，用于合并唤醒
+    bool task_armed_;                              ///< 已有周期定时器，受调度器锁保护
+    std::atomic<uint32_t> task_inflight_;          ///< 排队或执行中的任务数
+    std::atomic_bool task_rerun_;                  ///< 执行期间有被合并的唤醒
+    std::atomic<uint64_t> task_submitted_;         ///< 已提交任务数
+    std::atomic<uint64_t> task_coalesced_;         ///< 被合并的提交数
+    std::atomic<uint64_t> task_rejected_;          ///< 被线程池拒绝的提交数
+    PluginMetrics metrics_;                        ///< 运行指标
+    uint32_t actor_batch_;                         ///< actor模式每次激活处理的邮件数
+    MicroMailbox<thread_task_t> mailbox_;          ///< actor模式的邮箱
+    std::atomic<int64_t> actor_pending_;           ///< 未处理的邮件数，大于0时已激活
+    std::atomic_bool draining_;                    ///< 正在停止，不再提交插件任务
 };
 
 }
@@ -0,0 +1,78 @@
+/**
+ * @file sample_plugin.cpp
+ * @author wotsen (astralrovers@outlook.com)
+ * @brief 动态库插件示例，由demo按plugins.manifest在首次收到消息时加载
+ * @date 2021-01-27
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <stdio.h>
+#include "../micro_plugin_loader.hpp"
+#include "../plugin.hpp"
+
+using namespace Asty;
+
+// 与demo.cpp中的定义一致
+typedef enum : int {
+    E_DOMAIN_BASIC = 0,
+    E_DOMAIN_ALARM = 1,
+    E_DOMAIN_SAMPLE = 100,
+} domain_type;
+
+class SamplePlugin : public IPlugin<domain_type> {
+public:
+    // 插件信息需与清单中的一致
+    SamplePlugin()
+        : IPlugin<domain_type>(
+              PluginKey<domain_type>{"sample", "1.0.0", E_DOMAIN_SAMPLE}) {}
+
+    // 初始化，首次使用时才调用
+    virtual bool plugin_init(void) override {
+        get_micro_kernel_service()->log(E_LOG_INFO, "sample init");
+        return true;
+    }
+
+    // 启动
+    virtual bool plugin_start(void) override {
+        get_micro_kernel_service()->log(E_LOG_INFO, "sample start");
+        return true;
+    }
+
+    virtual bool plugin_task(void) override { return true; }
+
+    virtual bool plugin_task_en(void) override { return false; }
+
+    // 停止
+    virtual bool plugin_stop(void) override {
+        get_micro_kernel_service()->log(E_LOG_INFO, "sample stop");
+        return true;
+    }
+
+    // 退出，之后动态库被卸载
+    virtual bool plugin_exit(void) override {
+        get_micro_kernel_service()->log(E_LOG_INFO, "sample exit");
+        return true;
+    }
+
+    virtual bool notice(const PluginDataT &msg) override { return true; }
+
+    // 消息处理，应答使用微内核缓冲区
+    virtual bool message(const PluginMessage<domain_type> &request,
+                         PluginMessage<domain_type> &response) override {
+        PluginBuffer resb = get_micro_kernel_service()->buffer_alloc(32);
+
+        response.data.set_buffer(
+            resb, snprintf((char *)resb.data(), resb.capacity(),
+                           "hello from sample"));
+
+        return true;
+    }
+
+    virtual bool stream(
+        std::shared_ptr<IPluginStream<domain_type>> stream) override {
+        return false;
+    }
+};
+
+MICRO_PLUGIN_EXPORT(domain_type, SamplePlugin)
@@ -10,6 +10,8 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <utility>
 
 namespace Asty {
 
@@ -25,8 +27,30 @@ public:
 
     // 入队
     virtual bool push(T&& obj) = 0;
+    // 限时入队，wait为等待时间(us)，0不等待，-1一直等待；
+    // 队列满超时或退出时返回false，不会移走obj
+    virtual bool push(T&& obj, int64_t wait) = 0;
     // 出队
     virtual bool pop(T& t) = 0;
+    // 不等待地取出最先应丢弃的对象，为新对象腾出空间，队列空返回false
+    virtual bool shed(T& t) = 0;
+
+    // 批量入队，按顺序移走能入队的前若干个对象，返回入队数；
+    // 队列满时等待wait(us)，0不等待，-1一直等待。默认逐个入队
+    virtual size_t push_bulk(T* objs, size_t cnt, int64_t wait) {
+        size_t n = 0;
+
+        while (n < cnt && push(std::move(objs[n]), wait)) {
+            n++;
+        }
+
+        return n;
+    }
+
+    // 批量出队，等待到有对象后最多取出max个，退出时返回0。默认取出一个
+    virtual size_t pop_bulk(T* objs, size_t max) {
+        return max && pop(objs[0]) ? 1 : 0;
+    }
 
     // 队列数量
     virtual size_t count(void) = 0;
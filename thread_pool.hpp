@@ -8,15 +8,120 @@
  *
  */
 #pragma once
-#include <functional>
+#include <stdint.h>
+#include <chrono>
+#include "micro_task.hpp"
 
 namespace Asty {
 
 /**
- * @brief 任务接口类型
+ * @brief 任务接口类型，只能移动，入队和出队都移动任务
  * 
  */
-typedef std::function<void(void)> thread_task_t;
+typedef MicroTask thread_task_t;
+
+/**
+ * @brief 任务优先级类别，高类别的任务总是先于低类别执行
+ *
+ */
+typedef enum : uint32_t {
+    E_TASK_PRIO_HIGH = 0,    ///< 延迟敏感的任务，如告警处理
+    E_TASK_PRIO_NORMAL = 1,  ///< 默认类别
+    E_TASK_PRIO_LOW = 2,     ///< 可延后的任务，如周期巡检
+    E_TASK_PRIO_CNT = 3,     ///< 类别数
+} thread_task_prio;
+
+/**
+ * @brief 队列满时的溢出策略
+ *
+ */
+typedef enum : uint32_t {
+    E_TASK_OVERFLOW_BLOCK = 0,        ///< 等待队列有空间，默认策略
+    E_TASK_OVERFLOW_REJECT = 1,       ///< 拒绝新任务
+    E_TASK_OVERFLOW_DROP_OLDEST = 2,  ///< 丢弃最早排队的可丢弃任务，被丢弃的任务不会执行
+    E_TASK_OVERFLOW_CALLER_RUNS = 3,  ///< 在调用线程执行新任务
+} thread_overflow_policy;
+
+/**
+ * @brief 添加任务的结果
+ *
+ */
+typedef enum : uint32_t {
+    E_TASK_ADD_OK = 0,          ///< 已入队
+    E_TASK_ADD_FULL = 1,        ///< 队列满，任务被拒绝
+    E_TASK_ADD_STOPPED = 2,     ///< 线程池已退出
+    E_TASK_ADD_CALLER_RAN = 3,  ///< 队列满，已在调用线程执行
+} thread_task_add_status;
+
+/**
+ * @brief 任务属性
+ *
+ */
+struct ThreadTaskAttr {
+    typedef std::chrono::steady_clock clock;
+
+    ThreadTaskAttr(thread_task_prio p = E_TASK_PRIO_NORMAL,
+                   clock::time_point d = clock::time_point::max())
+        : prio(p), deadline(d), node(-1), cpu(-1), keep(false) {}
+
+    // 是否设置了截止时间
+    bool has_deadline(void) const {
+        return deadline != clock::time_point::max();
+    }
+
+    thread_task_prio prio;       ///< 优先级类别
+    clock::time_point deadline;  ///< 截止时间，同类别内越早越先执行
+    int32_t node;                ///< 执行的NUMA节点，-1不限
+    int32_t cpu;                 ///< 执行的CPU，按所在节点执行，-1不限
+    bool keep;                   ///< 不可丢弃，必须执行的任务如等待计数的任务
+};
+
+/**
+ * @brief 线程池自适应大小
+ * @details 工作线程全忙且队列持续有积压超过grow_ms时增加一个线程，
+ * 持续idle_ms都有空闲线程时减少一个线程，线程数保持在上下限之间
+ *
+ */
+struct ThreadPoolSizing {
+    ThreadPoolSizing(uint32_t min = 0, uint32_t max = 0, uint32_t grow = 50,
+                     uint32_t idle = 5000, uint32_t sample = 10)
+        : min_threads(min),
+          max_threads(max),
+          grow_ms(grow),
+          idle_ms(idle),
+          sample_ms(sample) {}
+
+    // 是否调整线程数
+    bool adaptive(void) const { return max_threads > min_threads; }
+
+    uint32_t min_threads;  ///< 最少工作线程数
+    uint32_t max_threads;  ///< 最多工作线程数，不大于min_threads时不调整
+    uint32_t grow_ms;      ///< 持续积压多久后增加线程
+    uint32_t idle_ms;      ///< 持续空闲多久后减少线程
+    uint32_t sample_ms;    ///< 采样间隔
+};
+
+/**
+ * @brief 线程池运行统计
+ *
+ */
+struct ThreadPoolStat {
+    uint32_t threads;      ///< 当前工作线程数
+    uint32_t min_threads;  ///< 最少工作线程数，固定大小时等于threads
+    uint32_t max_threads;  ///< 最多工作线程数，固定大小时等于threads
+    uint64_t grown;        ///< 增加线程的次数
+    uint64_t shrunk;       ///< 减少线程的次数
+    uint64_t queued;     ///< 排队中的任务数
+    uint64_t executed;   ///< 已执行的任务数
+    uint64_t busy_ns;    ///< 工作线程执行任务的总时间
+    uint64_t uptime_ns;  ///< 线程池运行时间
+    double utilization;  ///< 工作线程利用率，busy_ns / (uptime_ns * threads)
+    uint64_t class_queued[E_TASK_PRIO_CNT];  ///< 各类别排队中的任务数
+    uint64_t class_missed[E_TASK_PRIO_CNT];  ///< 各类别超过截止时间完成的任务数
+    uint64_t rejected;     ///< 队列满被拒绝的任务数
+    uint64_t shed;         ///< 为新任务腾出空间而丢弃的任务数
+    uint64_t caller_runs;  ///< 队列满在调用线程执行的任务数
+};
 
 /**
  * @brief 线程池基类
@@ -31,8 +136,71 @@ public:
     // 退出线程池
     virtual void stop() = 0;
 
-    // 添加任务
-    virtual void add_task(const thread_task_t &task) = 0;
+    // 添加任务，队列满时按溢出策略处理
+    virtual void add_task(thread_task_t &&task) = 0;
+
+    // 按属性添加任务，线程池不支持的属性被忽略
+    virtual void add_task(thread_task_t &&task, const ThreadTaskAttr &attr) {
+        add_task(std::move(task));
+    }
+
+    // 限时添加任务，队列满时等待wait(us)，0不等待，-1一直等待，
+    // 仍然满时按溢出策略处理，未被接收时不会移走任务；
+    // 不支持时按add_task添加
+    virtual thread_task_add_status add_task_for(
+        thread_task_t &&task, int64_t wait,
+        const ThreadTaskAttr &attr = ThreadTaskAttr()) {
+        add_task(std::move(task), attr);
+        return E_TASK_ADD_OK;
+    }
+
+    // 非阻塞添加任务，队列满时立即按溢出策略处理
+    thread_task_add_status try_add_task(
+        thread_task_t &&task, const ThreadTaskAttr &attr = ThreadTaskAttr()) {
+        return add_task_for(std::move(task), 0, attr);
+    }
+
+    // 批量添加任务，attrs为空时按默认属性，队列满时等待wait(us)后按溢出
+    // 策略处理；按顺序添加到第一个未被接收的任务为止，返回被接收(入队或
+    // 在调用线程执行)的任务数，未被接收的任务不会被移走。默认逐个添加
+    virtual size_t add_tasks(thread_task_t *tasks, size_t cnt, int64_t wait,
+                             const ThreadTaskAttr *attrs = nullptr) {
+        for (size_t i = 0; i < cnt; i++) {
+            if (!accepted(add_task_for(std::move(tasks[i]), wait,
+                                       attrs ? attrs[i] : ThreadTaskAttr()))) {
+                return i;
+            }
+        }
+
+        return cnt;
+    }
+
+    // 设置溢出策略，不支持时返回false
+    virtual bool set_overflow_policy(thread_overflow_policy policy) {
+        return false;
+    }
+
+    // 当前溢出策略
+    virtual thread_overflow_policy overflow_policy(void) {
+        return E_TASK_OVERFLOW_BLOCK;
+    }
+
+    // 设置工作线程每次唤醒最多取出的任务数，默认为1；取出的任务只能由
+    // 本线程依次执行，任务之间有等待关系时(如在工作线程内同步调用actor
+    // 插件)不要大于1。不支持时返回false
+    virtual bool set_drain_batch(uint32_t n) { return false; }
+
+    // 运行统计，不支持时返回false
+    virtual bool stat(ThreadPoolStat &stat) { return false; }
+
+    // 当前线程是否为本线程池的工作线程，在其中等待其他任务可能耗尽线程池；
+    // 不支持时返回false
+    virtual bool in_worker(void) { return false; }
+
+    // 任务是否被接收，入队或在调用线程执行
+    static bool accepted(thread_task_add_status status) {
+        return E_TASK_ADD_OK == status || E_TASK_ADD_CALLER_RAN == status;
+    }
 };
 
 }